@@ -0,0 +1,93 @@
+#!/bin/sh
+# Check libclprof.so on bandwidth, ndrangelatency and overalloc-auto
+# (run by `make check`, from the top directory, after building them).
+#
+# By default the tools run on the mock runtime in mock/ (preload/mockcl.c);
+# with ICD=system they run on the installed OpenCL runtime instead.
+# Each tool runs under LD_PRELOAD=./libclprof.so with CLPROF_OUT and
+# CLPROF_TRACE set, and the check fails unless
+#  * the tool exits successfully;
+#  * every successful clEnqueue* call was collected as a completed
+#    command (calls - failed == completed);
+#  * the trace has one device event per completed command, and is closed;
+#  * on the mock, every object created was released.
+
+ICD=${ICD:-mock}
+SRCDIR=${SRCDIR:-src}
+OUT=${OUT:-check.out}
+
+mkdir -p "$OUT" || exit 1
+
+if [ "$ICD" = mock ]; then
+	LD_LIBRARY_PATH=mock${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH}
+	MOCKCL_LIVE=1
+	export LD_LIBRARY_PATH MOCKCL_LIVE
+fi
+
+fail=0
+
+for tool in bandwidth ndrangelatency overalloc-auto; do
+	prof="$OUT/$tool.prof"
+	trace="$OUT/$tool.json"
+	log="$OUT/$tool.log"
+	err="$OUT/$tool.err"
+	rm -f "$prof" "$trace"
+
+	LD_PRELOAD=./libclprof.so CLPROF_OUT="$prof" CLPROF_TRACE="$trace" \
+		"$SRCDIR/$tool" > "$log" 2> "$err"
+	status=$?
+	if [ $status -ne 0 ]; then
+		echo "$tool: FAIL: exited with status $status (see $err)"
+		fail=1
+		continue
+	fi
+
+	# calls - failed of each enqueue in the host table, against completed
+	# in the device table; prints the total completed last
+	if ! completed=$(awk -F '\t' '
+		/^clprof: host time/ { table = "host"; next }
+		/^clprof: device time/ { table = "device"; next }
+		$1 !~ /^clEnqueue/ { next }
+		table == "host" { ok[$1] = $2 - $3 }
+		table == "device" { done[$1] = $2; total += $2 }
+		END {
+			for (c in ok)
+				if (ok[c] != done[c] + 0) {
+					printf "%s: %d successful, %d completed\n", c, ok[c], done[c] > "/dev/stderr"
+					bad = 1
+				}
+			for (c in done)
+				if (!(c in ok)) {
+					printf "%s: completed but never called\n", c > "/dev/stderr"
+					bad = 1
+				}
+			print total + 0
+			exit bad
+		}' "$prof"); then
+		echo "$tool: FAIL: enqueues and completed commands differ (see $prof)"
+		fail=1
+		continue
+	fi
+
+	events=$(grep '"ph":"X"' "$trace" | grep -vc '"pid":0,')
+	if [ "$events" -ne "$completed" ]; then
+		echo "$tool: FAIL: $events device events in the trace, $completed completed commands"
+		fail=1
+		continue
+	fi
+	if [ "$(tail -n 1 "$trace")" != "]" ]; then
+		echo "$tool: FAIL: trace not closed (see $trace)"
+		fail=1
+		continue
+	fi
+
+	if [ "$ICD" = mock ] && ! grep -q '^mockcl: 0 live objects$' "$err"; then
+		echo "$tool: FAIL: objects left alive (see $err)"
+		fail=1
+		continue
+	fi
+
+	echo "$tool: ok, $completed commands"
+done
+
+exit $fail
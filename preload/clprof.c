@@ -0,0 +1,708 @@
+/* OpenCL interception profiler, to be loaded with LD_PRELOAD into any
+ * OpenCL program (these tools or others):
+ *
+ *	LD_PRELOAD=./libclprof.so ./overalloc-auto
+ *
+ * The entry points the tools in this repository use are interposed: the
+ * host time of each call is recorded, and every enqueued command gets an
+ * event (an internal one if the program does not ask for it) whose device
+ * time is collected once it completes. Queues are created with profiling
+ * enabled regardless of what the program asks. At exit, per-call and
+ * per-command statistics are written to stderr, or to the file named by
+ * CLPROF_OUT; setting CLPROF_TRACE to a file name also writes the
+ * timeline of all host calls and commands, as trace.h does.
+ *
+ * Events are only checked for completion at synchronization points
+ * (clFinish, clWaitForEvents, blocking reads, writes and maps) and when
+ * many are pending, so the program is not made to wait on something it
+ * did not wait on itself; the only exception is releasing a queue, before
+ * which the commands pending on that queue are waited for.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <CL/cl.h>
+
+void *real_symbol(const char *name);
+
+// the timeline uses its own variable, so that it does not clash with a
+// program tracing itself; its clock calibration must not go through the
+// interposed entry points
+#define TRACE_ENV "CLPROF_TRACE"
+#define TRACE_REAL(name) ((__typeof__(&name))real_symbol(#name))
+#include "trace.h"
+
+#define PROF_OUT_ENV "CLPROF_OUT"
+
+// pending events are checked for completion every time this many more
+// have been enqueued
+#define PROF_HARVEST_EVERY 1024
+
+enum prof_call {
+	// host-only calls
+	C_CREATE_CONTEXT,
+	C_CREATE_QUEUE,
+	C_RELEASE_QUEUE,
+	C_CREATE_BUFFER,
+	C_RELEASE_MEM,
+	C_BUILD_PROGRAM,
+	C_CREATE_KERNEL,
+	C_SET_KERNEL_ARG,
+	C_FLUSH,
+	C_FINISH,
+	C_WAIT,
+	// enqueues, which also have a device time
+	C_NDRANGE,
+	C_READ,
+	C_WRITE,
+	C_READ_RECT,
+	C_WRITE_RECT,
+	C_COPY,
+	C_COPY_RECT,
+	C_FILL,
+	C_MAP,
+	C_UNMAP,
+	C_MIGRATE,
+	C_MARKER,
+	C_BARRIER,
+	NUM_CALLS
+};
+
+#define FIRST_ENQUEUE C_NDRANGE
+
+const char * const call_name[] = {
+	"clCreateContext",
+	"clCreateCommandQueue",
+	"clReleaseCommandQueue",
+	"clCreateBuffer",
+	"clReleaseMemObject",
+	"clBuildProgram",
+	"clCreateKernel",
+	"clSetKernelArg",
+	"clFlush",
+	"clFinish",
+	"clWaitForEvents",
+	"clEnqueueNDRangeKernel",
+	"clEnqueueReadBuffer",
+	"clEnqueueWriteBuffer",
+	"clEnqueueReadBufferRect",
+	"clEnqueueWriteBufferRect",
+	"clEnqueueCopyBuffer",
+	"clEnqueueCopyBufferRect",
+	"clEnqueueFillBuffer",
+	"clEnqueueMapBuffer",
+	"clEnqueueUnmapMemObject",
+	"clEnqueueMigrateMemObjects",
+	"clEnqueueMarkerWithWaitList",
+	"clEnqueueBarrierWithWaitList",
+};
+
+struct call_stats {
+	cl_ulong calls, failed;
+	double host, host_min, host_max; // seconds
+	cl_ulong commands; // completed commands, for enqueues
+	cl_ulong dev, wait; // START to END and QUEUED to START, ns
+};
+
+struct pending {
+	cl_event evt;
+	enum prof_call call;
+};
+
+pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_once_t prof_once = PTHREAD_ONCE_INIT;
+
+struct call_stats stats[NUM_CALLS];
+
+struct pending *pending;
+size_t npending, max_pending, next_harvest = PROF_HARVEST_EVERY;
+
+// the real entry points, looked up on first use
+void *real_symbol(const char *name)
+{
+	void *sym = dlsym(RTLD_NEXT, name);
+	if (!sym) {
+		fprintf(stderr, "clprof: %s not found: %s\n", name, dlerror());
+		exit(1);
+	}
+	return sym;
+}
+
+#define REAL(name) \
+	static __typeof__(&name) real_##name; \
+	if (!real_##name) \
+		real_##name = (__typeof__(&name))real_symbol(#name)
+
+/* collect the device times of the pending commands that are done; with
+ * wait, wait for all of them first
+ */
+void harvest(int wait)
+{
+	REAL(clWaitForEvents);
+	size_t kept = 0;
+
+	for (size_t i = 0; i < npending; ++i) {
+		struct pending *pd = pending + i;
+		cl_int status;
+		cl_ulong queued, start, end;
+
+		if (wait)
+			real_clWaitForEvents(1, &pd->evt);
+		if (clGetEventInfo(pd->evt, CL_EVENT_COMMAND_EXECUTION_STATUS,
+				sizeof(status), &status, NULL) != CL_SUCCESS)
+			status = -1;
+		if (status > CL_COMPLETE) {
+			pending[kept++] = *pd;
+			continue;
+		}
+		if (status == CL_COMPLETE &&
+			clGetEventProfilingInfo(pd->evt, CL_PROFILING_COMMAND_QUEUED,
+				sizeof(queued), &queued, NULL) == CL_SUCCESS &&
+			clGetEventProfilingInfo(pd->evt, CL_PROFILING_COMMAND_START,
+				sizeof(start), &start, NULL) == CL_SUCCESS &&
+			clGetEventProfilingInfo(pd->evt, CL_PROFILING_COMMAND_END,
+				sizeof(end), &end, NULL) == CL_SUCCESS) {
+			struct call_stats *s = stats + pd->call;
+			++s->commands;
+			s->dev += end - start;
+			s->wait += start - queued;
+			trace_event(pd->evt, call_name[pd->call]);
+		}
+		clReleaseEvent(pd->evt);
+	}
+	npending = kept;
+	next_harvest = npending + PROF_HARVEST_EVERY;
+}
+
+void print_stats(FILE *out)
+{
+	fputs("clprof: host time per call\n", out);
+	fputs("call\tcalls\tfailed\ttotal (ms)\tavg (us)\tmin (us)\tmax (us)\n", out);
+	for (enum prof_call c = 0; c < NUM_CALLS; ++c) {
+		const struct call_stats *s = stats + c;
+		if (!s->calls)
+			continue;
+		fprintf(out, "%s\t%lu\t%lu\t%.6g\t%.6g\t%.6g\t%.6g\n", call_name[c],
+			s->calls, s->failed, s->host*1.0e3, s->host/s->calls*1.0e6,
+			s->host_min*1.0e6, s->host_max*1.0e6);
+	}
+
+	fputs("clprof: device time per command\n", out);
+	fputs("command\tcompleted\ttotal (ms)\tavg (us)\tavg wait (us)\n", out);
+	for (enum prof_call c = FIRST_ENQUEUE; c < NUM_CALLS; ++c) {
+		const struct call_stats *s = stats + c;
+		if (!s->commands)
+			continue;
+		fprintf(out, "%s\t%lu\t%.6g\t%.6g\t%.6g\n", call_name[c],
+			s->commands, s->dev*1.0e-6, s->dev*1.0e-3/s->commands,
+			s->wait*1.0e-3/s->commands);
+	}
+}
+
+void prof_exit(void)
+{
+	const char *fname = getenv(PROF_OUT_ENV);
+	FILE *out = stderr;
+
+	pthread_mutex_lock(&prof_lock);
+	harvest(1);
+	free(pending);
+	pending = NULL;
+	npending = max_pending = 0;
+
+	if (fname && *fname) {
+		out = fopen(fname, "w");
+		if (!out) {
+			perror(fname);
+			out = stderr;
+		}
+	}
+	print_stats(out);
+	if (out != stderr)
+		fclose(out);
+	pthread_mutex_unlock(&prof_lock);
+}
+
+void prof_init(void)
+{
+	// the trace must be closed after the last events are collected,
+	// and exit handlers run in reverse order
+	trace_enabled();
+	atexit(prof_exit);
+}
+
+// account a call that took since start
+void account(enum prof_call c, double start, cl_int ret)
+{
+	const double t = trace_clock() - start;
+	struct call_stats *s = stats + c;
+
+	pthread_once(&prof_once, prof_init);
+	pthread_mutex_lock(&prof_lock);
+	if (!s->calls || t < s->host_min)
+		s->host_min = t;
+	if (t > s->host_max)
+		s->host_max = t;
+	s->host += t;
+	++s->calls;
+	if (ret != CL_SUCCESS)
+		++s->failed;
+	trace_host(call_name[c], start);
+	pthread_mutex_unlock(&prof_lock);
+}
+
+/* account an enqueue, and keep its event for the device time: the
+ * program's own event (retained), if it asked for one, otherwise own
+ */
+void account_enqueue(enum prof_call c, double start, cl_int ret, cl_event *evt, cl_event own)
+{
+	account(c, start, ret);
+	if (ret != CL_SUCCESS)
+		return;
+	if (evt)
+		clRetainEvent(own = *evt);
+
+	pthread_mutex_lock(&prof_lock);
+	if (npending == max_pending) {
+		max_pending = max_pending ? 2*max_pending : PROF_HARVEST_EVERY;
+		pending = realloc(pending, max_pending*sizeof(*pending));
+		if (!pending) {
+			fputs("clprof: couldn't allocate pending events\n", stderr);
+			exit(1);
+		}
+	}
+	pending[npending].evt = own;
+	pending[npending].call = c;
+	++npending;
+	if (npending >= next_harvest)
+		harvest(0);
+	pthread_mutex_unlock(&prof_lock);
+}
+
+// check pending events after the program synchronized
+void synchronized(void)
+{
+	pthread_mutex_lock(&prof_lock);
+	harvest(0);
+	pthread_mutex_unlock(&prof_lock);
+}
+
+// add a new queue to the trace, so that its device clock is calibrated now
+void queue_created(cl_command_queue cq)
+{
+	if (!cq)
+		return;
+	pthread_mutex_lock(&prof_lock);
+	if (trace_enabled())
+		trace_queue_index(cq);
+	pthread_mutex_unlock(&prof_lock);
+}
+
+/* wait for the commands pending on cq, and collect them; the waiting is
+ * done without holding the lock, so that other threads and queues are
+ * not held up
+ */
+void drain_queue(cl_command_queue cq)
+{
+	REAL(clWaitForEvents);
+	cl_event *mine = NULL;
+	size_t nmine = 0;
+
+	pthread_mutex_lock(&prof_lock);
+	if (npending)
+		mine = malloc(npending*sizeof(*mine));
+	for (size_t i = 0; mine && i < npending; ++i) {
+		cl_command_queue eq;
+		if (clGetEventInfo(pending[i].evt, CL_EVENT_COMMAND_QUEUE, sizeof(eq), &eq, NULL) == CL_SUCCESS &&
+			eq == cq) {
+			clRetainEvent(pending[i].evt);
+			mine[nmine++] = pending[i].evt;
+		}
+	}
+	pthread_mutex_unlock(&prof_lock);
+
+	for (size_t i = 0; i < nmine; ++i) {
+		real_clWaitForEvents(1, mine + i);
+		clReleaseEvent(mine[i]);
+	}
+	free(mine);
+	synchronized();
+}
+
+/* Host-only calls */
+
+CL_API_ENTRY cl_context CL_API_CALL
+clCreateContext(const cl_context_properties *props, cl_uint ndev, const cl_device_id *devs,
+	void (CL_CALLBACK *notify)(const char *, const void *, size_t, void *), void *data,
+	cl_int *err)
+{
+	REAL(clCreateContext);
+	cl_int ret;
+	const double start = trace_clock();
+	cl_context c = real_clCreateContext(props, ndev, devs, notify, data, &ret);
+	account(C_CREATE_CONTEXT, start, ret);
+	if (err)
+		*err = ret;
+	return c;
+}
+
+CL_API_ENTRY cl_command_queue CL_API_CALL
+clCreateCommandQueue(cl_context c, cl_device_id dev, cl_command_queue_properties props,
+	cl_int *err)
+{
+	REAL(clCreateCommandQueue);
+	cl_int ret;
+	const double start = trace_clock();
+	cl_command_queue cq = real_clCreateCommandQueue(c, dev,
+		props | CL_QUEUE_PROFILING_ENABLE, &ret);
+	account(C_CREATE_QUEUE, start, ret);
+	queue_created(cq);
+	if (err)
+		*err = ret;
+	return cq;
+}
+
+#ifdef CL_VERSION_2_0
+// properties of clCreateCommandQueueWithProperties we can handle, beyond
+// the terminating 0
+#define MAX_QUEUE_PROPS 16
+
+CL_API_ENTRY cl_command_queue CL_API_CALL
+clCreateCommandQueueWithProperties(cl_context c, cl_device_id dev,
+	const cl_queue_properties *props, cl_int *err)
+{
+	REAL(clCreateCommandQueueWithProperties);
+	cl_queue_properties prof_props[MAX_QUEUE_PROPS + 3];
+	const cl_queue_properties *use = prof_props;
+	cl_uint n = 0;
+	int found = 0;
+	cl_int ret;
+
+	// copy the properties, adding profiling to CL_QUEUE_PROPERTIES,
+	// or adding that if missing
+	for (; props && props[n] && n < MAX_QUEUE_PROPS; n += 2) {
+		prof_props[n] = props[n];
+		prof_props[n + 1] = props[n + 1];
+		if (props[n] == CL_QUEUE_PROPERTIES) {
+			prof_props[n + 1] |= CL_QUEUE_PROFILING_ENABLE;
+			found = 1;
+		}
+	}
+	if (props && props[n]) {
+		// too many to handle, leave them alone
+		use = props;
+	} else {
+		if (!found) {
+			prof_props[n++] = CL_QUEUE_PROPERTIES;
+			prof_props[n++] = CL_QUEUE_PROFILING_ENABLE;
+		}
+		prof_props[n] = 0;
+	}
+
+	const double start = trace_clock();
+	cl_command_queue cq = real_clCreateCommandQueueWithProperties(c, dev, use, &ret);
+	account(C_CREATE_QUEUE, start, ret);
+	queue_created(cq);
+	if (err)
+		*err = ret;
+	return cq;
+}
+#endif
+
+CL_API_ENTRY cl_int CL_API_CALL
+clReleaseCommandQueue(cl_command_queue cq)
+{
+	REAL(clReleaseCommandQueue);
+	// collect what ran on it while the queue is surely still there
+	drain_queue(cq);
+	const double start = trace_clock();
+	cl_int ret = real_clReleaseCommandQueue(cq);
+	account(C_RELEASE_QUEUE, start, ret);
+	return ret;
+}
+
+CL_API_ENTRY cl_mem CL_API_CALL
+clCreateBuffer(cl_context c, cl_mem_flags flags, size_t size, void *host_ptr, cl_int *err)
+{
+	REAL(clCreateBuffer);
+	cl_int ret;
+	const double start = trace_clock();
+	cl_mem m = real_clCreateBuffer(c, flags, size, host_ptr, &ret);
+	account(C_CREATE_BUFFER, start, ret);
+	if (err)
+		*err = ret;
+	return m;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clReleaseMemObject(cl_mem m)
+{
+	REAL(clReleaseMemObject);
+	const double start = trace_clock();
+	cl_int ret = real_clReleaseMemObject(m);
+	account(C_RELEASE_MEM, start, ret);
+	return ret;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clBuildProgram(cl_program pg, cl_uint ndev, const cl_device_id *devs, const char *options,
+	void (CL_CALLBACK *notify)(cl_program, void *), void *data)
+{
+	REAL(clBuildProgram);
+	const double start = trace_clock();
+	cl_int ret = real_clBuildProgram(pg, ndev, devs, options, notify, data);
+	account(C_BUILD_PROGRAM, start, ret);
+	return ret;
+}
+
+CL_API_ENTRY cl_kernel CL_API_CALL
+clCreateKernel(cl_program pg, const char *name, cl_int *err)
+{
+	REAL(clCreateKernel);
+	cl_int ret;
+	const double start = trace_clock();
+	cl_kernel kn = real_clCreateKernel(pg, name, &ret);
+	account(C_CREATE_KERNEL, start, ret);
+	if (err)
+		*err = ret;
+	return kn;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clSetKernelArg(cl_kernel kn, cl_uint idx, size_t size, const void *value)
+{
+	REAL(clSetKernelArg);
+	const double start = trace_clock();
+	cl_int ret = real_clSetKernelArg(kn, idx, size, value);
+	account(C_SET_KERNEL_ARG, start, ret);
+	return ret;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clFlush(cl_command_queue cq)
+{
+	REAL(clFlush);
+	const double start = trace_clock();
+	cl_int ret = real_clFlush(cq);
+	account(C_FLUSH, start, ret);
+	return ret;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clFinish(cl_command_queue cq)
+{
+	REAL(clFinish);
+	const double start = trace_clock();
+	cl_int ret = real_clFinish(cq);
+	account(C_FINISH, start, ret);
+	synchronized();
+	return ret;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clWaitForEvents(cl_uint nevt, const cl_event *evts)
+{
+	REAL(clWaitForEvents);
+	const double start = trace_clock();
+	cl_int ret = real_clWaitForEvents(nevt, evts);
+	account(C_WAIT, start, ret);
+	synchronized();
+	return ret;
+}
+
+/* Enqueues */
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueNDRangeKernel(cl_command_queue cq, cl_kernel kn, cl_uint dim,
+	const size_t *offset, const size_t *gws, const size_t *lws,
+	cl_uint nwait, const cl_event *wait, cl_event *evt)
+{
+	REAL(clEnqueueNDRangeKernel);
+	cl_event own;
+	const double start = trace_clock();
+	cl_int ret = real_clEnqueueNDRangeKernel(cq, kn, dim, offset, gws, lws,
+		nwait, wait, evt ? evt : &own);
+	account_enqueue(C_NDRANGE, start, ret, evt, own);
+	return ret;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueReadBuffer(cl_command_queue cq, cl_mem m, cl_bool blocking, size_t offset,
+	size_t size, void *ptr, cl_uint nwait, const cl_event *wait, cl_event *evt)
+{
+	REAL(clEnqueueReadBuffer);
+	cl_event own;
+	const double start = trace_clock();
+	cl_int ret = real_clEnqueueReadBuffer(cq, m, blocking, offset, size, ptr,
+		nwait, wait, evt ? evt : &own);
+	account_enqueue(C_READ, start, ret, evt, own);
+	if (blocking)
+		synchronized();
+	return ret;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueWriteBuffer(cl_command_queue cq, cl_mem m, cl_bool blocking, size_t offset,
+	size_t size, const void *ptr, cl_uint nwait, const cl_event *wait, cl_event *evt)
+{
+	REAL(clEnqueueWriteBuffer);
+	cl_event own;
+	const double start = trace_clock();
+	cl_int ret = real_clEnqueueWriteBuffer(cq, m, blocking, offset, size, ptr,
+		nwait, wait, evt ? evt : &own);
+	account_enqueue(C_WRITE, start, ret, evt, own);
+	if (blocking)
+		synchronized();
+	return ret;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueReadBufferRect(cl_command_queue cq, cl_mem m, cl_bool blocking,
+	const size_t *buf_origin, const size_t *host_origin, const size_t *region,
+	size_t buf_row, size_t buf_slice, size_t host_row, size_t host_slice, void *ptr,
+	cl_uint nwait, const cl_event *wait, cl_event *evt)
+{
+	REAL(clEnqueueReadBufferRect);
+	cl_event own;
+	const double start = trace_clock();
+	cl_int ret = real_clEnqueueReadBufferRect(cq, m, blocking, buf_origin, host_origin,
+		region, buf_row, buf_slice, host_row, host_slice, ptr,
+		nwait, wait, evt ? evt : &own);
+	account_enqueue(C_READ_RECT, start, ret, evt, own);
+	if (blocking)
+		synchronized();
+	return ret;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueWriteBufferRect(cl_command_queue cq, cl_mem m, cl_bool blocking,
+	const size_t *buf_origin, const size_t *host_origin, const size_t *region,
+	size_t buf_row, size_t buf_slice, size_t host_row, size_t host_slice, const void *ptr,
+	cl_uint nwait, const cl_event *wait, cl_event *evt)
+{
+	REAL(clEnqueueWriteBufferRect);
+	cl_event own;
+	const double start = trace_clock();
+	cl_int ret = real_clEnqueueWriteBufferRect(cq, m, blocking, buf_origin, host_origin,
+		region, buf_row, buf_slice, host_row, host_slice, ptr,
+		nwait, wait, evt ? evt : &own);
+	account_enqueue(C_WRITE_RECT, start, ret, evt, own);
+	if (blocking)
+		synchronized();
+	return ret;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueCopyBuffer(cl_command_queue cq, cl_mem src, cl_mem dst, size_t src_offset,
+	size_t dst_offset, size_t size, cl_uint nwait, const cl_event *wait, cl_event *evt)
+{
+	REAL(clEnqueueCopyBuffer);
+	cl_event own;
+	const double start = trace_clock();
+	cl_int ret = real_clEnqueueCopyBuffer(cq, src, dst, src_offset, dst_offset, size,
+		nwait, wait, evt ? evt : &own);
+	account_enqueue(C_COPY, start, ret, evt, own);
+	return ret;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueCopyBufferRect(cl_command_queue cq, cl_mem src, cl_mem dst,
+	const size_t *src_origin, const size_t *dst_origin, const size_t *region,
+	size_t src_row, size_t src_slice, size_t dst_row, size_t dst_slice,
+	cl_uint nwait, const cl_event *wait, cl_event *evt)
+{
+	REAL(clEnqueueCopyBufferRect);
+	cl_event own;
+	const double start = trace_clock();
+	cl_int ret = real_clEnqueueCopyBufferRect(cq, src, dst, src_origin, dst_origin,
+		region, src_row, src_slice, dst_row, dst_slice,
+		nwait, wait, evt ? evt : &own);
+	account_enqueue(C_COPY_RECT, start, ret, evt, own);
+	return ret;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueFillBuffer(cl_command_queue cq, cl_mem m, const void *patt, size_t patt_size,
+	size_t offset, size_t size, cl_uint nwait, const cl_event *wait, cl_event *evt)
+{
+	REAL(clEnqueueFillBuffer);
+	cl_event own;
+	const double start = trace_clock();
+	cl_int ret = real_clEnqueueFillBuffer(cq, m, patt, patt_size, offset, size,
+		nwait, wait, evt ? evt : &own);
+	account_enqueue(C_FILL, start, ret, evt, own);
+	return ret;
+}
+
+CL_API_ENTRY void * CL_API_CALL
+clEnqueueMapBuffer(cl_command_queue cq, cl_mem m, cl_bool blocking, cl_map_flags flags,
+	size_t offset, size_t size, cl_uint nwait, const cl_event *wait, cl_event *evt,
+	cl_int *err)
+{
+	REAL(clEnqueueMapBuffer);
+	cl_event own;
+	cl_int ret;
+	const double start = trace_clock();
+	void *ptr = real_clEnqueueMapBuffer(cq, m, blocking, flags, offset, size,
+		nwait, wait, evt ? evt : &own, &ret);
+	account_enqueue(C_MAP, start, ret, evt, own);
+	if (blocking)
+		synchronized();
+	if (err)
+		*err = ret;
+	return ptr;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueUnmapMemObject(cl_command_queue cq, cl_mem m, void *ptr,
+	cl_uint nwait, const cl_event *wait, cl_event *evt)
+{
+	REAL(clEnqueueUnmapMemObject);
+	cl_event own;
+	const double start = trace_clock();
+	cl_int ret = real_clEnqueueUnmapMemObject(cq, m, ptr, nwait, wait, evt ? evt : &own);
+	account_enqueue(C_UNMAP, start, ret, evt, own);
+	return ret;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueMigrateMemObjects(cl_command_queue cq, cl_uint nmem, const cl_mem *mems,
+	cl_mem_migration_flags flags, cl_uint nwait, const cl_event *wait, cl_event *evt)
+{
+	REAL(clEnqueueMigrateMemObjects);
+	cl_event own;
+	const double start = trace_clock();
+	cl_int ret = real_clEnqueueMigrateMemObjects(cq, nmem, mems, flags,
+		nwait, wait, evt ? evt : &own);
+	account_enqueue(C_MIGRATE, start, ret, evt, own);
+	return ret;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueMarkerWithWaitList(cl_command_queue cq, cl_uint nwait, const cl_event *wait,
+	cl_event *evt)
+{
+	REAL(clEnqueueMarkerWithWaitList);
+	cl_event own;
+	const double start = trace_clock();
+	cl_int ret = real_clEnqueueMarkerWithWaitList(cq, nwait, wait, evt ? evt : &own);
+	account_enqueue(C_MARKER, start, ret, evt, own);
+	return ret;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueBarrierWithWaitList(cl_command_queue cq, cl_uint nwait, const cl_event *wait,
+	cl_event *evt)
+{
+	REAL(clEnqueueBarrierWithWaitList);
+	cl_event own;
+	const double start = trace_clock();
+	cl_int ret = real_clEnqueueBarrierWithWaitList(cq, nwait, wait, evt ? evt : &own);
+	account_enqueue(C_BARRIER, start, ret, evt, own);
+	return ret;
+}
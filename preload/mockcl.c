@@ -0,0 +1,644 @@
+/* Mock OpenCL runtime, to check libclprof.so without an OpenCL platform
+ * (see check.sh). Built as a libOpenCL.so.1 that the tools load instead
+ * of the ICD loader:
+ *
+ *	make check
+ *
+ * There is one platform with one CPU device. Commands run synchronously
+ * on the host when they are enqueued, so every event is complete when
+ * its enqueue returns; its QUEUED, SUBMIT and START times are those of
+ * the enqueue, and END and COMPLETE when the command is done, on the
+ * CLOCK_MONOTONIC clock. Programs are not compiled: kernels are emulated
+ * by name, for the ones of bandwidth (set, add), ndrangelatency (nop)
+ * and verify.h (init, verify); any other kernel does nothing.
+ *
+ * Only the entry points used by bandwidth, ndrangelatency and
+ * overalloc-auto are provided. Setting MOCKCL_LIVE prints the number of
+ * objects still alive at exit on stderr, which must be 0 for a program
+ * that releases everything it creates.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <CL/cl.h>
+
+#define MOCK_GMEM (256UL*1024*1024)
+#define MOCK_MAX_ARGS 8
+#define MOCK_ARGSZ 16
+#define MOCK_NAMESZ 64
+
+struct _cl_platform_id { int unused; };
+struct _cl_device_id { int unused; };
+
+struct _cl_context {
+	cl_uint ref;
+};
+
+struct _cl_command_queue {
+	cl_uint ref;
+	cl_context ctx;
+	cl_command_queue_properties props;
+};
+
+struct _cl_mem {
+	cl_uint ref;
+	char *ptr;
+	size_t size;
+	int own; // ptr was allocated by the mock
+};
+
+struct _cl_program {
+	cl_uint ref;
+	cl_context ctx;
+};
+
+struct _cl_kernel {
+	cl_uint ref;
+	cl_program pg;
+	char name[MOCK_NAMESZ];
+	unsigned char arg[MOCK_MAX_ARGS][MOCK_ARGSZ];
+};
+
+struct _cl_event {
+	cl_uint ref;
+	cl_command_queue q;
+	cl_command_type type;
+	cl_ulong time[4]; // queued, submit, start, end
+};
+
+struct _cl_platform_id mock_platform;
+struct _cl_device_id mock_device;
+
+// objects created and not released yet
+long mock_live;
+
+void __attribute__((destructor)) mock_report(void)
+{
+	if (getenv("MOCKCL_LIVE"))
+		fprintf(stderr, "mockcl: %ld live objects\n", mock_live);
+}
+
+cl_ulong mock_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000UL + ts.tv_nsec;
+}
+
+void *mock_object(size_t size, cl_int *err)
+{
+	void *obj = calloc(1, size);
+	if (!obj) {
+		if (err)
+			*err = CL_OUT_OF_HOST_MEMORY;
+		return NULL;
+	}
+	++mock_live;
+	if (err)
+		*err = CL_SUCCESS;
+	return obj;
+}
+
+void mock_free(void *obj)
+{
+	free(obj);
+	--mock_live;
+}
+
+// answer a query with size bytes from value
+cl_int mock_info(const void *value, size_t size, size_t param_size, void *param,
+	size_t *param_size_ret)
+{
+	if (param_size_ret)
+		*param_size_ret = size;
+	if (param) {
+		if (param_size < size)
+			return CL_INVALID_VALUE;
+		memcpy(param, value, size);
+	}
+	return CL_SUCCESS;
+}
+
+#define INFO(value) mock_info(&(value), sizeof(value), param_size, param, param_size_ret)
+#define INFO_STR(str) mock_info(str, strlen(str) + 1, param_size, param, param_size_ret)
+
+/* Platform and device */
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetPlatformIDs(cl_uint nentries, cl_platform_id *platforms, cl_uint *nplatforms)
+{
+	if (nplatforms)
+		*nplatforms = 1;
+	if (nentries && platforms)
+		platforms[0] = &mock_platform;
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetPlatformInfo(cl_platform_id p, cl_platform_info what, size_t param_size, void *param,
+	size_t *param_size_ret)
+{
+	switch (what) {
+	case CL_PLATFORM_NAME:
+		return INFO_STR("Mock platform");
+	case CL_PLATFORM_VERSION:
+		return INFO_STR("OpenCL 1.2 mock");
+	default:
+		return INFO_STR("");
+	}
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetDeviceIDs(cl_platform_id p, cl_device_type type, cl_uint nentries, cl_device_id *devices,
+	cl_uint *ndevices)
+{
+	if (!(type & CL_DEVICE_TYPE_CPU))
+		return CL_DEVICE_NOT_FOUND;
+	if (ndevices)
+		*ndevices = 1;
+	if (nentries && devices)
+		devices[0] = &mock_device;
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetDeviceInfo(cl_device_id d, cl_device_info what, size_t param_size, void *param,
+	size_t *param_size_ret)
+{
+	const cl_device_type type = CL_DEVICE_TYPE_CPU;
+	const cl_ulong gmem = MOCK_GMEM, alloc_max = MOCK_GMEM/4;
+	const cl_uint base_align = 1024; // bits
+	const cl_uint units = 4;
+	const size_t wg_size = 256;
+	const cl_platform_id p = &mock_platform;
+	const cl_ulong zero = 0;
+
+	switch (what) {
+	case CL_DEVICE_NAME:
+		return INFO_STR("Mock device");
+	case CL_DEVICE_VERSION:
+		return INFO_STR("OpenCL 1.2 mock");
+	case CL_DEVICE_TYPE:
+		return INFO(type);
+	case CL_DEVICE_GLOBAL_MEM_SIZE:
+		return INFO(gmem);
+	case CL_DEVICE_MAX_MEM_ALLOC_SIZE:
+		return INFO(alloc_max);
+	case CL_DEVICE_MEM_BASE_ADDR_ALIGN:
+		return INFO(base_align);
+	case CL_DEVICE_MAX_COMPUTE_UNITS:
+		return INFO(units);
+	case CL_DEVICE_MAX_WORK_GROUP_SIZE:
+		return INFO(wg_size);
+	case CL_DEVICE_PLATFORM:
+		return INFO(p);
+	default:
+		// anything else is unsupported: zero, of whatever size is asked
+		if (param && param_size < sizeof(zero)) {
+			memset(param, 0, param_size);
+			return CL_SUCCESS;
+		}
+		return INFO(zero);
+	}
+}
+
+/* Context and queues */
+
+CL_API_ENTRY cl_context CL_API_CALL
+clCreateContext(const cl_context_properties *props, cl_uint ndev, const cl_device_id *devs,
+	void (CL_CALLBACK *notify)(const char *, const void *, size_t, void *),
+	void *user_data, cl_int *err)
+{
+	cl_context c = mock_object(sizeof(*c), err);
+	if (c)
+		c->ref = 1;
+	return c;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clRetainContext(cl_context c)
+{
+	++c->ref;
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clReleaseContext(cl_context c)
+{
+	if (!--c->ref)
+		mock_free(c);
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_command_queue CL_API_CALL
+clCreateCommandQueue(cl_context c, cl_device_id d, cl_command_queue_properties props,
+	cl_int *err)
+{
+	cl_command_queue q = mock_object(sizeof(*q), err);
+	if (q) {
+		q->ref = 1;
+		q->ctx = c;
+		q->props = props;
+		clRetainContext(c);
+	}
+	return q;
+}
+
+#ifdef CL_VERSION_2_0
+// there are no device queues, and host queues are created with the 1.x call
+CL_API_ENTRY cl_command_queue CL_API_CALL
+clCreateCommandQueueWithProperties(cl_context c, cl_device_id d,
+	const cl_queue_properties *props, cl_int *err)
+{
+	if (err)
+		*err = CL_INVALID_QUEUE_PROPERTIES;
+	return NULL;
+}
+#endif
+
+CL_API_ENTRY cl_int CL_API_CALL
+clRetainCommandQueue(cl_command_queue q)
+{
+	++q->ref;
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clReleaseCommandQueue(cl_command_queue q)
+{
+	if (!--q->ref) {
+		clReleaseContext(q->ctx);
+		mock_free(q);
+	}
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetCommandQueueInfo(cl_command_queue q, cl_command_queue_info what, size_t param_size,
+	void *param, size_t *param_size_ret)
+{
+	const cl_device_id d = &mock_device;
+
+	switch (what) {
+	case CL_QUEUE_CONTEXT:
+		return INFO(q->ctx);
+	case CL_QUEUE_DEVICE:
+		return INFO(d);
+	case CL_QUEUE_REFERENCE_COUNT:
+		return INFO(q->ref);
+	case CL_QUEUE_PROPERTIES:
+		return INFO(q->props);
+	default:
+		return CL_INVALID_VALUE;
+	}
+}
+
+// commands are done when enqueued
+CL_API_ENTRY cl_int CL_API_CALL
+clFlush(cl_command_queue q)
+{
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clFinish(cl_command_queue q)
+{
+	return CL_SUCCESS;
+}
+
+/* Buffers */
+
+CL_API_ENTRY cl_mem CL_API_CALL
+clCreateBuffer(cl_context c, cl_mem_flags flags, size_t size, void *host_ptr, cl_int *err)
+{
+	cl_mem m = mock_object(sizeof(*m), err);
+	if (!m)
+		return NULL;
+	m->ref = 1;
+	m->size = size;
+	if (flags & CL_MEM_USE_HOST_PTR) {
+		m->ptr = host_ptr;
+		return m;
+	}
+	m->ptr = malloc(size);
+	if (!m->ptr) {
+		mock_free(m);
+		if (err)
+			*err = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+		return NULL;
+	}
+	m->own = 1;
+	if (flags & CL_MEM_COPY_HOST_PTR)
+		memcpy(m->ptr, host_ptr, size);
+	return m;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clRetainMemObject(cl_mem m)
+{
+	++m->ref;
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clReleaseMemObject(cl_mem m)
+{
+	if (!--m->ref) {
+		if (m->own)
+			free(m->ptr);
+		mock_free(m);
+	}
+	return CL_SUCCESS;
+}
+
+/* Programs and kernels */
+
+CL_API_ENTRY cl_program CL_API_CALL
+clCreateProgramWithSource(cl_context c, cl_uint count, const char **strings,
+	const size_t *lengths, cl_int *err)
+{
+	cl_program pg = mock_object(sizeof(*pg), err);
+	if (pg) {
+		pg->ref = 1;
+		pg->ctx = c;
+		clRetainContext(c);
+	}
+	return pg;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clReleaseProgram(cl_program pg)
+{
+	if (!--pg->ref) {
+		clReleaseContext(pg->ctx);
+		mock_free(pg);
+	}
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clBuildProgram(cl_program pg, cl_uint ndev, const cl_device_id *devs, const char *options,
+	void (CL_CALLBACK *notify)(cl_program, void *), void *user_data)
+{
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetProgramBuildInfo(cl_program pg, cl_device_id d, cl_program_build_info what,
+	size_t param_size, void *param, size_t *param_size_ret)
+{
+	return INFO_STR("");
+}
+
+CL_API_ENTRY cl_kernel CL_API_CALL
+clCreateKernel(cl_program pg, const char *name, cl_int *err)
+{
+	cl_kernel k = mock_object(sizeof(*k), err);
+	if (k) {
+		k->ref = 1;
+		k->pg = pg;
+		++pg->ref;
+		snprintf(k->name, sizeof(k->name), "%s", name);
+	}
+	return k;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clReleaseKernel(cl_kernel k)
+{
+	if (!--k->ref) {
+		clReleaseProgram(k->pg);
+		mock_free(k);
+	}
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clSetKernelArg(cl_kernel k, cl_uint idx, size_t size, const void *value)
+{
+	if (idx >= MOCK_MAX_ARGS || size > MOCK_ARGSZ)
+		return CL_INVALID_ARG_INDEX;
+	memcpy(k->arg[idx], value, size);
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetKernelWorkGroupInfo(cl_kernel k, cl_device_id d, cl_kernel_work_group_info what,
+	size_t param_size, void *param, size_t *param_size_ret)
+{
+	const size_t size = what == CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE ? 8 : 256;
+	return INFO(size);
+}
+
+/* Events */
+
+// give the command, done now, an event if asked for one
+void mock_event(cl_command_queue q, cl_command_type type, cl_ulong queued, cl_event *evt)
+{
+	if (!evt)
+		return;
+	cl_event e = mock_object(sizeof(*e), NULL);
+	e->ref = 1;
+	e->q = q;
+	e->type = type;
+	e->time[0] = e->time[1] = e->time[2] = queued;
+	e->time[3] = mock_ns();
+	clRetainCommandQueue(q);
+	*evt = e;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clWaitForEvents(cl_uint nevt, const cl_event *evts)
+{
+	return nevt && evts ? CL_SUCCESS : CL_INVALID_VALUE;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clRetainEvent(cl_event e)
+{
+	++e->ref;
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clReleaseEvent(cl_event e)
+{
+	if (!--e->ref) {
+		clReleaseCommandQueue(e->q);
+		mock_free(e);
+	}
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetEventInfo(cl_event e, cl_event_info what, size_t param_size, void *param,
+	size_t *param_size_ret)
+{
+	const cl_int status = CL_COMPLETE;
+
+	switch (what) {
+	case CL_EVENT_COMMAND_QUEUE:
+		return INFO(e->q);
+	case CL_EVENT_CONTEXT:
+		return INFO(e->q->ctx);
+	case CL_EVENT_COMMAND_TYPE:
+		return INFO(e->type);
+	case CL_EVENT_COMMAND_EXECUTION_STATUS:
+		return INFO(status);
+	case CL_EVENT_REFERENCE_COUNT:
+		return INFO(e->ref);
+	default:
+		return CL_INVALID_VALUE;
+	}
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetEventProfilingInfo(cl_event e, cl_profiling_info what, size_t param_size, void *param,
+	size_t *param_size_ret)
+{
+	if (!(e->q->props & CL_QUEUE_PROFILING_ENABLE))
+		return CL_PROFILING_INFO_NOT_AVAILABLE;
+	switch (what) {
+	case CL_PROFILING_COMMAND_QUEUED:
+		return INFO(e->time[0]);
+	case CL_PROFILING_COMMAND_SUBMIT:
+		return INFO(e->time[1]);
+	case CL_PROFILING_COMMAND_START:
+		return INFO(e->time[2]);
+	case CL_PROFILING_COMMAND_END:
+#ifdef CL_VERSION_2_0
+	case CL_PROFILING_COMMAND_COMPLETE:
+#endif
+		return INFO(e->time[3]);
+	default:
+		return CL_INVALID_VALUE;
+	}
+}
+
+/* Enqueues: the wait lists can be ignored, since everything before them
+ * is done already
+ */
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueReadBuffer(cl_command_queue q, cl_mem m, cl_bool blocking, size_t offset,
+	size_t size, void *ptr, cl_uint nwait, const cl_event *wait, cl_event *evt)
+{
+	const cl_ulong queued = mock_ns();
+	if (offset + size > m->size)
+		return CL_INVALID_VALUE;
+	memcpy(ptr, m->ptr + offset, size);
+	mock_event(q, CL_COMMAND_READ_BUFFER, queued, evt);
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueWriteBuffer(cl_command_queue q, cl_mem m, cl_bool blocking, size_t offset,
+	size_t size, const void *ptr, cl_uint nwait, const cl_event *wait, cl_event *evt)
+{
+	const cl_ulong queued = mock_ns();
+	if (offset + size > m->size)
+		return CL_INVALID_VALUE;
+	memcpy(m->ptr + offset, ptr, size);
+	mock_event(q, CL_COMMAND_WRITE_BUFFER, queued, evt);
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueFillBuffer(cl_command_queue q, cl_mem m, const void *patt, size_t patt_size,
+	size_t offset, size_t size, cl_uint nwait, const cl_event *wait, cl_event *evt)
+{
+	const cl_ulong queued = mock_ns();
+	if (offset + size > m->size || !patt_size || size % patt_size)
+		return CL_INVALID_VALUE;
+	for (size_t i = 0; i < size; i += patt_size)
+		memcpy(m->ptr + offset + i, patt, patt_size);
+	mock_event(q, CL_COMMAND_FILL_BUFFER, queued, evt);
+	return CL_SUCCESS;
+}
+
+// buffers are always in host memory: maps return it directly
+CL_API_ENTRY void * CL_API_CALL
+clEnqueueMapBuffer(cl_command_queue q, cl_mem m, cl_bool blocking, cl_map_flags flags,
+	size_t offset, size_t size, cl_uint nwait, const cl_event *wait, cl_event *evt,
+	cl_int *err)
+{
+	const cl_ulong queued = mock_ns();
+	if (offset + size > m->size) {
+		if (err)
+			*err = CL_INVALID_VALUE;
+		return NULL;
+	}
+	mock_event(q, CL_COMMAND_MAP_BUFFER, queued, evt);
+	if (err)
+		*err = CL_SUCCESS;
+	return m->ptr + offset;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueUnmapMemObject(cl_command_queue q, cl_mem m, void *ptr, cl_uint nwait,
+	const cl_event *wait, cl_event *evt)
+{
+	mock_event(q, CL_COMMAND_UNMAP_MEM_OBJECT, mock_ns(), evt);
+	return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueMarkerWithWaitList(cl_command_queue q, cl_uint nwait, const cl_event *wait,
+	cl_event *evt)
+{
+	mock_event(q, CL_COMMAND_MARKER, mock_ns(), evt);
+	return CL_SUCCESS;
+}
+
+#define ARG(k, idx, type) (*(type *)(k)->arg[idx])
+#define ARG_PTR(k, idx, type) ((type *)ARG(k, idx, cl_mem)->ptr)
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueNDRangeKernel(cl_command_queue q, cl_kernel k, cl_uint dim, const size_t *offset,
+	const size_t *gws, const size_t *lws, cl_uint nwait, const cl_event *wait,
+	cl_event *evt)
+{
+	const cl_ulong queued = mock_ns();
+	size_t n = gws[0];
+
+	if (!strcmp(k->name, "set")) {
+		float *dst = ARG_PTR(k, 0, float), *src = ARG_PTR(k, 1, float);
+		if (ARG(k, 2, cl_uint) < n)
+			n = ARG(k, 2, cl_uint);
+		for (size_t i = 0; i < n; ++i) {
+			dst[i] = 0;
+			src[i] = i;
+		}
+	} else if (!strcmp(k->name, "add")) {
+		float *dst = ARG_PTR(k, 0, float), *src = ARG_PTR(k, 1, float);
+		if (ARG(k, 2, cl_uint) < n)
+			n = ARG(k, 2, cl_uint);
+		for (size_t i = 0; i < n; ++i)
+			dst[i] += src[i];
+	} else if (!strcmp(k->name, "init")) {
+		float *dst = ARG_PTR(k, 0, float);
+		const float val = ARG(k, 1, float);
+		if (ARG(k, 2, cl_uint) < n)
+			n = ARG(k, 2, cl_uint);
+		for (size_t i = 0; i < n; ++i)
+			dst[i] = val;
+	} else if (!strcmp(k->name, "verify")) {
+		const float *src = ARG_PTR(k, 0, float);
+		const float expected = ARG(k, 1, float);
+		cl_uint *result = ARG_PTR(k, 3, cl_uint);
+		if (ARG(k, 2, cl_uint) < n)
+			n = ARG(k, 2, cl_uint);
+		for (size_t i = 0; i < n; ++i)
+			if (src[i] != expected) {
+				++result[0];
+				if (i < result[1])
+					result[1] = i;
+			}
+	}
+	mock_event(q, CL_COMMAND_NDRANGE_KERNEL, queued, evt);
+	return CL_SUCCESS;
+}
@@ -0,0 +1,422 @@
+/* Autotune the set and add kernels of bandwidth over vector width,
+ * elements per work-item, loop unrolling and local size, and remember
+ * the best configuration of each device */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <CL/cl.h>
+
+#include "error.h"
+#include "verify.h"
+#include "trace.h"
+#include "phases.h"
+#include "overalloc.h"
+
+// the kernels of bandwidth, generalized: each work-item processes EPT
+// vectors of type VTYPE, a global size apart so that accesses stay
+// coalesced, in a loop unrolled UNROLL times
+const char *tune_src[] = {
+"kernel void set(global VTYPE * restrict dst, global VTYPE * restrict src, uint n) {\n",
+"	const uint gs = get_global_size(0);\n",
+"	uint i = get_global_id(0);\n",
+"#if UNROLL > 1\n",
+"#pragma unroll UNROLL\n",
+"#endif\n",
+"	for (uint j = 0; j < EPT; ++j, i += gs)\n",
+"		if (i < n) { dst[i] = (VTYPE)(0); src[i] = (VTYPE)(i); }\n",
+"}\n",
+"kernel void add(global VTYPE * restrict dst, global const VTYPE * restrict src, uint n) {\n",
+"	const uint gs = get_global_size(0);\n",
+"	uint i = get_global_id(0);\n",
+"#if UNROLL > 1\n",
+"#pragma unroll UNROLL\n",
+"#endif\n",
+"	for (uint j = 0; j < EPT; ++j, i += gs)\n",
+"		if (i < n) dst[i] += src[i];\n",
+"}\n"
+};
+
+enum tune_kernel { TK_SET, TK_ADD, NUM_TUNE_KERNELS };
+const char * const tune_kernel_name[] = { "set", "add" };
+
+// the search space; local size 0 lets the runtime choose, the others are
+// the preferred multiple times powers of two up to the kernel maximum
+const cl_uint vec_widths[] = { 1, 2, 4, 8, 16 };
+const cl_uint elems_per_item[] = { 1, 2, 4, 8, 16 };
+const cl_uint unroll_factors[] = { 1, 2, 4, 8, 16 };
+
+#define ARRAY_SIZE(a) (sizeof(a)/sizeof(*a))
+
+// number of timed runs of each configuration, the median is used
+#define NREPS 5
+
+// pruning: a configuration whose first run is PRUNE times slower than the
+// best so far is not run again, and if the fastest local size of a vector
+// width and elements per work-item is, higher unroll factors are skipped
+#define PRUNE 1.5
+
+#define DEFAULT_CACHE "autotune.cache"
+
+struct tune_conf {
+	cl_uint vw, ept, unroll;
+	size_t lws;
+	double time; // median runtime, ns; 0 if none yet
+	double bw; // GB/s, counting two buffers' worth of traffic as bandwidth
+};
+
+struct tune_conf best[NUM_TUNE_KERNELS];
+
+cl_mem buf[2]; // dst, src
+cl_uint nvec; // number of vectors of the current width in each buffer
+
+char driver[BUFSZ], devname[BUFSZ];
+
+cl_ulong event_duration(cl_event evt)
+{
+	cl_ulong start, end;
+	error = clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_START,
+		sizeof(start), &start, NULL);
+	CHECK_ERROR("get start");
+	error = clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_END,
+		sizeof(end), &end, NULL);
+	CHECK_ERROR("get end");
+	return end - start;
+}
+
+int compare_double(const void *_a, const void *_b)
+{
+	const double a = *(const double*)_a;
+	const double b = *(const double*)_b;
+	return (a > b) - (a < b);
+}
+
+// global size for nvec vectors, ept per work-item, with local size lws (0: any)
+size_t global_size(cl_uint ept, size_t lws)
+{
+	const size_t items = (nvec + ept - 1)/ept;
+	return lws ? ROUND_MUL(items, lws) : items;
+}
+
+// launch tk once with local size lws (0: any), returning its runtime in ns
+double launch(cl_kernel tk, cl_uint ept, size_t lws)
+{
+	const size_t tgws = global_size(ept, lws);
+	cl_event evt;
+
+	clSetKernelArg(tk, 0, sizeof(buf[0]), buf);
+	clSetKernelArg(tk, 1, sizeof(buf[1]), buf + 1);
+	clSetKernelArg(tk, 2, sizeof(nvec), &nvec);
+	error = clEnqueueNDRangeKernel(q, tk, 1, NULL, &tgws, lws ? &lws : NULL,
+			0, NULL, &evt);
+	CHECK_ERROR("enqueueing kernel");
+	error = clWaitForEvents(1, &evt);
+	CHECK_ERROR("waiting for kernel");
+	trace_event(evt, "tune");
+	const double t = event_duration(evt);
+	clReleaseEvent(evt);
+	return t;
+}
+
+/* median runtime of tk over NREPS runs, or the runtime of the first run if
+ * that is already PRUNE times slower than bound (when not 0), in which
+ * case *pruned is set
+ */
+double time_kernel(cl_kernel tk, cl_uint ept, size_t lws, double bound, int *pruned)
+{
+	double sample[NREPS];
+
+	*pruned = 0;
+	for (int rep = 0; rep < NREPS; ++rep) {
+		sample[rep] = launch(tk, ept, lws);
+		if (!rep && bound && sample[0] > PRUNE*bound) {
+			*pruned = 1;
+			return sample[0];
+		}
+	}
+	qsort(sample, NREPS, sizeof(*sample), compare_double);
+	return sample[NREPS/2];
+}
+
+/* check that set followed by add, with local size lws, leave dst equal to
+ * src everywhere: the buffers are first filled with different values, so
+ * elements missed by either kernel show up
+ */
+int check_kernels(cl_kernel ks, cl_kernel ka, cl_uint ept, size_t lws)
+{
+	const float patt[2] = { -1, -2 };
+	float *h[2];
+
+	for (int i = 0; i < 2; ++i) {
+		error = clEnqueueFillBuffer(q, buf[i], patt + i, sizeof(*patt), 0, buf_size,
+				0, NULL, NULL);
+		CHECK_ERROR("filling buffer");
+	}
+	launch(ks, ept, lws);
+	launch(ka, ept, lws);
+	for (int i = 0; i < 2; ++i) {
+		h[i] = clEnqueueMapBuffer(q, buf[i], CL_TRUE, CL_MAP_READ, 0, buf_size,
+				0, NULL, NULL, &error);
+		CHECK_ERROR("mapping buffer");
+	}
+	const int ok = !memcmp(h[0], h[1], buf_size);
+	for (int i = 0; i < 2; ++i)
+		clEnqueueUnmapMemObject(q, buf[i], h[i], 0, NULL, NULL);
+	error = clFinish(q);
+	CHECK_ERROR("unmapping buffers");
+	return ok;
+}
+
+void print_conf(const char *what, enum tune_kernel t, const struct tune_conf *c)
+{
+	printf("%s %s: float", what, tune_kernel_name[t]);
+	if (c->vw > 1)
+		printf("%u", c->vw);
+	printf(", %u per work-item, unroll %u, local size ", c->ept, c->unroll);
+	if (c->lws)
+		printf("%zu", c->lws);
+	else
+		printf("any");
+	printf(": %gms, %gGB/s\n", c->time*1.0e-6, c->bw);
+}
+
+/* Cache file: one line per device, driver and kernel, with the best
+ * configuration, its runtime and bandwidth, tab-separated
+ */
+
+// look the best configurations for this device and driver up in the cache;
+// returns the number of kernels found
+int cache_load(const char *fname)
+{
+	char line[3*BUFSZ];
+	int found = 0;
+	FILE *f = fopen(fname, "r");
+
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f)) {
+		char *dev = strtok(line, "\t");
+		char *drv = strtok(NULL, "\t");
+		char *kn = strtok(NULL, "\t");
+		char *rest = strtok(NULL, "\n");
+		struct tune_conf c;
+
+		if (!rest || strcmp(dev, devname) || strcmp(drv, driver))
+			continue;
+		if (sscanf(rest, "%u\t%u\t%u\t%zu\t%lg\t%lg", &c.vw, &c.ept, &c.unroll,
+				&c.lws, &c.time, &c.bw) != 6)
+			continue;
+		for (enum tune_kernel t = 0; t < NUM_TUNE_KERNELS; ++t)
+			if (!strcmp(kn, tune_kernel_name[t])) {
+				if (!best[t].time)
+					++found;
+				best[t] = c;
+			}
+	}
+	fclose(f);
+	return found;
+}
+
+// rewrite the cache, replacing the entries of this device and driver
+void cache_store(const char *fname)
+{
+	char line[3*BUFSZ], key[3*BUFSZ];
+	char *kept = NULL;
+	size_t nkept = 0;
+	FILE *f = fopen(fname, "r");
+
+	// keep the lines of other devices and drivers
+	snprintf(key, sizeof(key), "%s\t%s\t", devname, driver);
+	while (f && fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, key, strlen(key)))
+			continue;
+		kept = realloc(kept, nkept + strlen(line) + 1);
+		if (!kept) {
+			fputs("couldn't allocate cache contents\n", stderr);
+			exit(1);
+		}
+		strcpy(kept + nkept, line);
+		nkept += strlen(line);
+	}
+	if (f)
+		fclose(f);
+
+	f = fopen(fname, "w");
+	if (!f) {
+		perror(fname);
+		free(kept);
+		return;
+	}
+	if (kept)
+		fputs(kept, f);
+	for (enum tune_kernel t = 0; t < NUM_TUNE_KERNELS; ++t)
+		if (best[t].time)
+			fprintf(f, "%s%s\t%u\t%u\t%u\t%zu\t%g\t%g\n", key, tune_kernel_name[t],
+				best[t].vw, best[t].ept, best[t].unroll, best[t].lws,
+				best[t].time, best[t].bw);
+	fclose(f);
+	free(kept);
+}
+
+/* build the variant with the given vector width, elements per work-item
+ * and unroll factor; returns NULL if the platform can't build it
+ */
+cl_program build_variant(cl_uint vw, cl_uint ept, cl_uint unroll)
+{
+	char options[BUFSZ];
+	cl_program tpg;
+
+	if (vw > 1)
+		snprintf(options, BUFSZ, "-DVTYPE=float%u -DEPT=%u -DUNROLL=%u", vw, ept, unroll);
+	else
+		snprintf(options, BUFSZ, "-DVTYPE=float -DEPT=%u -DUNROLL=%u", ept, unroll);
+
+	tpg = clCreateProgramWithSource(ctx, ARRAY_SIZE(tune_src), tune_src, NULL, &error);
+	CHECK_ERROR("creating program");
+	if (clBuildProgram(tpg, 1, &d, options, NULL, NULL) != CL_SUCCESS) {
+		printf("%s: build failed, skipped\n", options);
+		clReleaseProgram(tpg);
+		return NULL;
+	}
+	return tpg;
+}
+
+/* try all local sizes for the kernels of program tpg; skip[t] is set if
+ * kernel t was PRUNE times slower than its best with all of them
+ */
+void tune_program(cl_program tpg, cl_uint vw, cl_uint ept, cl_uint unroll,
+	int skip[NUM_TUNE_KERNELS])
+{
+	cl_kernel tk[NUM_TUNE_KERNELS];
+	size_t max_lws = 0;
+
+	for (enum tune_kernel t = 0; t < NUM_TUNE_KERNELS; ++t) {
+		size_t kmax;
+		tk[t] = clCreateKernel(tpg, tune_kernel_name[t], &error);
+		CHECK_ERROR("creating kernel");
+		error = clGetKernelWorkGroupInfo(tk[t], d, CL_KERNEL_WORK_GROUP_SIZE,
+				sizeof(kmax), &kmax, NULL);
+		CHECK_ERROR("getting kernel work-group size");
+		if (!max_lws || kmax < max_lws)
+			max_lws = kmax;
+	}
+
+	// untimed warm-up
+	launch(tk[TK_SET], ept, 0);
+	launch(tk[TK_ADD], ept, 0);
+
+	double fastest[NUM_TUNE_KERNELS] = { 0 };
+	for (size_t lws = 0; lws <= max_lws; lws = lws ? 2*lws : wgm) {
+		for (enum tune_kernel t = 0; t < NUM_TUNE_KERNELS; ++t) {
+			if (skip[t])
+				continue;
+			int pruned;
+			const double time = time_kernel(tk[t], ept, lws, best[t].time, &pruned);
+			if (!fastest[t] || time < fastest[t])
+				fastest[t] = time;
+			if (pruned || (best[t].time && time >= best[t].time))
+				continue;
+			if (!check_kernels(tk[TK_SET], tk[TK_ADD], ept, lws)) {
+				printf("width %u, %u per work-item, unroll %u, local size %zu: wrong results, skipped\n",
+					vw, ept, unroll, lws);
+				continue;
+			}
+			const struct tune_conf c = { vw, ept, unroll, lws, time, 2.0*buf_size/time };
+			best[t] = c;
+			print_conf("new best", t, best + t);
+		}
+	}
+
+	for (enum tune_kernel t = 0; t < NUM_TUNE_KERNELS; ++t) {
+		skip[t] = skip[t] || fastest[t] > PRUNE*best[t].time;
+		clReleaseKernel(tk[t]);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	// selected platform and device number
+	cl_uint pn = 0, dn = 0;
+
+	// cache file, and whether to tune even if the device is in it
+	const char *cache = DEFAULT_CACHE;
+	int force = 0;
+
+	// set platform/device num, cache file and force from command line
+	if (argc > 1)
+		pn = atoi(argv[1]);
+	if (argc > 2)
+		dn = atoi(argv[2]);
+	if (argc > 3)
+		cache = argv[3];
+	if (argc > 4)
+		force = !strcmp(argv[4], "force");
+
+	setup(pn, dn);
+
+	error = clGetDeviceInfo(d, CL_DEVICE_NAME, BUFSZ, devname, NULL);
+	CHECK_ERROR("getting device name");
+	error = clGetDeviceInfo(d, CL_DRIVER_VERSION, BUFSZ, driver, NULL);
+	CHECK_ERROR("getting driver version");
+
+	if (!force && cache_load(cache) == NUM_TUNE_KERNELS) {
+		printf("cached in %s:\n", cache);
+		for (enum tune_kernel t = 0; t < NUM_TUNE_KERNELS; ++t)
+			print_conf("best", t, best + t);
+		goto out;
+	}
+	memset(best, 0, sizeof(best));
+
+	// two buffers, as bandwidth, with room for a whole number of vectors
+	// of any width
+	size_t size = gmem/2;
+	if (size > alloc_max)
+		size = alloc_max;
+	buf_size = size/(16*sizeof(cl_float))*16*sizeof(cl_float);
+	for (int i = 0; i < 2; ++i) {
+		buf[i] = clCreateBuffer(ctx, CL_MEM_READ_WRITE, buf_size, NULL, &error);
+		CHECK_ERROR("allocating buffer");
+	}
+	printf("tuning on buffers of %gMB\n", buf_size/MB);
+
+	for (size_t w = 0; w < ARRAY_SIZE(vec_widths); ++w) {
+		const cl_uint vw = vec_widths[w];
+		nvec = buf_size/(vw*sizeof(cl_float));
+		for (size_t e = 0; e < ARRAY_SIZE(elems_per_item); ++e) {
+			const cl_uint ept = elems_per_item[e];
+			int skip[NUM_TUNE_KERNELS] = { 0 };
+			for (size_t u = 0; u < ARRAY_SIZE(unroll_factors); ++u) {
+				const cl_uint unroll = unroll_factors[u];
+				// stop unrolling past the loop length, or once no kernel
+				// is worth it
+				if (unroll > ept || (skip[TK_SET] && skip[TK_ADD]))
+					break;
+				cl_program tpg = build_variant(vw, ept, unroll);
+				if (!tpg)
+					continue;
+				tune_program(tpg, vw, ept, unroll, skip);
+				clReleaseProgram(tpg);
+			}
+		}
+	}
+
+	for (enum tune_kernel t = 0; t < NUM_TUNE_KERNELS; ++t) {
+		if (best[t].time)
+			print_conf("best", t, best + t);
+		else
+			printf("no working configuration for %s\n", tune_kernel_name[t]);
+	}
+	cache_store(cache);
+
+	for (int i = 0; i < 2; ++i)
+		clReleaseMemObject(buf[i]);
+out:
+	release_kernels();
+	clReleaseProgram(pg);
+	clReleaseCommandQueue(q);
+	clReleaseContext(ctx);
+
+	return 0;
+}
@@ -0,0 +1,478 @@
+/* Bandwidth of the set and add kernels, maps and reads with the
+ * CL_MEM_*_HOST_PTR flags, run by bandwidth and clbench.
+ *
+ * Requires error.h, trace.h, hoststream.h, hostalloc.h and testenv.h.
+ */
+
+// kernel to force usage of the buffer
+const char *bandwidth_src[] = {
+"kernel void set(global TYPE * restrict dst, global TYPE * restrict src, uint n) {\n",
+"	uint i = get_global_id(0);\n",
+"	if (i < n) { dst[i] = (TYPE)(0); src[i] = (TYPE)(i); }\n",
+"}\n"
+"kernel void add(global TYPE * restrict dst, global const TYPE * restrict src, uint n) {\n",
+"	uint i = get_global_id(0);\n",
+"	if (i < n) dst[i] += src[i];\n",
+"}"
+};
+
+// what the bandwidth test runs
+struct bandwidth_opts {
+	cl_uint vec_width; // width of the float vectors, 1 for plain float
+	// placements and allocation strategies to try for the USE_HOST_PTR backing store
+	int use_placement[NUM_PLACEMENTS];
+	int use_strategy[NUM_ALLOC_STRATS];
+};
+
+// macro to round size to the next multiple of base
+#define ROUND_MUL(size, base) \
+	((size + base - 1)/base)*base
+
+#define MB (1024*1024.0)
+
+/* print the event runtime in ms, bandwidth in GB/s assuming
+ * nbytes total gmem access (read + write), return runtime
+ * in ms
+ */
+double event_perf(cl_event evt, size_t nbytes, const char *name)
+{
+	cl_ulong start, end;
+	error = clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_START,
+		sizeof(start), &start, NULL);
+	CHECK_ERROR("get start");
+	error = clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_END,
+		sizeof(end), &end, NULL);
+	CHECK_ERROR("get end");
+	trace_event(evt, name);
+	double time_ms = (end - start)*1.0e-6;
+	double bandwidth = (double)(nbytes)/(end - start);
+	printf("%s runtime: %gms, B/W: %gGB/s\n", name, time_ms, bandwidth);
+	return time_ms;
+}
+
+/* parse a comma-separated list of names (or all) into use[count];
+ * what names the kind of item, for errors
+ */
+void parse_list(char *csv, const char * const names[], int count, int *use,
+	const char *what)
+{
+	memset(use, 0, count*sizeof(*use));
+	for (char *tok = strtok(csv, ","); tok; tok = strtok(NULL, ",")) {
+		const int all = !strcmp(tok, "all");
+		int found = all;
+		for (int n = 0; n < count; ++n)
+			if (all || !strcmp(tok, names[n]))
+				use[n] = found = 1;
+		if (!found) {
+			fprintf(stderr, "unknown %s %s\n", what, tok);
+			exit(1);
+		}
+	}
+}
+
+void bandwidth_test(const struct test_env *env, const struct bandwidth_opts *opts)
+{
+	const cl_device_id d = env->dev->d;
+	const cl_context ctx = env->ctx;
+	const cl_command_queue q = env->q;
+
+	char type_def[32];
+	cl_uint vec_width = opts->vec_width;
+	int use_placement[NUM_PLACEMENTS];
+	int use_strategy[NUM_ALLOC_STRATS];
+
+	size_t gmem; // device global memory size
+	size_t alloc_max; // max single-buffer-size on device
+	size_t buf_size; // actual buffer size
+
+	cl_uint nbuf; // number of buffers to allocate
+	cl_mem *buf; // array of allocated buffers
+
+	cl_uint nels; // number of elements that fit in the allocated arrays
+	float **hbuf; // host buffer pointers
+
+	cl_program pg; // program
+	cl_kernel k_set, k_add; // actual kernels
+	size_t gws ; // global work size
+	size_t wgm ; // preferred workgroup size multiple (will be used as local size too)
+
+	// sync events for mem/launch ops
+	cl_event set_event, add_event, map_event, read_event;
+
+	// generic iterator
+	cl_uint i;
+
+	// this should only be 2, 4, 8, 16
+	// if the user passes bogus data, it's their problem.
+	if (vec_width > 1)
+		snprintf(type_def, sizeof(type_def), "-DTYPE=float%u", vec_width);
+	else
+		strcpy(type_def, "-DTYPE=float");
+	if (vec_width == 3)
+		vec_width++;
+
+	memcpy(use_placement, opts->use_placement, sizeof(use_placement));
+	memcpy(use_strategy, opts->use_strategy, sizeof(use_strategy));
+
+	numa_detect();
+	printf("%u NUMA nodes, running on node %u\n", numa_nodes, numa_local);
+	for (enum placement pl = 0; pl < NUM_PLACEMENTS; ++pl)
+		if (use_placement[pl] && !placement_available(pl)) {
+			printf("single NUMA node: skipping %s placement\n", placement_name[pl]);
+			use_placement[pl] = 0;
+		}
+
+	error = clGetDeviceInfo(d, CL_DEVICE_GLOBAL_MEM_SIZE,
+			sizeof(gmem), &gmem, NULL);
+	CHECK_ERROR("getting device global memory size");
+	error = clGetDeviceInfo(d, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+			sizeof(alloc_max), &alloc_max, NULL);
+	CHECK_ERROR("getting device max memory allocation size");
+	cl_uint base_align;
+	error = clGetDeviceInfo(d, CL_DEVICE_MEM_BASE_ADDR_ALIGN,
+			sizeof(base_align), &base_align, NULL);
+	CHECK_ERROR("getting device base address alignment");
+	host_align = base_align/8;
+	printf("device base address alignment: %zu bytes\n", host_align);
+
+	// create program
+	pg = clCreateProgramWithSource(ctx, sizeof(bandwidth_src)/sizeof(*bandwidth_src),
+		bandwidth_src, NULL, &error);
+	CHECK_ERROR("creating program");
+
+	// build program
+	printf("OpenCL program build options: %s\n", type_def);
+	error = clBuildProgram(pg, 1, &d, type_def, NULL, NULL);
+#if 1
+	if (error == CL_BUILD_PROGRAM_FAILURE) {
+		error = clGetProgramBuildInfo(pg, d, CL_PROGRAM_BUILD_LOG,
+			BUFSZ, strbuf, NULL);
+		CHECK_ERROR("get program build info");
+		printf("=== BUILD LOG ===\n%s\n=========\n", strbuf);
+	}
+#endif
+	CHECK_ERROR("building program");
+
+	// get kernels
+	k_set = clCreateKernel(pg, "set", &error);
+	CHECK_ERROR("creating kernel set");
+
+	k_add = clCreateKernel(pg, "add", &error);
+	CHECK_ERROR("creating kernel add");
+
+
+	error = clGetKernelWorkGroupInfo(k_add, d, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+			sizeof(wgm), &wgm, NULL);
+	CHECK_ERROR("getting preferred workgroup size multiple");
+
+	// we allocate two buffers
+	nbuf = 2;
+
+	// reduce buffer allocation size to ensure we can fit all buffer
+	// into the device memory
+	if (alloc_max > gmem/nbuf)
+		buf_size = gmem/nbuf;
+	else
+		buf_size = alloc_max;
+
+	// number of elements that fit in the given buf_size
+	nels = buf_size/sizeof(cl_float)/vec_width;
+	// set the buffer size to match exactly what we need
+	buf_size = nels*sizeof(cl_float)*vec_width;
+
+	gws = ROUND_MUL(nels, wgm);
+
+	printf("will use %zu workitems to process %u elements of type %s\n",
+			gws, nels, type_def + 7);
+
+	printf("will try allocating %u buffers of %gMB each\n", nbuf, buf_size/MB);
+
+	buf = calloc(nbuf, sizeof(cl_mem));
+
+	if (!buf) {
+		fprintf(stderr, "could not prepare support for %u buffers\n", nbuf);
+		exit(1);
+	}
+
+	// we try multiple configurations: no HOST_PTR flags, USE_HOST_PTR and ALLOC_HOST_PTR;
+	// the USE_HOST_PTR turn is repeated for each allocation strategy and
+	// placement of the host memory
+	const cl_mem_flags base_flags[] = {
+		CL_MEM_READ_WRITE,
+		CL_MEM_USE_HOST_PTR | CL_MEM_READ_WRITE,
+		CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_WRITE,
+		CL_MEM_READ_WRITE,
+	};
+	const char * const base_names[] = {
+		"(none)", "USE_HOST_PTR", "ALLOC_HOST_PTR", "(none)"
+	};
+	const size_t nbase = sizeof(base_flags)/sizeof(*base_flags);
+
+#define MAX_TURNS (sizeof(base_flags)/sizeof(*base_flags) + NUM_ALLOC_STRATS*NUM_PLACEMENTS)
+	cl_mem_flags buf_flags[MAX_TURNS];
+	enum alloc_strategy buf_strategy[MAX_TURNS];
+	enum placement buf_placement[MAX_TURNS];
+	char flag_names[MAX_TURNS][64];
+	// whether the host memory couldn't be allocated, and whether mapping
+	// gave back the host pointer every time (USE_HOST_PTR turns only)
+	int skipped[MAX_TURNS] = {0}, zero_copy[MAX_TURNS] = {0};
+	size_t nturns = 0;
+
+	for (size_t b = 0; b < nbase; ++b) {
+		if (!(base_flags[b] & CL_MEM_USE_HOST_PTR)) {
+			buf_flags[nturns] = base_flags[b];
+			buf_strategy[nturns] = ALLOC_CALLOC;
+			buf_placement[nturns] = PLACE_DEFAULT;
+			strcpy(flag_names[nturns++], base_names[b]);
+			continue;
+		}
+		for (enum alloc_strategy st = 0; st < NUM_ALLOC_STRATS; ++st)
+		for (enum placement pl = 0; pl < NUM_PLACEMENTS; ++pl) {
+			if (!use_strategy[st] || !use_placement[pl])
+				continue;
+			buf_flags[nturns] = base_flags[b];
+			buf_strategy[nturns] = st;
+			buf_placement[nturns] = pl;
+			if (st == ALLOC_CALLOC && pl == PLACE_DEFAULT)
+				strcpy(flag_names[nturns], base_names[b]);
+			else
+				snprintf(flag_names[nturns], sizeof(*flag_names), "%s (%s, %s)",
+					base_names[b], alloc_strategy_name[st], placement_name[pl]);
+			++nturns;
+		}
+	}
+
+	const size_t nloops = 5; // number of loops for each turn, for stats
+	const size_t median = nloops/2; // location of median value after sorting
+	const size_t gmem_bytes_rw = 2*buf_size;
+	// host memory for the transfer (read) test, with the strategy and
+	// placement of the turn; capped, as USE_HOST_PTR turns already need
+	// twice buf_size of host memory
+#define XFER_MAX (256*1024*1024UL)
+	const size_t xfer_size = buf_size < XFER_MAX ? buf_size : XFER_MAX;
+	float *hxfer;
+
+	double runtimes[nturns][4][nloops]; /* set, add, map, read */
+	memset(runtimes, 0, nturns*sizeof(*runtimes));
+
+	hbuf = calloc(nbuf, sizeof(*hbuf));
+	if (!hbuf) {
+		fputs("couldn't allocate host buffer array\n", stderr);
+		exit(1);
+	}
+
+	for (size_t turn = 0; turn < nturns; ++turn) {
+		const enum alloc_strategy st = buf_strategy[turn];
+		const enum placement pl = buf_placement[turn];
+
+		// huge pages in particular may not be available: skip the turn
+		hxfer = host_alloc(xfer_size, st, pl);
+		for (i = 0; hxfer && i < nbuf && (buf_flags[turn] & CL_MEM_USE_HOST_PTR); ++i) {
+			hbuf[i] = host_alloc(buf_size, st, pl);
+			if (!hbuf[i])
+				break;
+			placement_report(hbuf[i], buf_size);
+		}
+		if (!hxfer || ((buf_flags[turn] & CL_MEM_USE_HOST_PTR) && i < nbuf)) {
+			printf("Turn %zu: %s: couldn't allocate host memory, skipping\n",
+				turn, flag_names[turn]);
+			host_free(hxfer, xfer_size, st);
+			for (i = 0; i < nbuf; ++i) {
+				host_free(hbuf[i], buf_size, st);
+				hbuf[i] = NULL;
+			}
+			skipped[turn] = 1;
+			continue;
+		}
+		zero_copy[turn] = !!(buf_flags[turn] & CL_MEM_USE_HOST_PTR);
+
+		for (i = 0; i < nbuf; ++i) {
+			buf[i] = clCreateBuffer(ctx, buf_flags[turn], buf_size,
+				hbuf[i], &error);
+			CHECK_ERROR("allocating buffer");
+			printf("buffer %u allocated\n", i);
+		}
+
+		for (size_t loop = 0; loop < nloops; ++loop) {
+			clSetKernelArg(k_set, 0, sizeof(buf[0]), buf);
+			clSetKernelArg(k_set, 1, sizeof(buf[1]), buf + 1);
+			clSetKernelArg(k_set, 2, sizeof(nels), &nels);
+			error = clEnqueueNDRangeKernel(q, k_set, 1, NULL, &gws, NULL,
+					0, NULL, &set_event);
+			CHECK_ERROR("enqueueing kernel set");
+
+			clSetKernelArg(k_add, 0, sizeof(buf[0]), buf);
+			clSetKernelArg(k_add, 1, sizeof(buf[1]), buf + 1);
+			clSetKernelArg(k_add, 2, sizeof(nels), &nels);
+			error = clEnqueueNDRangeKernel(q, k_add, 1, NULL, &gws, NULL,
+					1, &set_event, &add_event);
+			CHECK_ERROR("enqueueing kernel add");
+
+			const double map_start = trace_clock();
+			float *hmap = clEnqueueMapBuffer(q, buf[0], CL_TRUE,
+				CL_MAP_READ, 0, buf_size, 1, &add_event, &map_event, &error);
+			CHECK_ERROR("map");
+			trace_host(flag_names[turn], map_start);
+
+			error = clWaitForEvents(1, &map_event);
+			CHECK_ERROR("map event");
+			// a runtime that shadows the host memory maps its own copy
+			if (hmap != hbuf[0])
+				zero_copy[turn] = 0;
+
+			printf("Turn %zu, loop %zu: %s\n", turn, loop, flag_names[turn]);
+			runtimes[turn][0][loop] = event_perf(set_event, gmem_bytes_rw, "set");
+			runtimes[turn][1][loop] = event_perf(add_event, gmem_bytes_rw, "add");
+			runtimes[turn][2][loop] = event_perf(map_event, buf_size, "map");
+
+			clEnqueueUnmapMemObject(q, buf[0], hmap, 0, NULL, NULL);
+
+			error = clEnqueueReadBuffer(q, buf[1], CL_TRUE, 0, xfer_size, hxfer,
+				0, NULL, &read_event);
+			CHECK_ERROR("read");
+			runtimes[turn][3][loop] = event_perf(read_event, xfer_size, "read");
+
+			clFinish(q);
+
+			// release the events
+			clReleaseEvent(set_event);
+			clReleaseEvent(add_event);
+			clReleaseEvent(map_event);
+			clReleaseEvent(read_event);
+		}
+
+		// release the buffers
+		for (i = 0; i < nbuf; ++i) {
+			if (buf_flags[turn] & CL_MEM_USE_HOST_PTR) {
+				host_free(hbuf[i], buf_size, st);
+				hbuf[i] = NULL;
+			}
+			clReleaseMemObject(buf[i]);
+		}
+		host_free(hxfer, xfer_size, st);
+
+	}
+
+	/* native host bandwidth over the same buffer size, as a reference,
+	 * with and without non-temporal stores. Each device operation is
+	 * compared with the STREAM operations moving as many arrays: set
+	 * writes two buffers, as copy and scale move two arrays; add reads
+	 * two and writes one, as add and triad. Map and read copy a buffer,
+	 * so they are compared with the bytes copy and scale copy per
+	 * second, half of their bandwidth.
+	 */
+	double host_op_bw[NUM_STREAM_OPS] = {0};
+	int host_op_nt[NUM_STREAM_OPS] = {0};
+	for (int nt = 0; nt < 2; ++nt) {
+		if (!host_stream(buf_size, nt))
+			continue;
+		for (enum stream_op op = 0; op < NUM_STREAM_OPS; ++op) {
+			const double bw = stream_bw(op, stream_runtimes[op][0]);
+			if (bw > host_op_bw[op]) {
+				host_op_bw[op] = bw;
+				host_op_nt[op] = nt;
+			}
+		}
+	}
+	// best two-array and three-array operations
+	const enum stream_op host_op2 = host_op_bw[ST_SCALE] > host_op_bw[ST_COPY] ? ST_SCALE : ST_COPY;
+	const enum stream_op host_op3 = host_op_bw[ST_TRIAD] > host_op_bw[ST_ADD] ? ST_TRIAD : ST_ADD;
+	const double host_bw2 = host_op_bw[host_op2], host_bw3 = host_op_bw[host_op3];
+
+	puts("Summary/stats:");
+
+	if (host_bw2)
+		printf("Host: %u threads, %gMB arrays: %s (%s stores) %g GB/s, %s (%s stores) %g GB/s\n",
+			stream_nthreads, stream_size/MB,
+			stream_op_name[host_op2], host_op_nt[host_op2] ? "non-temporal" : "regular", host_bw2,
+			stream_op_name[host_op3], host_op_nt[host_op3] ? "non-temporal" : "regular", host_bw3);
+	else
+		puts("Host: native bandwidth not available");
+
+	for (size_t turn = 0; turn < nturns; ++turn) {
+		double avg[4] = {0};
+
+		if (skipped[turn]) {
+			printf("Turn %zu: %s: skipped\n", turn, flag_names[turn]);
+			continue;
+		}
+
+		/* I'm lazy, so sort with qsort and then compute average,
+		 * otherwise we could just compute min, max, avg and median together */
+		qsort(runtimes[turn][0], nloops, sizeof(double), compare_double);
+		qsort(runtimes[turn][1], nloops, sizeof(double), compare_double);
+		qsort(runtimes[turn][2], nloops, sizeof(double), compare_double);
+		qsort(runtimes[turn][3], nloops, sizeof(double), compare_double);
+		for (size_t loop = 0; loop < nloops; ++loop) {
+			avg[0] += runtimes[turn][0][loop];
+			avg[1] += runtimes[turn][1][loop];
+			avg[2] += runtimes[turn][2][loop];
+			avg[3] += runtimes[turn][3][loop];
+		}
+		avg[0] /= nloops;
+		avg[1] /= nloops;
+		avg[2] /= nloops;
+		avg[3] /= nloops;
+
+		printf("Turn %zu: %s\n", turn, flag_names[turn]);
+		printf("set\ttime (ms): best: %8g, median: %8g, worst: %8g, avg: %8g\n",
+			runtimes[turn][0][0],
+			runtimes[turn][0][median],
+			runtimes[turn][0][nloops - 1],
+			avg[0]);
+		printf("\tBW (GB/s): best: %8g, median: %8g, worst: %8g, avg: %8g\n",
+			gmem_bytes_rw/runtimes[turn][0][0]*1.0e-6,
+			gmem_bytes_rw/runtimes[turn][0][median]*1.0e-6,
+			gmem_bytes_rw/runtimes[turn][0][nloops - 1]*1.0e-6,
+			gmem_bytes_rw/avg[0]*1.0e-6);
+		printf("add\ttime (ms): best: %8g, median: %8g worst: %8g, avg: %8g\n",
+			runtimes[turn][1][0],
+			runtimes[turn][1][median],
+			runtimes[turn][1][nloops - 1],
+			avg[1]);
+		printf("\tBW (GB/s): best: %8g, median: %8g, worst: %8g, avg: %8g\n",
+			gmem_bytes_rw/runtimes[turn][1][0]*1.0e-6,
+			gmem_bytes_rw/runtimes[turn][1][median]*1.0e-6,
+			gmem_bytes_rw/runtimes[turn][1][nloops - 1]*1.0e-6,
+			gmem_bytes_rw/avg[1]*1.0e-6);
+		printf("map\ttime (ms): best: %8g, median: %8g, worst: %8g, avg: %8g\n",
+			runtimes[turn][2][0],
+			runtimes[turn][2][median],
+			runtimes[turn][2][nloops - 1],
+			avg[2]);
+		printf("\tBW (GB/s): best: %8g, median: %8g, worst: %8g, avg: %8g\n",
+			buf_size/runtimes[turn][2][0]*1.0e-6,
+			buf_size/runtimes[turn][2][median]*1.0e-6,
+			buf_size/runtimes[turn][2][nloops - 1]*1.0e-6,
+			buf_size/avg[2]*1.0e-6);
+		printf("read\ttime (ms): best: %8g, median: %8g, worst: %8g, avg: %8g\n",
+			runtimes[turn][3][0],
+			runtimes[turn][3][median],
+			runtimes[turn][3][nloops - 1],
+			avg[3]);
+		printf("\tBW (GB/s): best: %8g, median: %8g, worst: %8g, avg: %8g\n",
+			xfer_size/runtimes[turn][3][0]*1.0e-6,
+			xfer_size/runtimes[turn][3][median]*1.0e-6,
+			xfer_size/runtimes[turn][3][nloops - 1]*1.0e-6,
+			xfer_size/avg[3]*1.0e-6);
+		if (host_bw2)
+			printf("\tvs host (best BW): set %.3g%% of %s, add %.3g%% of %s, "
+				"map %.3g%%, read %.3g%% of %s (bytes copied)\n",
+				gmem_bytes_rw/runtimes[turn][0][0]*1.0e-4/host_bw2, stream_op_name[host_op2],
+				3.0*buf_size/runtimes[turn][1][0]*1.0e-4/host_bw3, stream_op_name[host_op3],
+				buf_size/runtimes[turn][2][0]*1.0e-4/(host_bw2/2),
+				xfer_size/runtimes[turn][3][0]*1.0e-4/(host_bw2/2), stream_op_name[host_op2]);
+		if (buf_flags[turn] & CL_MEM_USE_HOST_PTR)
+			printf("\tzero-copy: %s\n", zero_copy[turn] ?
+				"yes (map returned the host pointer)" :
+				"no (map returned a copy)");
+
+	}
+
+
+	clReleaseKernel(k_add);
+	clReleaseKernel(k_set);
+	clReleaseProgram(pg);
+	free(hbuf);
+	free(buf);
+}
@@ -0,0 +1,172 @@
+/* Run the tests of the standalone tools in a single process, on contexts
+ * and queues created once per device and shared by all the tests, and
+ * report the time taken by each test next to the one-time init cost */
+
+// _GNU_SOURCE for the CPU affinity calls in hostalloc.h
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <CL/cl.h>
+
+#include "error.h"
+#include "verify.h"
+#include "trace.h"
+#include "phases.h"
+#include "hoststream.h"
+#include "hostalloc.h"
+#include "devsel.h"
+#include "testenv.h"
+#include "ndrangelatency.h"
+#include "bandwidth.h"
+#include "command-fail-event.h"
+#include "overalloc-auto.h"
+#include "overalloc-migrate.h"
+#include "overalloc-migrate-copy.h"
+
+/* Tests, with the default arguments of the standalone tools; each returns
+ * CL_SUCCESS, or an error if it could not complete
+ */
+
+cl_int run_latency(const struct test_env *env)
+{
+	return latency_test(env);
+}
+
+cl_int run_bandwidth(const struct test_env *env)
+{
+	const struct bandwidth_opts opts = { 1, { 1 }, { 1 } };
+	bandwidth_test(env, &opts);
+	return CL_SUCCESS;
+}
+
+cl_int run_fail_event(const struct test_env *env)
+{
+	return fail_event_test(env);
+}
+
+cl_int run_overalloc_auto(const struct test_env *env)
+{
+	overalloc_auto_test(env, FILL_HOST, CHECK_HOST);
+	return CL_SUCCESS;
+}
+
+cl_int run_overalloc_migrate(const struct test_env *env)
+{
+	return overalloc_migrate_test(env, FILL_HOST, CHECK_HOST) ?
+		CL_INVALID_PLATFORM : CL_SUCCESS;
+}
+
+cl_int run_overalloc_migrate_copy(const struct test_env *env)
+{
+	return overalloc_migrate_copy_test(env, FILL_HOST, CHECK_HOST) ?
+		CL_INVALID_PLATFORM : CL_SUCCESS;
+}
+
+struct test {
+	const char *name; // as the standalone tool
+	cl_int (*run)(const struct test_env *env);
+};
+
+const struct test tests[] = {
+	{ "ndrangelatency", run_latency },
+	{ "bandwidth", run_bandwidth },
+	{ "command-fail-event", run_fail_event },
+	{ "overalloc-auto", run_overalloc_auto },
+	{ "overalloc-migrate", run_overalloc_migrate },
+	{ "overalloc-migrate-copy", run_overalloc_migrate_copy },
+};
+
+#define NUM_TESTS (sizeof(tests)/sizeof(*tests))
+
+int main(int argc, char *argv[])
+{
+	// device selectors and tests to run
+	const char *devices = "0";
+	int use_test[NUM_TESTS];
+	const char *test_name[NUM_TESTS];
+
+	for (size_t t = 0; t < NUM_TESTS; ++t) {
+		use_test[t] = 1;
+		test_name[t] = tests[t].name;
+	}
+
+	// set device selectors and tests from command line
+	if (argc > 1)
+		devices = argv[1];
+	if (argc > 2)
+		parse_list(argv[2], test_name, NUM_TESTS, use_test, "test");
+
+	double start = now();
+	discover_devices();
+	const double discovery_time = now() - start;
+
+	for (cl_uint i = 0; i < dev_count; ++i)
+		printf("device %u (%u:%u): %s\n", i, dev_list[i].pn, dev_list[i].dn, dev_list[i].name);
+
+	char *selected = calloc(dev_count ? dev_count : 1, 1);
+	struct test_env *env = calloc(dev_count ? dev_count : 1, sizeof(*env));
+	double *init_time = calloc(dev_count ? dev_count : 1, sizeof(*init_time));
+	double *test_time = calloc((dev_count ? dev_count : 1)*NUM_TESTS, sizeof(*test_time));
+	cl_int *test_error = calloc((dev_count ? dev_count : 1)*NUM_TESTS, sizeof(*test_error));
+	if (!selected || !env || !init_time || !test_time || !test_error) {
+		fputs("couldn't allocate device contexts\n", stderr);
+		exit(1);
+	}
+	if (!select_devices(devices, selected)) {
+		fprintf(stderr, "no device matches %s\n", devices);
+		exit(1);
+	}
+
+	// one-time creation of the contexts and queues all tests share
+	for (cl_uint i = 0; i < dev_count; ++i) {
+		if (!selected[i])
+			continue;
+		start = now();
+		test_env_create(env + i, dev_list + i);
+		init_time[i] = now() - start;
+	}
+
+	for (cl_uint i = 0; i < dev_count; ++i) {
+		if (!selected[i])
+			continue;
+		for (size_t t = 0; t < NUM_TESTS; ++t) {
+			if (!use_test[t])
+				continue;
+			printf("== device %u: %s, %s ==\n", i, dev_list[i].name, tests[t].name);
+			start = now();
+			test_error[i*NUM_TESTS + t] = tests[t].run(env + i);
+			test_time[i*NUM_TESTS + t] = now() - start;
+			puts("");
+		}
+	}
+
+	puts("Summary (ms):");
+	printf("discovery: %g\n", discovery_time*1.0e3);
+	for (cl_uint i = 0; i < dev_count; ++i) {
+		if (!selected[i])
+			continue;
+		printf("device %u: %s\n", i, dev_list[i].name);
+		printf("\t%-24s%12g\n", "init (context, queue)", init_time[i]*1.0e3);
+		for (size_t t = 0; t < NUM_TESTS; ++t) {
+			if (!use_test[t])
+				continue;
+			printf("\t%-24s%12g", tests[t].name, test_time[i*NUM_TESTS + t]*1.0e3);
+			if (test_error[i*NUM_TESTS + t] != CL_SUCCESS)
+				printf("\t(failed: error %d)", test_error[i*NUM_TESTS + t]);
+			puts("");
+		}
+	}
+
+	for (cl_uint i = 0; i < dev_count; ++i)
+		test_env_release(env + i);
+	free(test_error);
+	free(test_time);
+	free(init_time);
+	free(env);
+	free(selected);
+	free(dev_list);
+
+	return 0;
+}
@@ -0,0 +1,494 @@
+/* Events of failed API calls, and host cost of hot API calls, run by
+ * command-fail-event and clbench.
+ *
+ * Requires error.h, trace.h and testenv.h; the including file must
+ * define _POSIX_C_SOURCE for clock_gettime.
+ */
+
+#include <time.h>
+
+// number of timed calls for each API
+#define NCALLS 10000
+
+// host time of each call, ns
+double sample[NCALLS];
+
+// overhead of the timer itself, subtracted from the samples
+double timer_ns;
+
+// pointers returned by the timed map calls, for the unmaps
+void *mapped[NCALLS];
+
+// events returned by timed enqueues, released afterwards
+cl_event evts[NCALLS];
+
+// size of the buffers used by the timed commands: small, since we are
+// interested in the API overhead, not in the transfers
+#define CMDSZ 64
+char hostmem[CMDSZ];
+
+const char *fail_event_src[] = {
+"kernel void nop(global int *p, int v) {}\n"
+};
+
+// host function run by clEnqueueNativeKernel
+void CL_CALLBACK native_nop(void *args)
+{
+	(void)args;
+}
+
+double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1.0e9 + ts.tv_nsec;
+}
+
+// print percentiles of the samples of the last timed API
+void report(const char *name)
+{
+	qsort(sample, NCALLS, sizeof(*sample), compare_double);
+	printf("\t%-40s", name);
+	// min, median, 90th, 99th percentile, max
+	static const double pct[] = { 0, 0.5, 0.9, 0.99, 1 };
+	for (size_t i = 0; i < sizeof(pct)/sizeof(*pct); ++i) {
+		double ns = sample[(size_t)(pct[i]*(NCALLS - 1))] - timer_ns;
+		printf("\t%8.0f", ns > 0 ? ns : 0);
+	}
+	puts("");
+}
+
+// time NCALLS executions of call, which can use the index i_, and report;
+// the whole batch is traced as a host span
+#define BENCH(name, call) do { \
+	const double start_ = trace_clock(); \
+	for (cl_uint i_ = 0; i_ < NCALLS; ++i_) { \
+		const double t0_ = now_ns(); \
+		call; \
+		sample[i_] = now_ns() - t0_; \
+	} \
+	trace_host(name, start_); \
+	report(name); \
+} while (0)
+
+// time an invalid enqueue, which must fail without touching its event
+#define BENCH_FAIL(name, call) do { \
+	event = invalid_evt; \
+	BENCH(name, error = call); \
+	if (error == CL_SUCCESS) { \
+		error = CL_INVALID_VALUE; \
+		CHECK_ERROR_OUT("checking that " name " fails"); \
+	} \
+	if (event != invalid_evt) \
+		printf("\t\t(event %p written on failure)\n", event); \
+} while (0)
+
+/* time the host side of hot API calls on the device, context and queue of
+ * env. version is 10*major + minor of the device OpenCL version.
+ * Native kernels, images and SVM are only timed where the device reports
+ * support for them; the OpenCL 1.1 clEnqueueMarker/Barrier/WaitForEvents,
+ * superseded by the wait list versions, and the interop (GL, D3D, ...)
+ * acquire/release entry points are not timed
+ */
+cl_int bench_device(const struct test_env *env, unsigned int version)
+{
+	const cl_device_id d = env->dev->d;
+	const cl_context ctx = env->ctx;
+	const cl_command_queue q = env->q;
+	static const cl_event invalid_evt = (cl_event)(-1);
+	cl_event event = invalid_evt;
+	cl_event done = NULL;
+	cl_mem buf = NULL, buf2 = NULL;
+	cl_mem img = NULL, img2 = NULL;
+#ifdef CL_VERSION_2_0
+	void *svm = NULL, *svm2 = NULL;
+	cl_device_svm_capabilities svm_cap = 0;
+#endif
+	cl_device_exec_capabilities exec_cap;
+	cl_bool image_support;
+	cl_program pg = NULL;
+	cl_kernel k = NULL;
+	size_t value;
+	cl_ulong t;
+	cl_int status;
+	const cl_int pattern = 0;
+	const size_t origin[3] = { 0, 0, 0 };
+	const size_t region[3] = { CMDSZ, 1, 1 };
+	const size_t gws = 1;
+	// the images are CMDSZ bytes of RGBA8 texels
+	const size_t img_region[3] = { CMDSZ/4, 1, 1 };
+	const cl_uint color[4] = { 0, 0, 0, 0 };
+	size_t row_pitch;
+
+	cl_int error = CL_SUCCESS;
+
+	buf = clCreateBuffer(ctx, CL_MEM_READ_WRITE, CMDSZ, NULL, &error);
+	CHECK_ERROR_OUT("create buffer");
+	buf2 = clCreateBuffer(ctx, CL_MEM_READ_WRITE, CMDSZ, NULL, &error);
+	CHECK_ERROR_OUT("create buffer");
+	pg = clCreateProgramWithSource(ctx, 1, fail_event_src, NULL, &error);
+	CHECK_ERROR_OUT("create program");
+	error = clBuildProgram(pg, 1, &d, NULL, NULL, NULL);
+	CHECK_ERROR_OUT("build program");
+	k = clCreateKernel(pg, "nop", &error);
+	CHECK_ERROR_OUT("create kernel");
+	error = clSetKernelArg(k, 0, sizeof(buf), &buf);
+	CHECK_ERROR_OUT("set kernel argument");
+	error = clSetKernelArg(k, 1, sizeof(pattern), &pattern);
+	CHECK_ERROR_OUT("set kernel argument");
+
+	error = clGetDeviceInfo(d, CL_DEVICE_EXECUTION_CAPABILITIES,
+		sizeof(exec_cap), &exec_cap, NULL);
+	CHECK_ERROR_OUT("get device execution capabilities");
+	error = clGetDeviceInfo(d, CL_DEVICE_IMAGE_SUPPORT,
+		sizeof(image_support), &image_support, NULL);
+	CHECK_ERROR_OUT("get device image support");
+	// images are created with clCreateImage, from OpenCL 1.2
+	if (image_support && version >= 12) {
+		const cl_image_format fmt = { CL_RGBA, CL_UNSIGNED_INT8 };
+		cl_image_desc desc;
+		memset(&desc, 0, sizeof(desc));
+		desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+		desc.image_width = img_region[0];
+		desc.image_height = img_region[1];
+		img = clCreateImage(ctx, CL_MEM_READ_WRITE, &fmt, &desc, NULL, &error);
+		CHECK_ERROR_OUT("create image");
+		img2 = clCreateImage(ctx, CL_MEM_READ_WRITE, &fmt, &desc, NULL, &error);
+		CHECK_ERROR_OUT("create image");
+	}
+#ifdef CL_VERSION_2_0
+	// a failed query means no SVM support
+	if (version >= 20 && clGetDeviceInfo(d, CL_DEVICE_SVM_CAPABILITIES,
+			sizeof(svm_cap), &svm_cap, NULL) != CL_SUCCESS)
+		svm_cap = 0;
+	if (svm_cap & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER) {
+		svm = clSVMAlloc(ctx, CL_MEM_READ_WRITE, CMDSZ, 0);
+		svm2 = clSVMAlloc(ctx, CL_MEM_READ_WRITE, CMDSZ, 0);
+		if (!svm || !svm2) {
+			error = CL_OUT_OF_RESOURCES;
+			CHECK_ERROR_OUT("allocate SVM");
+		}
+	}
+#endif
+
+	// a completed command to query
+	error = clEnqueueWriteBuffer(q, buf, CL_TRUE, 0, CMDSZ, hostmem, 0, NULL, &done);
+	CHECK_ERROR_OUT("write buffer");
+
+	// calibrate the timer
+	timer_ns = 0;
+	BENCH("(timer)", (void)0);
+	timer_ns = sample[NCALLS/2];
+
+	printf("\t%-40s\t%8s\t%8s\t%8s\t%8s\t%8s\n", "host ns/call",
+		"min", "median", "90%", "99%", "max");
+
+	/* Queries */
+	BENCH("clGetDeviceInfo(NAME)",
+		error = clGetDeviceInfo(d, CL_DEVICE_NAME, BUFSZ, strbuf, NULL));
+	CHECK_ERROR_OUT("get device info");
+	BENCH("clGetDeviceInfo(MAX_WORK_GROUP_SIZE)",
+		error = clGetDeviceInfo(d, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(value), &value, NULL));
+	CHECK_ERROR_OUT("get device info");
+	BENCH("clGetEventProfilingInfo(END)",
+		error = clGetEventProfilingInfo(done, CL_PROFILING_COMMAND_END, sizeof(t), &t, NULL));
+	CHECK_ERROR_OUT("get event profiling info");
+	BENCH("clGetEventInfo(EXECUTION_STATUS)",
+		error = clGetEventInfo(done, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL));
+	CHECK_ERROR_OUT("get event info");
+	BENCH("clGetMemObjectInfo(SIZE)",
+		error = clGetMemObjectInfo(buf, CL_MEM_SIZE, sizeof(value), &value, NULL));
+	CHECK_ERROR_OUT("get mem object info");
+	BENCH("clGetKernelWorkGroupInfo(WORK_GROUP_SIZE)",
+		error = clGetKernelWorkGroupInfo(k, d, CL_KERNEL_WORK_GROUP_SIZE, sizeof(value), &value, NULL));
+	CHECK_ERROR_OUT("get kernel work-group info");
+
+	/* Reference counting: as many releases as retains */
+	BENCH("clRetainEvent", clRetainEvent(done));
+	BENCH("clReleaseEvent", clReleaseEvent(done));
+	BENCH("clRetainMemObject", clRetainMemObject(buf));
+	BENCH("clReleaseMemObject", clReleaseMemObject(buf));
+	BENCH("clRetainKernel", clRetainKernel(k));
+	BENCH("clReleaseKernel", clReleaseKernel(k));
+	BENCH("clRetainCommandQueue", clRetainCommandQueue(q));
+	BENCH("clReleaseCommandQueue", clReleaseCommandQueue(q));
+	BENCH("clRetainContext", clRetainContext(ctx));
+	BENCH("clReleaseContext", clReleaseContext(ctx));
+
+	/* Kernel arguments */
+	BENCH("clSetKernelArg(buffer)", error = clSetKernelArg(k, 0, sizeof(buf), &buf));
+	CHECK_ERROR_OUT("set kernel argument");
+	BENCH("clSetKernelArg(int)", error = clSetKernelArg(k, 1, sizeof(pattern), &pattern));
+	CHECK_ERROR_OUT("set kernel argument");
+
+	/* Valid enqueues, draining the queue (untimed) after each batch */
+#define BENCH_ENQUEUE(name, call) do { \
+	BENCH(name, error = call); \
+	CHECK_ERROR_OUT(name); \
+	error = clFinish(q); \
+	CHECK_ERROR_OUT("finish"); \
+} while (0)
+
+	BENCH("clFlush (empty queue)", error = clFlush(q));
+	CHECK_ERROR_OUT("flush");
+	BENCH("clFinish (empty queue)", error = clFinish(q));
+	CHECK_ERROR_OUT("finish");
+
+	BENCH_ENQUEUE("clEnqueueReadBuffer",
+		clEnqueueReadBuffer(q, buf, CL_FALSE, 0, CMDSZ, hostmem, 0, NULL, NULL));
+	BENCH_ENQUEUE("clEnqueueWriteBuffer",
+		clEnqueueWriteBuffer(q, buf, CL_FALSE, 0, CMDSZ, hostmem, 0, NULL, NULL));
+	BENCH_ENQUEUE("clEnqueueCopyBuffer",
+		clEnqueueCopyBuffer(q, buf, buf2, 0, 0, CMDSZ, 0, NULL, NULL));
+	BENCH_ENQUEUE("clEnqueueReadBufferRect",
+		clEnqueueReadBufferRect(q, buf, CL_FALSE, origin, origin, region,
+			0, 0, 0, 0, hostmem, 0, NULL, NULL));
+	BENCH_ENQUEUE("clEnqueueWriteBufferRect",
+		clEnqueueWriteBufferRect(q, buf, CL_FALSE, origin, origin, region,
+			0, 0, 0, 0, hostmem, 0, NULL, NULL));
+	BENCH_ENQUEUE("clEnqueueCopyBufferRect",
+		clEnqueueCopyBufferRect(q, buf, buf2, origin, origin, region,
+			0, 0, 0, 0, 0, NULL, NULL));
+
+	BENCH("clEnqueueMapBuffer",
+		mapped[i_] = clEnqueueMapBuffer(q, buf, CL_FALSE, CL_MAP_READ, 0, CMDSZ,
+			0, NULL, NULL, &error));
+	CHECK_ERROR_OUT("map buffer");
+	BENCH_ENQUEUE("clEnqueueUnmapMemObject",
+		clEnqueueUnmapMemObject(q, buf, mapped[i_], 0, NULL, NULL));
+
+	BENCH_ENQUEUE("clEnqueueNDRangeKernel",
+		clEnqueueNDRangeKernel(q, k, 1, NULL, &gws, NULL, 0, NULL, NULL));
+	BENCH_ENQUEUE("clEnqueueNDRangeKernel (with event)",
+		clEnqueueNDRangeKernel(q, k, 1, NULL, &gws, NULL, 0, NULL, evts + i_));
+	for (cl_uint i = 0; i < NCALLS; ++i)
+		clReleaseEvent(evts[i]);
+	// deprecated by OpenCL 2.0, but still an entry point
+	BENCH_ENQUEUE("clEnqueueTask",
+		clEnqueueTask(q, k, 0, NULL, NULL));
+	if (exec_cap & CL_EXEC_NATIVE_KERNEL) {
+		BENCH_ENQUEUE("clEnqueueNativeKernel",
+			clEnqueueNativeKernel(q, native_nop, NULL, 0, 0, NULL, NULL, 0, NULL, NULL));
+	}
+
+	if (img) {
+		BENCH_ENQUEUE("clEnqueueReadImage",
+			clEnqueueReadImage(q, img, CL_FALSE, origin, img_region, 0, 0,
+				hostmem, 0, NULL, NULL));
+		BENCH_ENQUEUE("clEnqueueWriteImage",
+			clEnqueueWriteImage(q, img, CL_FALSE, origin, img_region, 0, 0,
+				hostmem, 0, NULL, NULL));
+		BENCH_ENQUEUE("clEnqueueCopyImage",
+			clEnqueueCopyImage(q, img, img2, origin, origin, img_region, 0, NULL, NULL));
+		BENCH_ENQUEUE("clEnqueueCopyImageToBuffer",
+			clEnqueueCopyImageToBuffer(q, img, buf, origin, img_region, 0, 0, NULL, NULL));
+		BENCH_ENQUEUE("clEnqueueCopyBufferToImage",
+			clEnqueueCopyBufferToImage(q, buf, img, 0, origin, img_region, 0, NULL, NULL));
+		BENCH_ENQUEUE("clEnqueueFillImage",
+			clEnqueueFillImage(q, img, color, origin, img_region, 0, NULL, NULL));
+		BENCH("clEnqueueMapImage",
+			mapped[i_] = clEnqueueMapImage(q, img, CL_FALSE, CL_MAP_READ, origin, img_region,
+				&row_pitch, NULL, 0, NULL, NULL, &error));
+		CHECK_ERROR_OUT("map image");
+		BENCH_ENQUEUE("clEnqueueUnmapMemObject (image)",
+			clEnqueueUnmapMemObject(q, img, mapped[i_], 0, NULL, NULL));
+	}
+
+#ifdef CL_VERSION_2_0
+	if (svm) {
+		BENCH_ENQUEUE("clEnqueueSVMMemcpy",
+			clEnqueueSVMMemcpy(q, CL_FALSE, svm2, svm, CMDSZ, 0, NULL, NULL));
+		BENCH_ENQUEUE("clEnqueueSVMMemFill",
+			clEnqueueSVMMemFill(q, svm, &pattern, sizeof(pattern), CMDSZ, 0, NULL, NULL));
+		BENCH_ENQUEUE("clEnqueueSVMMap",
+			clEnqueueSVMMap(q, CL_FALSE, CL_MAP_READ, svm, CMDSZ, 0, NULL, NULL));
+		BENCH_ENQUEUE("clEnqueueSVMUnmap",
+			clEnqueueSVMUnmap(q, svm, 0, NULL, NULL));
+#ifdef CL_VERSION_2_1
+		if (version >= 21) {
+			BENCH_ENQUEUE("clEnqueueSVMMigrateMem",
+				clEnqueueSVMMigrateMem(q, 1, (const void **)&svm, NULL, 0, 0, NULL, NULL));
+		}
+#endif
+		// each free needs its own allocation, made beforehand
+		cl_uint nalloc = 0;
+		while (nalloc < NCALLS &&
+			(mapped[nalloc] = clSVMAlloc(ctx, CL_MEM_READ_WRITE, CMDSZ, 0)))
+			++nalloc;
+		if (nalloc < NCALLS) {
+			while (nalloc > 0)
+				clSVMFree(ctx, mapped[--nalloc]);
+			error = CL_OUT_OF_RESOURCES;
+			CHECK_ERROR_OUT("allocate SVM to free");
+		}
+		BENCH_ENQUEUE("clEnqueueSVMFree",
+			clEnqueueSVMFree(q, 1, mapped + i_, NULL, NULL, 0, NULL, NULL));
+	}
+#endif
+
+	if (version >= 12) {
+		BENCH_ENQUEUE("clEnqueueFillBuffer",
+			clEnqueueFillBuffer(q, buf, &pattern, sizeof(pattern), 0, CMDSZ, 0, NULL, NULL));
+		BENCH_ENQUEUE("clEnqueueMigrateMemObjects",
+			clEnqueueMigrateMemObjects(q, 1, &buf, 0, 0, NULL, NULL));
+		BENCH_ENQUEUE("clEnqueueMarkerWithWaitList",
+			clEnqueueMarkerWithWaitList(q, 0, NULL, NULL));
+		BENCH_ENQUEUE("clEnqueueBarrierWithWaitList",
+			clEnqueueBarrierWithWaitList(q, 0, NULL, NULL));
+	}
+
+	/* Invalid enqueues: how fast is the fast-fail path? */
+	BENCH_FAIL("clEnqueueReadBuffer (invalid)",
+		clEnqueueReadBuffer(q, NULL, CL_FALSE, 0, CMDSZ, hostmem, 0, NULL, &event));
+	BENCH_FAIL("clEnqueueWriteBuffer (invalid)",
+		clEnqueueWriteBuffer(q, NULL, CL_FALSE, 0, CMDSZ, hostmem, 0, NULL, &event));
+	BENCH_FAIL("clEnqueueCopyBuffer (invalid)",
+		clEnqueueCopyBuffer(q, buf, NULL, 0, 0, CMDSZ, 0, NULL, &event));
+	BENCH_FAIL("clEnqueueReadBufferRect (invalid)",
+		clEnqueueReadBufferRect(q, NULL, CL_FALSE, origin, origin, region,
+			0, 0, 0, 0, hostmem, 0, NULL, &event));
+	BENCH_FAIL("clEnqueueWriteBufferRect (invalid)",
+		clEnqueueWriteBufferRect(q, NULL, CL_FALSE, origin, origin, region,
+			0, 0, 0, 0, hostmem, 0, NULL, &event));
+	BENCH_FAIL("clEnqueueCopyBufferRect (invalid)",
+		clEnqueueCopyBufferRect(q, buf, NULL, origin, origin, region,
+			0, 0, 0, 0, 0, NULL, &event));
+	event = invalid_evt;
+	BENCH("clEnqueueMapBuffer (invalid)",
+		clEnqueueMapBuffer(q, NULL, CL_FALSE, CL_MAP_READ, 0, CMDSZ,
+			0, NULL, &event, &error));
+	if (error == CL_SUCCESS) {
+		error = CL_INVALID_VALUE;
+		CHECK_ERROR_OUT("checking that clEnqueueMapBuffer fails");
+	}
+	BENCH_FAIL("clEnqueueUnmapMemObject (invalid)",
+		clEnqueueUnmapMemObject(q, NULL, hostmem, 0, NULL, &event));
+	BENCH_FAIL("clEnqueueNDRangeKernel (invalid)",
+		clEnqueueNDRangeKernel(q, NULL, 1, NULL, &gws, NULL, 0, NULL, &event));
+	// a wait list with a NULL event is invalid
+	BENCH_FAIL("clEnqueueNDRangeKernel (invalid wait list)",
+		clEnqueueNDRangeKernel(q, k, 1, NULL, &gws, NULL, 1, NULL, &event));
+	BENCH_FAIL("clEnqueueTask (invalid)",
+		clEnqueueTask(q, NULL, 0, NULL, &event));
+	if (exec_cap & CL_EXEC_NATIVE_KERNEL) {
+		BENCH_FAIL("clEnqueueNativeKernel (invalid)",
+			clEnqueueNativeKernel(q, NULL, NULL, 0, 0, NULL, NULL, 0, NULL, &event));
+	}
+	if (img) {
+		BENCH_FAIL("clEnqueueReadImage (invalid)",
+			clEnqueueReadImage(q, NULL, CL_FALSE, origin, img_region, 0, 0,
+				hostmem, 0, NULL, &event));
+		BENCH_FAIL("clEnqueueWriteImage (invalid)",
+			clEnqueueWriteImage(q, NULL, CL_FALSE, origin, img_region, 0, 0,
+				hostmem, 0, NULL, &event));
+		BENCH_FAIL("clEnqueueCopyImage (invalid)",
+			clEnqueueCopyImage(q, img, NULL, origin, origin, img_region, 0, NULL, &event));
+		BENCH_FAIL("clEnqueueCopyImageToBuffer (invalid)",
+			clEnqueueCopyImageToBuffer(q, img, NULL, origin, img_region, 0, 0, NULL, &event));
+		BENCH_FAIL("clEnqueueCopyBufferToImage (invalid)",
+			clEnqueueCopyBufferToImage(q, buf, NULL, 0, origin, img_region, 0, NULL, &event));
+		BENCH_FAIL("clEnqueueFillImage (invalid)",
+			clEnqueueFillImage(q, NULL, color, origin, img_region, 0, NULL, &event));
+		event = invalid_evt;
+		BENCH("clEnqueueMapImage (invalid)",
+			clEnqueueMapImage(q, NULL, CL_FALSE, CL_MAP_READ, origin, img_region,
+				&row_pitch, NULL, 0, NULL, &event, &error));
+		if (error == CL_SUCCESS) {
+			error = CL_INVALID_VALUE;
+			CHECK_ERROR_OUT("checking that clEnqueueMapImage fails");
+		}
+		if (event != invalid_evt)
+			printf("\t\t(event %p written on failure)\n", event);
+	}
+#ifdef CL_VERSION_2_0
+	if (svm) {
+		BENCH_FAIL("clEnqueueSVMMemcpy (invalid)",
+			clEnqueueSVMMemcpy(q, CL_FALSE, NULL, svm, CMDSZ, 0, NULL, &event));
+		BENCH_FAIL("clEnqueueSVMMemFill (invalid)",
+			clEnqueueSVMMemFill(q, NULL, &pattern, sizeof(pattern), CMDSZ, 0, NULL, &event));
+		BENCH_FAIL("clEnqueueSVMMap (invalid)",
+			clEnqueueSVMMap(q, CL_FALSE, CL_MAP_READ, NULL, CMDSZ, 0, NULL, &event));
+		BENCH_FAIL("clEnqueueSVMUnmap (invalid)",
+			clEnqueueSVMUnmap(q, NULL, 0, NULL, &event));
+#ifdef CL_VERSION_2_1
+		if (version >= 21) {
+			BENCH_FAIL("clEnqueueSVMMigrateMem (invalid)",
+				clEnqueueSVMMigrateMem(q, 0, NULL, NULL, 0, 0, NULL, &event));
+		}
+#endif
+		// a pointer count without pointers is invalid
+		BENCH_FAIL("clEnqueueSVMFree (invalid)",
+			clEnqueueSVMFree(q, 1, NULL, NULL, NULL, 0, NULL, &event));
+	}
+#endif
+	if (version >= 12) {
+		BENCH_FAIL("clEnqueueFillBuffer (invalid)",
+			clEnqueueFillBuffer(q, NULL, &pattern, sizeof(pattern), 0, CMDSZ, 0, NULL, &event));
+		BENCH_FAIL("clEnqueueMigrateMemObjects (invalid)",
+			clEnqueueMigrateMemObjects(q, 0, NULL, 0, 0, NULL, &event));
+		BENCH_FAIL("clEnqueueMarkerWithWaitList (invalid)",
+			clEnqueueMarkerWithWaitList(q, 1, NULL, &event));
+		BENCH_FAIL("clEnqueueBarrierWithWaitList (invalid)",
+			clEnqueueBarrierWithWaitList(q, 1, NULL, &event));
+	}
+	// the last one left its (expected) failure behind
+	error = CL_SUCCESS;
+
+out:
+	clFinish(q);
+#ifdef CL_VERSION_2_0
+	if (svm2)
+		clSVMFree(ctx, svm2);
+	if (svm)
+		clSVMFree(ctx, svm);
+#endif
+	if (img2)
+		clReleaseMemObject(img2);
+	if (img)
+		clReleaseMemObject(img);
+	if (done)
+		clReleaseEvent(done);
+	if (k)
+		clReleaseKernel(k);
+	if (pg)
+		clReleaseProgram(pg);
+	if (buf2)
+		clReleaseMemObject(buf2);
+	if (buf)
+		clReleaseMemObject(buf);
+	return error;
+}
+
+/* check whether an enqueue that fails validation writes its event, then
+ * time the API calls
+ */
+cl_int fail_event_test(const struct test_env *env)
+{
+	static const cl_event invalid_evt = (cl_event)(-1);
+	cl_event event = invalid_evt;
+
+	unsigned int ocl_major, ocl_minor;
+
+	cl_int error = clGetDeviceInfo(env->dev->d, CL_DEVICE_VERSION, BUFSZ, strbuf, NULL);
+	CHECK_ERROR_OUT("getting device version");
+
+	if (sscanf(strbuf, "OpenCL %u.%u ", &ocl_major, &ocl_minor) != 2) {
+		error = CL_INVALID_VALUE;
+		CHECK_ERROR_OUT("getting OpenCL version");
+	}
+
+	// let's fire an invalid command
+	error = clEnqueueReadBuffer(env->q, NULL, CL_FALSE, 0, 0, NULL, 0, NULL, &event);
+
+	if (error == CL_SUCCESS) {
+		error = CL_INVALID_VALUE;
+		CHECK_ERROR_OUT("getting clEnqueueReadBuffer error");
+	}
+
+	printf("\t" "error %d, event %p (was: %p)\n", error, event, invalid_evt);
+
+	error = bench_device(env, ocl_major*10 + ocl_minor);
+
+out:
+	return error;
+}
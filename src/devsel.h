@@ -0,0 +1,138 @@
+/* Device discovery and selection.
+ *
+ * All devices of all platforms are listed once, numbered in discovery
+ * order. A selector picks devices by that number, by platform and device
+ * index as P:D (as the positional pn dn of the other tools), by type
+ * (cpu, gpu, accelerator, all), or by a substring of the device name.
+ *
+ * Requires error.h.
+ */
+
+#define DEVSEL_NAMESZ 256
+
+struct dev_entry {
+	cl_platform_id p;
+	cl_device_id d;
+	cl_uint pn, dn; // platform index, and device index in the platform
+	cl_device_type type;
+	cl_uint version; // platform OpenCL version, as 10*major + minor
+	char name[DEVSEL_NAMESZ];
+};
+
+struct dev_entry *dev_list;
+cl_uint dev_count;
+
+void discover_devices(void)
+{
+	cl_uint nplat, ndev;
+	cl_platform_id *plat;
+	cl_device_id *dev;
+	char version[DEVSEL_NAMESZ];
+
+	error = clGetPlatformIDs(0, NULL, &nplat);
+	CHECK_ERROR("getting amount of platform IDs");
+	plat = calloc(nplat, sizeof(*plat));
+	if (!plat) {
+		fputs("couldn't allocate platform list\n", stderr);
+		exit(1);
+	}
+	error = clGetPlatformIDs(nplat, plat, NULL);
+	CHECK_ERROR("getting platform IDs");
+
+	for (cl_uint pi = 0; pi < nplat; ++pi) {
+		cl_uint major = 1, minor = 0;
+		error = clGetPlatformInfo(plat[pi], CL_PLATFORM_VERSION, sizeof(version), version, NULL);
+		CHECK_ERROR("getting platform version");
+		sscanf(version, "OpenCL %u.%u ", &major, &minor);
+
+		error = clGetDeviceIDs(plat[pi], CL_DEVICE_TYPE_ALL, 0, NULL, &ndev);
+		if (error == CL_DEVICE_NOT_FOUND)
+			continue;
+		CHECK_ERROR("getting amount of device IDs");
+		dev = calloc(ndev, sizeof(*dev));
+		dev_list = realloc(dev_list, (dev_count + ndev)*sizeof(*dev_list));
+		if (!dev || !dev_list) {
+			fputs("couldn't allocate device list\n", stderr);
+			exit(1);
+		}
+		error = clGetDeviceIDs(plat[pi], CL_DEVICE_TYPE_ALL, ndev, dev, NULL);
+		CHECK_ERROR("getting device IDs");
+
+		for (cl_uint di = 0; di < ndev; ++di) {
+			struct dev_entry *e = dev_list + dev_count++;
+			e->p = plat[pi];
+			e->d = dev[di];
+			e->pn = pi;
+			e->dn = di;
+			e->version = 10*major + minor;
+			error = clGetDeviceInfo(dev[di], CL_DEVICE_TYPE, sizeof(e->type), &e->type, NULL);
+			CHECK_ERROR("getting device type");
+			error = clGetDeviceInfo(dev[di], CL_DEVICE_NAME, sizeof(e->name), e->name, NULL);
+			CHECK_ERROR("getting device name");
+		}
+		free(dev);
+	}
+	free(plat);
+}
+
+// whether device number idx matches the selector sel
+int device_matches(cl_uint idx, const char *sel)
+{
+	const struct dev_entry *e = dev_list + idx;
+	unsigned int a, b;
+	char extra;
+
+	if (sscanf(sel, "%u:%u%c", &a, &b, &extra) == 2)
+		return e->pn == a && e->dn == b;
+	if (sscanf(sel, "%u%c", &a, &extra) == 1)
+		return idx == a;
+	if (!strcmp(sel, "all"))
+		return 1;
+	if (!strcmp(sel, "cpu"))
+		return (e->type & CL_DEVICE_TYPE_CPU) != 0;
+	if (!strcmp(sel, "gpu"))
+		return (e->type & CL_DEVICE_TYPE_GPU) != 0;
+	if (!strcmp(sel, "accelerator"))
+		return (e->type & CL_DEVICE_TYPE_ACCELERATOR) != 0;
+	return strstr(e->name, sel) != NULL;
+}
+
+/* mark in selected[] the devices matching any of the comma-separated
+ * selectors in list; returns the number of selected devices
+ */
+cl_uint select_devices(const char *list, char *selected)
+{
+	char *copy = strdup(list);
+	cl_uint count = 0;
+
+	memset(selected, 0, dev_count);
+	for (char *tok = strtok(copy, ","); tok; tok = strtok(NULL, ","))
+		for (cl_uint i = 0; i < dev_count; ++i)
+			if (!selected[i] && device_matches(i, tok)) {
+				selected[i] = 1;
+				++count;
+			}
+	free(copy);
+	return count;
+}
+
+/* the entry of device dn of platform pn, as selected by the positional
+ * pn dn of the tools; exits if there is no such device
+ */
+const struct dev_entry *find_device(cl_uint pn, cl_uint dn)
+{
+	int platform_found = 0;
+
+	for (cl_uint i = 0; i < dev_count; ++i) {
+		if (dev_list[i].pn != pn)
+			continue;
+		platform_found = 1;
+		if (dev_list[i].dn == dn)
+			return dev_list + i;
+	}
+	if (!platform_found)
+		fprintf(stderr, "there is no platform #%u\n", pn);
+	else
+		fprintf(stderr, "there is no device #%u\n", dn);
+	exit(1);
+}
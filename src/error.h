@@ -16,3 +16,15 @@ check_ocl_error(cl_int err, const char *what, const char *func, int line)
 
 #define CHECK_ERROR(what) check_ocl_error(error, what, __func__, __LINE__)
 
+
+/* as CHECK_ERROR, but for functions that clean up after a failure and
+ * return the error to their caller: jumps to their out label instead of
+ * exiting. The error checked is the one in scope, usually a local one
+ */
+#define CHECK_ERROR_OUT(what) do { \
+	if (error != CL_SUCCESS) { \
+		fprintf(stderr, "%s:%u: %s : error %d\n", \
+			__func__, __LINE__, what, error);\
+		goto out; \
+	} \
+} while (0)
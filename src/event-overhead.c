@@ -0,0 +1,224 @@
+/* Measure what events and profiling cost: kernel launch throughput and
+ * latency with and without them, event create/release churn, and how the
+ * runtime copes with many outstanding events */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <CL/cl.h>
+
+#include "error.h"
+#include "verify.h"
+#include "trace.h"
+#include "phases.h"
+#include "overalloc.h"
+
+// number of launches for the throughput test
+#define NLAUNCH 10000
+
+// number of launches for the latency test
+#define NLAT 1000
+
+// number of event create/release cycles for the churn test
+#define NCHURN 100000
+
+// the outstanding events test enqueues launches in batches of BATCH,
+// holding on to their events, up to MAX_OUTSTANDING of them
+#define BATCH 1000
+#define MAX_OUTSTANDING (256*1024)
+
+// the runtime is considered to slow down when a launch costs this many
+// times more than with no outstanding events
+#define SLOWDOWN 2.0
+
+// queues without and with profiling
+cl_command_queue queue[2];
+const char * const profiling_name[] = { "off", "on" };
+
+cl_mem dummy; // kernel argument, never actually touched
+cl_uint zero; // number of elements processed by the kernel
+size_t lws; // launch size
+
+cl_event *held; // events held by the outstanding events test
+
+double sample[NLAT];
+
+int compare_double(const void *_a, const void *_b)
+{
+	const double a = *(const double*)_a;
+	const double b = *(const double*)_b;
+	return (a > b) - (a < b);
+}
+
+// enqueue an empty launch of the kernel on lq, with or without event
+void launch(cl_command_queue lq, cl_event *evt)
+{
+	error = clEnqueueNDRangeKernel(lq, k, 1, NULL, &lws, &lws, 0, NULL, evt);
+	CHECK_ERROR("enqueueing kernel");
+}
+
+// launch throughput and latency on the queue with or without profiling,
+// with or without events
+void launch_test(int prof, int events)
+{
+	cl_command_queue lq = queue[prof];
+	cl_event evt;
+	double start, enqueued, elapsed;
+
+	// throughput: enqueue everything, then wait
+	start = now();
+	for (cl_uint i = 0; i < NLAUNCH; ++i) {
+		launch(lq, events ? &evt : NULL);
+		if (events)
+			clReleaseEvent(evt);
+	}
+	enqueued = now() - start;
+	error = clFinish(lq);
+	CHECK_ERROR("finishing");
+	elapsed = now() - start;
+	snprintf(strbuf, BUFSZ, "throughput, profiling %s, events %s",
+		profiling_name[prof], events ? "yes" : "no");
+	trace_host(strbuf, start);
+
+	// latency: one launch at a time; only launches with an event on the
+	// profiling queue make it to the trace, outside of the timed part
+	const double lat_start = now();
+	for (cl_uint i = 0; i < NLAT; ++i) {
+		start = now();
+		launch(lq, events ? &evt : NULL);
+		error = clFinish(lq);
+		CHECK_ERROR("finishing");
+		sample[i] = now() - start;
+		if (events) {
+			if (prof)
+				trace_event(evt, "nop");
+			clReleaseEvent(evt);
+		}
+	}
+	snprintf(strbuf, BUFSZ, "latency, profiling %s, events %s",
+		profiling_name[prof], events ? "yes" : "no");
+	trace_host(strbuf, lat_start);
+	qsort(sample, NLAT, sizeof(*sample), compare_double);
+
+	printf("%-9s\t%-6s\t%10.4g\t%10.4g\t%10.4g\t%10.4g\n",
+		profiling_name[prof], events ? "yes" : "no",
+		enqueued/NLAUNCH*1.0e6, NLAUNCH/elapsed,
+		sample[NLAT/2]*1.0e6, sample[NLAT*99/100]*1.0e6);
+}
+
+// cost of an event lifecycle that involves no command at all
+void churn_test(void)
+{
+	const double start = now();
+	for (cl_uint i = 0; i < NCHURN; ++i) {
+		cl_event evt = clCreateUserEvent(ctx, &error);
+		CHECK_ERROR("creating user event");
+		clSetUserEventStatus(evt, CL_COMPLETE);
+		clReleaseEvent(evt);
+	}
+	trace_host("user event churn", start);
+	printf("user event create/complete/release: %gns\n", (now() - start)/NCHURN*1.0e9);
+}
+
+// launch cost as the number of events held grows
+void outstanding_test(int prof)
+{
+	cl_command_queue lq = queue[prof];
+	cl_uint nheld = 0, report = BATCH, slow = 0;
+	double base = 0;
+
+	printf("profiling %s\n", profiling_name[prof]);
+	puts("held events\tenqueue (us)\tlaunch (us)");
+	while (nheld < MAX_OUTSTANDING) {
+		const double start = now();
+		for (cl_uint i = 0; i < BATCH; ++i)
+			launch(lq, held + nheld + i);
+		const double enqueued = now() - start;
+		error = clFinish(lq);
+		CHECK_ERROR("finishing");
+		const double per_launch = (now() - start)/BATCH;
+		trace_host("batch", start);
+
+		if (!base)
+			base = per_launch;
+		if (!slow && per_launch > SLOWDOWN*base)
+			slow = nheld;
+
+		if (nheld + BATCH >= report || (slow == nheld && nheld)) {
+			printf("%11u\t%12.4g\t%11.4g\n", nheld,
+				enqueued/BATCH*1.0e6, per_launch*1.0e6);
+			while (report <= nheld + BATCH)
+				report *= 2;
+		}
+		nheld += BATCH;
+	}
+
+	if (slow)
+		printf("launches %gx slower with %u events held\n", SLOWDOWN, slow);
+	else
+		printf("no slowdown up to %u events held\n", nheld);
+
+	for (cl_uint i = 0; i < nheld; ++i)
+		clReleaseEvent(held[i]);
+}
+
+int main(int argc, char *argv[])
+{
+	// selected platform and device number
+	cl_uint pn = 0, dn = 0;
+
+	// set platform/device num from command line
+	if (argc > 1)
+		pn = atoi(argv[1]);
+	if (argc > 2)
+		dn = atoi(argv[2]);
+
+	setup(pn, dn);
+
+	// setup creates a queue with profiling; we need one without too
+	queue[1] = q;
+	queue[0] = clCreateCommandQueue(ctx, d, 0, &error);
+	CHECK_ERROR("creating queue without profiling");
+
+	// the kernel is launched on a single work-group, with nothing to do
+	dummy = clCreateBuffer(ctx, CL_MEM_READ_WRITE, sizeof(cl_float), NULL, &error);
+	CHECK_ERROR("allocating dummy buffer");
+	lws = wgm;
+	clSetKernelArg(k, 0, sizeof(dummy), &dummy);
+	clSetKernelArg(k, 1, sizeof(dummy), &dummy);
+	clSetKernelArg(k, 2, sizeof(zero), &zero);
+
+	held = calloc(MAX_OUTSTANDING, sizeof(*held));
+	if (!held) {
+		fputs("couldn't allocate events\n", stderr);
+		exit(1);
+	}
+
+	// warm up
+	for (int prof = 0; prof < 2; ++prof) {
+		launch(queue[prof], NULL);
+		clFinish(queue[prof]);
+	}
+
+	puts("profiling\tevents\tenqueue (us)\tlaunches/s\tmedian latency (us)\t99% latency (us)");
+	for (int prof = 0; prof < 2; ++prof)
+		for (int events = 0; events < 2; ++events)
+			launch_test(prof, events);
+
+	churn_test();
+
+	for (int prof = 0; prof < 2; ++prof)
+		outstanding_test(prof);
+
+	free(held);
+	clReleaseMemObject(dummy);
+	release_kernels();
+	clReleaseProgram(pg);
+	clReleaseCommandQueue(queue[0]);
+	clReleaseCommandQueue(q);
+	clReleaseContext(ctx);
+
+	return 0;
+}
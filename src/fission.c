@@ -0,0 +1,506 @@
+/* Compute-unit scaling and interference of sub-devices made by device
+ * fission: for each size of 1, 2, 4, ... compute units, up to the whole
+ * device, partition the device into as many sub-devices of that size as
+ * fit, measure the launch latency of an empty kernel and the bandwidth
+ * of the add kernel on one of them alone, then with all the siblings
+ * running the add kernel concurrently */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <CL/cl.h>
+
+#include "error.h"
+#include "trace.h"
+#include "phases.h"
+
+cl_uint np; // number of platforms
+cl_platform_id *platform; // list of platforms ids
+cl_platform_id p; // selected platform
+
+cl_uint nd; // number of devices in the selected platform
+cl_device_id *device; // list of device ids
+cl_device_id d; // selected device
+
+// context property: field 1 (the platform) will be set at runtime
+cl_context_properties ctx_prop[] = { CL_CONTEXT_PLATFORM, 0, 0, 0 };
+
+// generic string retrieval buffer. quick'n'dirty, hence fixed-size
+#define BUFSZ 1024
+char strbuf[BUFSZ];
+
+size_t gmem; // device global memory size
+size_t alloc_max; // max single-buffer-size on device
+size_t buf_size; // size of each buffer, the same for all sub-devices
+cl_uint nels; // number of elements in each buffer
+
+cl_uint max_cu; // compute units of the whole device
+cl_uint max_sub; // max number of sub-devices
+int by_counts, equally; // supported partition types
+
+// the add kernel of bandwidth and overalloc, and the nop of ndrangelatency
+const char *src[] = {
+"kernel void add(global float *dst, global const float *src, uint n) {\n",
+"	uint i = get_global_id(0);\n",
+"	if (i < n) dst[i] += src[i];\n",
+"}\n",
+"kernel void nop() { return; }\n"
+};
+
+// macro to round size to the next multiple of base
+#define ROUND_MUL(size, base) \
+	((size + base - 1)/base)*base
+
+#define MB (1024*1024.0)
+
+// at most this many sub-devices are used in a partition
+#define MAX_SUB 256
+
+// number of timed runs of the add kernel; the best one is reported
+#define NREPS 5
+
+// number of launches for the latency measurements; the median is reported
+#define NLAT 100
+
+// add kernels queued on each busy sibling while measuring latency
+#define BG_BATCH 8
+
+// buffers per sub-device, as a fraction of the device memory over the
+// number of compute units, so that all siblings fit at once
+#define BUFS_PER_CU_GMEM 4
+#define MAX_BUF_SIZE (256*1024*1024UL)
+
+// a partition of the device in nsub sub-devices of ncu compute units each
+struct part {
+	cl_uint ncu, nsub;
+	int root; // whether the only sub-device is the device itself
+	cl_device_id sub[MAX_SUB];
+	cl_context ctx;
+	cl_program pg;
+	cl_command_queue q[MAX_SUB];
+	cl_kernel add[MAX_SUB], nop[MAX_SUB];
+	cl_mem buf[MAX_SUB][2];
+	size_t wgm, gws;
+};
+
+// results for a partition size
+struct result {
+	cl_uint ncu, nsub;
+	double nop_us; // empty kernel latency, alone
+	double add_bw; // add kernel GB/s, alone
+	double conc_bw; // aggregate add kernel GB/s of all siblings at once
+	double conc_sub_bw; // median add kernel GB/s of each sibling at once
+	double busy_nop_us; // empty kernel latency with the siblings busy
+};
+
+// like CHECK_ERROR, but bail out to the cleanup code instead of exiting
+#define CHECK_PART(what) do { \
+	if (error != CL_SUCCESS) { \
+		fprintf(stderr, "%s:%u: %s : error %d\n", \
+			__func__, __LINE__, what, error);\
+		goto out; \
+	} \
+} while (0)
+
+cl_ulong event_time(cl_event evt, cl_profiling_info what)
+{
+	cl_ulong t;
+	error = clGetEventProfilingInfo(evt, what, sizeof(t), &t, NULL);
+	CHECK_ERROR("getting event profiling info");
+	return t;
+}
+
+int compare_double(const void *_a, const void *_b)
+{
+	const double a = *(const double*)_a;
+	const double b = *(const double*)_b;
+	return (a > b) - (a < b);
+}
+
+void release_part(struct part *pt)
+{
+	for (cl_uint s = 0; s < pt->nsub; ++s) {
+		for (int i = 0; i < 2; ++i)
+			if (pt->buf[s][i])
+				clReleaseMemObject(pt->buf[s][i]);
+		if (pt->add[s])
+			clReleaseKernel(pt->add[s]);
+		if (pt->nop[s])
+			clReleaseKernel(pt->nop[s]);
+		if (pt->q[s])
+			clReleaseCommandQueue(pt->q[s]);
+	}
+	if (pt->pg)
+		clReleaseProgram(pt->pg);
+	if (pt->ctx)
+		clReleaseContext(pt->ctx);
+	if (!pt->root)
+		for (cl_uint s = 0; s < pt->nsub; ++s)
+			clReleaseDevice(pt->sub[s]);
+	memset(pt, 0, sizeof(*pt));
+}
+
+/* partition the device in sub-devices of ncu compute units, as many as fit,
+ * and prepare context, queues, kernels and buffers on all of them;
+ * the whole device is used as is. Returns 0 (with nothing allocated) if the
+ * partition isn't supported or anything fails.
+ */
+int make_part(struct part *pt, cl_uint ncu)
+{
+	const float patt = 1;
+
+	memset(pt, 0, sizeof(*pt));
+	pt->ncu = ncu;
+
+	if (ncu == max_cu) {
+		pt->root = 1;
+		pt->nsub = 1;
+		pt->sub[0] = d;
+	} else {
+		cl_uint want = max_cu/ncu;
+		if (want > max_sub)
+			want = max_sub;
+		if (want > MAX_SUB)
+			want = MAX_SUB;
+
+		if (by_counts) {
+			// exactly want sub-devices of ncu compute units
+			cl_device_partition_property props[MAX_SUB + 3];
+			cl_uint n = 0;
+			props[n++] = CL_DEVICE_PARTITION_BY_COUNTS;
+			for (cl_uint s = 0; s < want; ++s)
+				props[n++] = ncu;
+			props[n++] = CL_DEVICE_PARTITION_BY_COUNTS_LIST_END;
+			props[n++] = 0;
+			error = clCreateSubDevices(d, props, want, pt->sub, &pt->nsub);
+		} else {
+			// as many as the runtime makes, which must fit in sub
+			const cl_device_partition_property props[] = {
+				CL_DEVICE_PARTITION_EQUALLY, ncu, 0
+			};
+			error = clCreateSubDevices(d, props, 0, NULL, &pt->nsub);
+			if (error == CL_SUCCESS && pt->nsub > MAX_SUB)
+				error = CL_DEVICE_PARTITION_FAILED;
+			if (error == CL_SUCCESS)
+				error = clCreateSubDevices(d, props, pt->nsub, pt->sub, NULL);
+		}
+		if (error != CL_SUCCESS) {
+			printf("partition in sub-devices of %u compute units failed (error %d), skipping\n",
+				ncu, error);
+			pt->nsub = 0;
+			return 0;
+		}
+	}
+
+	pt->ctx = clCreateContext(ctx_prop, pt->nsub, pt->sub, NULL, NULL, &error);
+	CHECK_PART("creating context");
+	pt->pg = clCreateProgramWithSource(pt->ctx, sizeof(src)/sizeof(*src), src, NULL, &error);
+	CHECK_PART("creating program");
+	error = clBuildProgram(pt->pg, pt->nsub, pt->sub, NULL, NULL, NULL);
+	if (error == CL_BUILD_PROGRAM_FAILURE) {
+		clGetProgramBuildInfo(pt->pg, pt->sub[0], CL_PROGRAM_BUILD_LOG,
+			BUFSZ, strbuf, NULL);
+		printf("=== BUILD LOG ===\n%s\n=========\n", strbuf);
+	}
+	CHECK_PART("building program");
+
+	// each sub-device gets its own kernels, so that they can run concurrently
+	// with different arguments
+	for (cl_uint s = 0; s < pt->nsub; ++s) {
+		pt->q[s] = clCreateCommandQueue(pt->ctx, pt->sub[s], CL_QUEUE_PROFILING_ENABLE, &error);
+		CHECK_PART("creating queue");
+		snprintf(strbuf, BUFSZ, "%u CUs: sub-device %u", ncu, s);
+		trace_name_queue(pt->q[s], strbuf);
+		pt->add[s] = clCreateKernel(pt->pg, "add", &error);
+		CHECK_PART("creating kernel add");
+		pt->nop[s] = clCreateKernel(pt->pg, "nop", &error);
+		CHECK_PART("creating kernel nop");
+		for (int i = 0; i < 2; ++i) {
+			pt->buf[s][i] = clCreateBuffer(pt->ctx, CL_MEM_READ_WRITE, buf_size, NULL, &error);
+			CHECK_PART("allocating buffer");
+			error = clEnqueueFillBuffer(pt->q[s], pt->buf[s][i], &patt, sizeof(patt), 0, buf_size,
+				0, NULL, NULL);
+			CHECK_PART("filling buffer");
+		}
+		clSetKernelArg(pt->add[s], 0, sizeof(cl_mem), pt->buf[s]);
+		clSetKernelArg(pt->add[s], 1, sizeof(cl_mem), pt->buf[s] + 1);
+		clSetKernelArg(pt->add[s], 2, sizeof(nels), &nels);
+		error = clFinish(pt->q[s]);
+		CHECK_PART("finishing fill");
+	}
+
+	error = clGetKernelWorkGroupInfo(pt->add[0], pt->sub[0], CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+			sizeof(pt->wgm), &pt->wgm, NULL);
+	CHECK_PART("getting preferred workgroup size multiple");
+	pt->gws = ROUND_MUL(nels, pt->wgm);
+	return 1;
+
+out:
+	release_part(pt);
+	return 0;
+}
+
+// median launch-to-completion time of the empty kernel on sub-device s, in us
+double nop_latency(struct part *pt, cl_uint s)
+{
+	double sample[NLAT];
+	const size_t one = 1;
+
+	for (cl_uint i = 0; i < NLAT; ++i) {
+		const double start = now();
+		error = clEnqueueNDRangeKernel(pt->q[s], pt->nop[s], 1, NULL, &one, NULL, 0, NULL, NULL);
+		CHECK_ERROR("enqueueing nop");
+		error = clFinish(pt->q[s]);
+		CHECK_ERROR("finishing nop");
+		sample[i] = now() - start;
+	}
+	qsort(sample, NLAT, sizeof(*sample), compare_double);
+	return sample[NLAT/2]*1.0e6;
+}
+
+// enqueue the add kernel on sub-device s
+void enqueue_add(struct part *pt, cl_uint s, cl_event *evt)
+{
+	error = clEnqueueNDRangeKernel(pt->q[s], pt->add[s], 1, NULL, &pt->gws, &pt->wgm,
+		0, NULL, evt);
+	CHECK_ERROR("enqueueing add");
+}
+
+// dst is read and written, src is read
+#define ADD_BYTES (3.0*buf_size)
+
+// best add kernel bandwidth on sub-device s alone, GB/s
+double add_bandwidth(struct part *pt, cl_uint s)
+{
+	double best = 0;
+
+	// the first run is a warm-up
+	for (int rep = 0; rep <= NREPS; ++rep) {
+		cl_event evt;
+		enqueue_add(pt, s, &evt);
+		error = clWaitForEvents(1, &evt);
+		CHECK_ERROR("waiting for add");
+		trace_event(evt, "add");
+		const double bw = ADD_BYTES/(event_time(evt, CL_PROFILING_COMMAND_END) -
+			event_time(evt, CL_PROFILING_COMMAND_START));
+		clReleaseEvent(evt);
+		if (rep > 0 && bw > best)
+			best = bw;
+	}
+	return best;
+}
+
+/* the add kernel on all sub-devices at once: best aggregate bandwidth over
+ * NREPS rounds (all sub-devices share the parent device clock), and median
+ * bandwidth of each sub-device over all rounds
+ */
+void concurrent_add(struct part *pt, double *agg, double *per_sub)
+{
+	cl_event evt[MAX_SUB];
+	double *sample = calloc(NREPS*pt->nsub, sizeof(*sample));
+	if (!sample) {
+		fputs("couldn't allocate timing array\n", stderr);
+		exit(1);
+	}
+
+	*agg = 0;
+	for (int rep = 0; rep <= NREPS; ++rep) {
+		cl_ulong first = 0, last = 0;
+		for (cl_uint s = 0; s < pt->nsub; ++s) {
+			enqueue_add(pt, s, evt + s);
+			clFlush(pt->q[s]);
+		}
+		error = clWaitForEvents(pt->nsub, evt);
+		CHECK_ERROR("waiting for concurrent adds");
+		for (cl_uint s = 0; s < pt->nsub; ++s) {
+			const cl_ulong start = event_time(evt[s], CL_PROFILING_COMMAND_START);
+			const cl_ulong end = event_time(evt[s], CL_PROFILING_COMMAND_END);
+			if (!s || start < first)
+				first = start;
+			if (end > last)
+				last = end;
+			if (rep > 0)
+				sample[(rep - 1)*pt->nsub + s] = ADD_BYTES/(end - start);
+			trace_event(evt[s], "concurrent add");
+			clReleaseEvent(evt[s]);
+		}
+		const double bw = pt->nsub*ADD_BYTES/(last - first);
+		if (rep > 0 && bw > *agg)
+			*agg = bw;
+	}
+	qsort(sample, NREPS*pt->nsub, sizeof(*sample), compare_double);
+	*per_sub = sample[NREPS*pt->nsub/2];
+	free(sample);
+}
+
+// empty kernel latency on sub-device 0 while the others run add kernels
+double busy_latency(struct part *pt)
+{
+	for (cl_uint s = 1; s < pt->nsub; ++s) {
+		for (int b = 0; b < BG_BATCH; ++b)
+			enqueue_add(pt, s, NULL);
+		clFlush(pt->q[s]);
+	}
+	const double lat = nop_latency(pt, 0);
+	for (cl_uint s = 1; s < pt->nsub; ++s) {
+		error = clFinish(pt->q[s]);
+		CHECK_ERROR("finishing background adds");
+	}
+	return lat;
+}
+
+int main(int argc, char *argv[])
+{
+	// selected platform and device number
+	cl_uint pn = 0, dn = 0;
+	cl_device_partition_property part_props[8];
+	size_t part_props_size = 0;
+
+	// set platform/device num from command line
+	if (argc > 1)
+		pn = atoi(argv[1]);
+	if (argc > 2)
+		dn = atoi(argv[2]);
+
+	error = clGetPlatformIDs(0, NULL, &np);
+	CHECK_ERROR("getting amount of platform IDs");
+	printf("%u platforms found\n", np);
+	if (pn >= np) {
+		fprintf(stderr, "there is no platform #%u\n" , pn);
+		exit(1);
+	}
+	// only allocate for IDs up to the intended one
+	platform = calloc(pn+1,sizeof(*platform));
+	// if allocation failed, next call will bomb. rely on this
+	error = clGetPlatformIDs(pn+1, platform, NULL);
+	CHECK_ERROR("getting platform IDs");
+
+	// choose platform
+	p = platform[pn];
+	ctx_prop[1] = (cl_context_properties)p;
+
+	error = clGetPlatformInfo(p, CL_PLATFORM_NAME, BUFSZ, strbuf, NULL);
+	CHECK_ERROR("getting platform name");
+	printf("using platform %u: %s\n", pn, strbuf);
+
+	error = clGetDeviceIDs(p, CL_DEVICE_TYPE_ALL, 0, NULL, &nd);
+	CHECK_ERROR("getting amount of device IDs");
+	printf("%u devices found\n", nd);
+	if (dn >= nd) {
+		fprintf(stderr, "there is no device #%u\n", dn);
+		exit(1);
+	}
+	// only allocate for IDs up to the intended one
+	device = calloc(dn+1,sizeof(*device));
+	// if allocation failed, next call will bomb. rely on this
+	error = clGetDeviceIDs(p, CL_DEVICE_TYPE_ALL, dn+1, device, NULL);
+	CHECK_ERROR("getting device IDs");
+
+	// choose device
+	d = device[dn];
+	error = clGetDeviceInfo(d, CL_DEVICE_NAME, BUFSZ, strbuf, NULL);
+	CHECK_ERROR("getting device name");
+	printf("using device %u: %s\n", dn, strbuf);
+
+	error = clGetDeviceInfo(d, CL_DEVICE_GLOBAL_MEM_SIZE,
+			sizeof(gmem), &gmem, NULL);
+	CHECK_ERROR("getting device global memory size");
+	error = clGetDeviceInfo(d, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+			sizeof(alloc_max), &alloc_max, NULL);
+	CHECK_ERROR("getting device max memory allocation size");
+	error = clGetDeviceInfo(d, CL_DEVICE_MAX_COMPUTE_UNITS,
+			sizeof(max_cu), &max_cu, NULL);
+	CHECK_ERROR("getting device compute units");
+
+	// fission needs OpenCL 1.2; older devices fail these queries, and
+	// get only the whole device
+	if (clGetDeviceInfo(d, CL_DEVICE_PARTITION_MAX_SUB_DEVICES,
+			sizeof(max_sub), &max_sub, NULL) != CL_SUCCESS)
+		max_sub = 0;
+	if (clGetDeviceInfo(d, CL_DEVICE_PARTITION_PROPERTIES,
+			sizeof(part_props), part_props, &part_props_size) != CL_SUCCESS)
+		part_props_size = 0;
+	for (size_t i = 0; i < part_props_size/sizeof(*part_props); ++i) {
+		if (part_props[i] == CL_DEVICE_PARTITION_EQUALLY)
+			equally = 1;
+		if (part_props[i] == CL_DEVICE_PARTITION_BY_COUNTS)
+			by_counts = 1;
+	}
+	printf("%u compute units, up to %u sub-devices, partition%s%s%s\n",
+		max_cu, max_sub, equally ? " equally" : "", by_counts ? " by counts" : "",
+		equally || by_counts ? "" : ": not supported");
+
+	// the same buffers for all partitions, so that results compare
+	size_t size = gmem/BUFS_PER_CU_GMEM/(max_cu ? max_cu : 1);
+	if (size > alloc_max)
+		size = alloc_max;
+	if (size > MAX_BUF_SIZE)
+		size = MAX_BUF_SIZE;
+	nels = size/sizeof(cl_float);
+	buf_size = nels*sizeof(cl_float);
+	printf("using two buffers of %gMB per sub-device\n", buf_size/MB);
+
+	// sizes: powers of two below the whole device, then the whole device
+#define MAX_SIZES (8*sizeof(cl_uint) + 1)
+	cl_uint sizes[MAX_SIZES], nsizes = 0;
+	for (cl_uint ncu = 1; ncu < max_cu; ncu *= 2)
+		sizes[nsizes++] = ncu;
+	sizes[nsizes++] = max_cu;
+
+	struct result res[MAX_SIZES];
+	cl_uint nres = 0;
+
+	for (cl_uint i = 0; i < nsizes; ++i) {
+		const cl_uint ncu = sizes[i];
+		struct part pt;
+		struct result *r = res + nres;
+
+		if (ncu < max_cu && !equally && !by_counts)
+			continue;
+		if (!make_part(&pt, ncu))
+			continue;
+
+		memset(r, 0, sizeof(*r));
+		r->ncu = ncu;
+		r->nsub = pt.nsub;
+		printf("== %u compute units: %u sub-device%s ==\n", ncu, pt.nsub,
+			pt.nsub > 1 ? "s" : "");
+
+		r->nop_us = nop_latency(&pt, 0);
+		r->add_bw = add_bandwidth(&pt, 0);
+		printf("alone: empty kernel latency %gus, add kernel %gGB/s\n",
+			r->nop_us, r->add_bw);
+
+		if (pt.nsub > 1) {
+			concurrent_add(&pt, &r->conc_bw, &r->conc_sub_bw);
+			printf("%u concurrent: add kernel %gGB/s total, %gGB/s per sub-device (%.3g%% of alone)\n",
+				pt.nsub, r->conc_bw, r->conc_sub_bw, r->conc_sub_bw*100/r->add_bw);
+			r->busy_nop_us = busy_latency(&pt);
+			printf("with %u busy siblings: empty kernel latency %gus (%.3gx alone)\n",
+				pt.nsub - 1, r->busy_nop_us, r->busy_nop_us/r->nop_us);
+		}
+
+		release_part(&pt);
+		++nres;
+	}
+
+	puts("Summary:");
+	puts("CUs\tsubdevs\tnop us\tadd GB/s\tspeedup\tconc GB/s\tper-sub %\tbusy nop us");
+	for (cl_uint i = 0; i < nres; ++i) {
+		const struct result *r = res + i;
+		// add bandwidth relative to the smallest sub-device
+		const double speedup = r->add_bw/res[0].add_bw;
+		printf("%u\t%u\t%g\t%g\t%.3g\t", r->ncu, r->nsub, r->nop_us, r->add_bw, speedup);
+		if (r->nsub > 1)
+			printf("%g\t%.3g\t%g\n", r->conc_bw, r->conc_sub_bw*100/r->add_bw, r->busy_nop_us);
+		else
+			puts("-\t-\t-");
+	}
+
+	free(device);
+	free(platform);
+
+	return 0;
+}
@@ -0,0 +1,311 @@
+/* Host memory allocation for the backing store of CL_MEM_USE_HOST_PTR
+ * buffers, with control over alignment, page size and NUMA placement.
+ *
+ * Strategies: calloc (what the tools always did), page (posix_memalign
+ * to the page size), devalign (posix_memalign to host_align, meant to be
+ * CL_DEVICE_MEM_BASE_ADDR_ALIGN), thp (2MB-aligned mapping with
+ * madvise(MADV_HUGEPAGE), for transparent huge pages) and hugetlb
+ * (MAP_HUGETLB, which needs reserved huge pages).
+ *
+ * Placements: default (no policy), local (bound to the node of the
+ * thread that called numa_detect), remote (bound to another node),
+ * interleave (pages spread over all nodes) and firsttouch (default
+ * policy, pages touched first by a thread pinned to the CPUs of the local
+ * node). Binding uses the mbind system call directly, so that libnuma is
+ * not needed, and moves pages the allocator already touched. On
+ * single-node machines (or without NUMA support) remote and interleave
+ * are not available and the others are all equivalent.
+ *
+ * Requires CL/cl.h; the including file must define _GNU_SOURCE for the
+ * CPU affinity calls and the huge page flags.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+enum alloc_strategy {
+	ALLOC_CALLOC,
+	ALLOC_PAGE,
+	ALLOC_DEVALIGN,
+	ALLOC_THP,
+	ALLOC_HUGETLB,
+	NUM_ALLOC_STRATS
+};
+
+const char * const alloc_strategy_name[] = {
+	"calloc", "page", "devalign", "thp", "hugetlb"
+};
+
+enum placement {
+	PLACE_DEFAULT,
+	PLACE_LOCAL,
+	PLACE_REMOTE,
+	PLACE_INTERLEAVE,
+	PLACE_FIRSTTOUCH,
+	NUM_PLACEMENTS
+};
+
+const char * const placement_name[] = {
+	"default", "local", "remote", "interleave", "firsttouch"
+};
+
+// memory policies, from linux/mempolicy.h
+#define HOSTALLOC_MPOL_BIND 2
+#define HOSTALLOC_MPOL_INTERLEAVE 3
+#define HOSTALLOC_MPOL_MF_MOVE (1 << 1)
+
+// size (and alignment) of the huge pages of thp and hugetlb
+#define HOSTALLOC_HUGE (2*1024*1024UL)
+
+// we handle at most this many nodes, as bits of an unsigned long
+#define HOSTALLOC_MAX_NODES (8*sizeof(unsigned long))
+
+// size of the sysfs lines and file names we handle
+#define HOSTALLOC_LINESZ 1024
+
+// number of pages sampled to report where an allocation actually is
+#define HOSTALLOC_SAMPLES 1024
+
+unsigned long numa_online; // mask of the online nodes
+cl_uint numa_nodes; // number of online nodes
+cl_uint numa_local; // node of the thread that called numa_detect
+cl_uint numa_remote; // the first other online node, if any
+
+size_t host_align; // alignment of devalign, bytes
+
+/* parse a sysfs list such as 0-3,8,10-11 into a bitmask of (at most)
+ * nbits bits; returns 0 if the file can't be read
+ */
+int read_sysfs_list(const char *fname, unsigned long *mask, size_t nbits)
+{
+	char line[HOSTALLOC_LINESZ];
+	FILE *f = fopen(fname, "r");
+	char *s;
+
+	memset(mask, 0, (nbits + HOSTALLOC_MAX_NODES - 1)/HOSTALLOC_MAX_NODES*sizeof(*mask));
+	if (!f)
+		return 0;
+	s = fgets(line, sizeof(line), f);
+	fclose(f);
+	if (!s)
+		return 0;
+
+	while (*s && *s != '\n') {
+		unsigned long lo = strtoul(s, &s, 10), hi = lo;
+		if (*s == '-')
+			hi = strtoul(s + 1, &s, 10);
+		for (unsigned long b = lo; b <= hi && b < nbits; ++b)
+			mask[b/HOSTALLOC_MAX_NODES] |= 1UL << (b % HOSTALLOC_MAX_NODES);
+		if (*s == ',')
+			++s;
+		else
+			break;
+	}
+	return 1;
+}
+
+// find the online nodes and the node we are running on
+void numa_detect(void)
+{
+	unsigned cpu, node;
+
+	numa_nodes = 1;
+	numa_local = numa_remote = 0;
+	if (!read_sysfs_list("/sys/devices/system/node/online", &numa_online, HOSTALLOC_MAX_NODES)
+		|| !numa_online) {
+		numa_online = 1;
+		return;
+	}
+	numa_nodes = __builtin_popcountl(numa_online);
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+		numa_local = node;
+	for (cl_uint n = 0; n < HOSTALLOC_MAX_NODES; ++n)
+		if (n != numa_local && (numa_online & (1UL << n))) {
+			numa_remote = n;
+			break;
+		}
+}
+
+// whether placement pl makes sense on this machine
+int placement_available(enum placement pl)
+{
+	return numa_nodes > 1 || (pl != PLACE_REMOTE && pl != PLACE_INTERLEAVE);
+}
+
+struct touch_args {
+	void *ptr;
+	size_t size;
+	cl_uint node;
+};
+
+// first touch of the memory from the CPUs of the given node
+void *touch_thread(void *_args)
+{
+	const struct touch_args *args = _args;
+	unsigned long cpus[CPU_SETSIZE/HOSTALLOC_MAX_NODES];
+	char fname[HOSTALLOC_LINESZ];
+	cpu_set_t set;
+
+	snprintf(fname, HOSTALLOC_LINESZ, "/sys/devices/system/node/node%u/cpulist", args->node);
+	if (read_sysfs_list(fname, cpus, CPU_SETSIZE)) {
+		CPU_ZERO(&set);
+		for (int c = 0; c < CPU_SETSIZE; ++c)
+			if (cpus[c/HOSTALLOC_MAX_NODES] & (1UL << (c % HOSTALLOC_MAX_NODES)))
+				CPU_SET(c, &set);
+		if (sched_setaffinity(0, sizeof(set), &set))
+			perror("pinning first-touch thread");
+	}
+	memset(args->ptr, 0, args->size);
+	return NULL;
+}
+
+// size actually allocated for size bytes with strategy s
+size_t host_alloc_size(size_t size, enum alloc_strategy s)
+{
+	if (s == ALLOC_THP || s == ALLOC_HUGETLB)
+		return (size + HOSTALLOC_HUGE - 1)/HOSTALLOC_HUGE*HOSTALLOC_HUGE;
+	return size;
+}
+
+// allocate with strategy s, without touching the memory where possible
+void *host_alloc_raw(size_t size, enum alloc_strategy s)
+{
+	const size_t full = host_alloc_size(size, s);
+	void *ptr = NULL;
+
+	switch (s) {
+	case ALLOC_CALLOC:
+		return calloc(size, 1);
+	case ALLOC_PAGE:
+		return posix_memalign(&ptr, sysconf(_SC_PAGESIZE), size) ? NULL : ptr;
+	case ALLOC_DEVALIGN:
+		return posix_memalign(&ptr, host_align > sizeof(void*) ? host_align : sizeof(void*),
+			size) ? NULL : ptr;
+	case ALLOC_THP:
+#ifdef MADV_HUGEPAGE
+		{
+			// map an extra huge page and trim the mapping to a huge page boundary
+			char *map = mmap(NULL, full + HOSTALLOC_HUGE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (map == MAP_FAILED)
+				return NULL;
+			char *aligned = (char*)(((size_t)map + HOSTALLOC_HUGE - 1)/HOSTALLOC_HUGE*HOSTALLOC_HUGE);
+			if (aligned > map)
+				munmap(map, aligned - map);
+			munmap(aligned + full, map + HOSTALLOC_HUGE - aligned);
+			if (madvise(aligned, full, MADV_HUGEPAGE))
+				perror("madvise(MADV_HUGEPAGE)");
+			return aligned;
+		}
+#else
+		return NULL;
+#endif
+	case ALLOC_HUGETLB:
+#ifdef MAP_HUGETLB
+		ptr = mmap(NULL, full, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		return ptr == MAP_FAILED ? NULL : ptr;
+#else
+		return NULL;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+void host_free(void *ptr, size_t size, enum alloc_strategy s)
+{
+	if (!ptr)
+		return;
+	if (s == ALLOC_THP || s == ALLOC_HUGETLB)
+		munmap(ptr, host_alloc_size(size, s));
+	else
+		free(ptr);
+}
+
+/* allocate size bytes of zeroed memory with strategy s and placement pl;
+ * returns NULL on failure, or if the placement is not available
+ */
+void *host_alloc(size_t size, enum alloc_strategy s, enum placement pl)
+{
+	const size_t page = sysconf(_SC_PAGESIZE);
+	unsigned long mask = 0;
+	int mode = -1;
+
+	if (!placement_available(pl))
+		return NULL;
+
+	char *ptr = host_alloc_raw(size, s);
+	if (!ptr)
+		return NULL;
+
+	switch (pl) {
+	case PLACE_LOCAL:
+	case PLACE_REMOTE:
+		mode = HOSTALLOC_MPOL_BIND;
+		mask = 1UL << (pl == PLACE_LOCAL ? numa_local : numa_remote);
+		break;
+	case PLACE_INTERLEAVE:
+		mode = HOSTALLOC_MPOL_INTERLEAVE;
+		mask = numa_online;
+		break;
+	default:
+		break;
+	}
+
+	if (mode >= 0 && numa_nodes > 1) {
+		// the policy applies to the whole pages in the allocation, as they
+		// are first touched; those the allocator touched already are moved
+		char *lo = (char*)(((size_t)ptr + page - 1)/page*page);
+		char *hi = (char*)(((size_t)ptr + size)/page*page);
+		if (hi > lo && syscall(SYS_mbind, lo, hi - lo, mode, &mask,
+				HOSTALLOC_MAX_NODES + 1, HOSTALLOC_MPOL_MF_MOVE)) {
+			perror("mbind");
+			host_free(ptr, size, s);
+			return NULL;
+		}
+	}
+
+	if (pl == PLACE_FIRSTTOUCH) {
+		struct touch_args args = { ptr, size, numa_local };
+		pthread_t thr;
+		if (pthread_create(&thr, NULL, touch_thread, &args)) {
+			host_free(ptr, size, s);
+			return NULL;
+		}
+		pthread_join(thr, NULL);
+	} else if (s != ALLOC_CALLOC || mode >= 0) {
+		memset(ptr, 0, size);
+	}
+	return ptr;
+}
+
+// print how the pages of [ptr, ptr + size) are spread over the nodes
+void placement_report(const void *ptr, size_t size)
+{
+	const size_t page = sysconf(_SC_PAGESIZE);
+	const size_t npages = (size + page - 1)/page;
+	const size_t nsamples = npages < HOSTALLOC_SAMPLES ? npages : HOSTALLOC_SAMPLES;
+	void *pages[HOSTALLOC_SAMPLES];
+	int status[HOSTALLOC_SAMPLES];
+	size_t count[HOSTALLOC_MAX_NODES] = { 0 };
+
+	if (numa_nodes < 2 || !nsamples)
+		return;
+	for (size_t i = 0; i < nsamples; ++i)
+		pages[i] = (char*)ptr + (i*npages/nsamples)*page;
+	// move_pages without target nodes only reports where the pages are
+	if (syscall(SYS_move_pages, 0, nsamples, pages, NULL, status, 0))
+		return;
+	for (size_t i = 0; i < nsamples; ++i)
+		if (status[i] >= 0 && (size_t)status[i] < HOSTALLOC_MAX_NODES)
+			++count[status[i]];
+	printf("\tpages by node:");
+	for (cl_uint n = 0; n < HOSTALLOC_MAX_NODES; ++n)
+		if (count[n])
+			printf(" %u: %.0f%%", n, 100.0*count[n]/nsamples);
+	puts("");
+}
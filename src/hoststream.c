@@ -0,0 +1,80 @@
+/* Measure the native host memory bandwidth, STREAM-style, with the buffer
+ * size bandwidth uses for the given device, as a reference for its results */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <CL/cl.h>
+
+#include "error.h"
+#include "trace.h"
+#include "hoststream.h"
+
+#define MB (1024*1024.0)
+
+int main(int argc, char *argv[])
+{
+	// selected platform and device number
+	cl_uint pn = 0, dn = 0;
+
+	cl_uint np, nd;
+	cl_platform_id *platform;
+	cl_device_id *device;
+	size_t gmem, alloc_max, buf_size;
+
+	// set platform/device num from command line
+	if (argc > 1)
+		pn = atoi(argv[1]);
+	if (argc > 2)
+		dn = atoi(argv[2]);
+
+	error = clGetPlatformIDs(0, NULL, &np);
+	CHECK_ERROR("getting amount of platform IDs");
+	if (pn >= np) {
+		fprintf(stderr, "there is no platform #%u\n" , pn);
+		exit(1);
+	}
+	platform = calloc(pn+1,sizeof(*platform));
+	error = clGetPlatformIDs(pn+1, platform, NULL);
+	CHECK_ERROR("getting platform IDs");
+
+	error = clGetDeviceIDs(platform[pn], CL_DEVICE_TYPE_ALL, 0, NULL, &nd);
+	CHECK_ERROR("getting amount of device IDs");
+	if (dn >= nd) {
+		fprintf(stderr, "there is no device #%u\n", dn);
+		exit(1);
+	}
+	device = calloc(dn+1,sizeof(*device));
+	error = clGetDeviceIDs(platform[pn], CL_DEVICE_TYPE_ALL, dn+1, device, NULL);
+	CHECK_ERROR("getting device IDs");
+
+	error = clGetDeviceInfo(device[dn], CL_DEVICE_GLOBAL_MEM_SIZE,
+			sizeof(gmem), &gmem, NULL);
+	CHECK_ERROR("getting device global memory size");
+	error = clGetDeviceInfo(device[dn], CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+			sizeof(alloc_max), &alloc_max, NULL);
+	CHECK_ERROR("getting device max memory allocation size");
+
+	// the buffer size bandwidth uses for two buffers
+	if (alloc_max > gmem/2)
+		buf_size = gmem/2;
+	else
+		buf_size = alloc_max;
+
+	for (int nt = 0; nt < 2; ++nt) {
+		if (!host_stream(buf_size, nt)) {
+			fputs("host stream failed\n", stderr);
+			exit(1);
+		}
+		printf("%u threads, %s stores, arrays of %gMB:\n", stream_nthreads,
+			nt ? "non-temporal" : "regular", stream_size/MB);
+		stream_report();
+	}
+
+	free(device);
+	free(platform);
+
+	return 0;
+}
@@ -0,0 +1,280 @@
+/* Native host memory bandwidth, STREAM-style: copy (c = a), scale
+ * (b = s*c), add (c = a + b) and triad (a = b + s*c) over three arrays,
+ * split across one thread per online CPU, with SSE loads and stores
+ * (optionally non-temporal) when available. Each thread initializes its
+ * own slice, so that first-touch places it near the thread.
+ *
+ * Bandwidth counts the bytes actually moved: two arrays for copy and
+ * scale, three for add and triad, as STREAM does.
+ *
+ * Requires error.h and trace.h (for trace_clock()); the including file
+ * must define _POSIX_C_SOURCE for pthread barriers and sysconf.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+enum stream_op {
+	ST_COPY,
+	ST_SCALE,
+	ST_ADD,
+	ST_TRIAD,
+	NUM_STREAM_OPS,
+	ST_INIT = NUM_STREAM_OPS, // not timed: first touch
+	ST_QUIT
+};
+
+const char * const stream_op_name[] = { "copy", "scale", "add", "triad" };
+const cl_uint stream_op_arrays[] = { 2, 2, 3, 3 };
+
+#define STREAM_SCALAR 3.0f
+
+// number of timed repetitions of each operation
+#define STREAM_NTIMES 5
+
+// at most this fraction of the physical memory is used for the three arrays
+#define STREAM_MAX_MEM_FRACTION 2
+
+// alignment of the arrays and granularity of the per-thread slices, in floats
+#define STREAM_ALIGN 16
+
+float *stream_a, *stream_b, *stream_c;
+size_t stream_n; // elements per array
+size_t stream_size; // bytes per array
+cl_uint stream_nthreads;
+int stream_nontemporal;
+
+// runtimes in ms of each repetition of each operation, sorted after the run
+double stream_runtimes[NUM_STREAM_OPS][STREAM_NTIMES];
+
+pthread_barrier_t stream_barrier;
+enum stream_op stream_cur; // operation the threads are running
+
+// run the current operation over elements [lo, hi)
+void stream_slice(size_t lo, size_t hi)
+{
+	float * restrict a = stream_a, * restrict b = stream_b, * restrict c = stream_c;
+	size_t i;
+
+	switch (stream_cur) {
+	case ST_INIT:
+		for (i = lo; i < hi; ++i) {
+			a[i] = 1;
+			b[i] = 2;
+			c[i] = 0;
+		}
+		return;
+	case ST_QUIT:
+		return;
+#ifdef __SSE__
+	default:
+		break;
+	}
+
+	const __m128 s = _mm_set1_ps(STREAM_SCALAR);
+
+	// the loops are duplicated so that the store kind is not decided per element
+#define STREAM_LOOP(dst, expr) do { \
+	if (stream_nontemporal) \
+		for (i = lo; i < hi; i += 4) _mm_stream_ps(dst + i, expr); \
+	else \
+		for (i = lo; i < hi; i += 4) _mm_store_ps(dst + i, expr); \
+} while (0)
+
+	switch (stream_cur) {
+	case ST_COPY:
+		STREAM_LOOP(c, _mm_load_ps(a + i));
+		break;
+	case ST_SCALE:
+		STREAM_LOOP(b, _mm_mul_ps(s, _mm_load_ps(c + i)));
+		break;
+	case ST_ADD:
+		STREAM_LOOP(c, _mm_add_ps(_mm_load_ps(a + i), _mm_load_ps(b + i)));
+		break;
+	case ST_TRIAD:
+		STREAM_LOOP(a, _mm_add_ps(_mm_load_ps(b + i), _mm_mul_ps(s, _mm_load_ps(c + i))));
+		break;
+	default:
+		break;
+	}
+#undef STREAM_LOOP
+	if (stream_nontemporal)
+		_mm_sfence();
+#else
+	// no SIMD, no non-temporal stores: plain loops
+	case ST_COPY:
+		for (i = lo; i < hi; ++i) c[i] = a[i];
+		break;
+	case ST_SCALE:
+		for (i = lo; i < hi; ++i) b[i] = STREAM_SCALAR*c[i];
+		break;
+	case ST_ADD:
+		for (i = lo; i < hi; ++i) c[i] = a[i] + b[i];
+		break;
+	case ST_TRIAD:
+		for (i = lo; i < hi; ++i) a[i] = b[i] + STREAM_SCALAR*c[i];
+		break;
+	}
+#endif
+}
+
+// elements [lo, hi) of thread t
+void stream_range(cl_uint t, size_t *lo, size_t *hi)
+{
+	const size_t per = stream_n/stream_nthreads/STREAM_ALIGN*STREAM_ALIGN;
+	*lo = t*per;
+	*hi = t == stream_nthreads - 1 ? stream_n : *lo + per;
+}
+
+void *stream_thread(void *arg)
+{
+	const cl_uint t = (cl_uint)(size_t)arg;
+	size_t lo, hi;
+
+	stream_range(t, &lo, &hi);
+	for (;;) {
+		pthread_barrier_wait(&stream_barrier);
+		if (stream_cur == ST_QUIT)
+			return NULL;
+		stream_slice(lo, hi);
+		pthread_barrier_wait(&stream_barrier);
+	}
+}
+
+// run op on all threads (the calling one is thread 0), returning the time in ms
+double stream_run(enum stream_op op)
+{
+	size_t lo, hi;
+
+	stream_cur = op;
+	stream_range(0, &lo, &hi);
+	const double start = trace_clock();
+	pthread_barrier_wait(&stream_barrier);
+	stream_slice(lo, hi);
+	pthread_barrier_wait(&stream_barrier);
+	const double elapsed = trace_clock() - start;
+	trace_host(op < NUM_STREAM_OPS ? stream_op_name[op] : "init", start);
+	return elapsed*1.0e3;
+}
+
+// check that the arrays hold the values STREAM_NTIMES rounds should give
+int stream_check(void)
+{
+	float a = 1, b = 2, c = 0;
+	for (int rep = 0; rep < STREAM_NTIMES; ++rep) {
+		c = a;
+		b = STREAM_SCALAR*c;
+		c = a + b;
+		a = b + STREAM_SCALAR*c;
+	}
+	for (size_t i = 0; i < stream_n; ++i)
+		if (stream_a[i] != a || stream_b[i] != b || stream_c[i] != c) {
+			fprintf(stderr, "host stream: mismatch @ %zu\n", i);
+			return 0;
+		}
+	return 1;
+}
+
+int compare_runtime(const void *_a, const void *_b)
+{
+	const double a = *(const double*)_a;
+	const double b = *(const double*)_b;
+	return (a > b) - (a < b);
+}
+
+/* Run the four operations STREAM_NTIMES times over arrays of (at most)
+ * size bytes, with or without non-temporal stores; the array size is
+ * reduced if the three arrays would take too much of the physical memory
+ * or can't be allocated. Returns 0 if the arrays can't be allocated at all
+ * or the results are wrong.
+ */
+int host_stream(size_t size, int nontemporal)
+{
+	const size_t phys = (size_t)sysconf(_SC_PHYS_PAGES)*sysconf(_SC_PAGESIZE);
+	const long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t *thr;
+	int ok = 0;
+
+	stream_nthreads = ncpu > 0 ? ncpu : 1;
+	stream_nontemporal = nontemporal;
+	if (phys && 3*size > phys/STREAM_MAX_MEM_FRACTION)
+		size = phys/STREAM_MAX_MEM_FRACTION/3;
+
+	for (;;) {
+		stream_n = size/sizeof(float)/STREAM_ALIGN*STREAM_ALIGN;
+		stream_size = stream_n*sizeof(float);
+		if (stream_n < STREAM_ALIGN*stream_nthreads)
+			return 0;
+		if (!posix_memalign((void**)&stream_a, STREAM_ALIGN*sizeof(float), stream_size) &&
+			!posix_memalign((void**)&stream_b, STREAM_ALIGN*sizeof(float), stream_size) &&
+			!posix_memalign((void**)&stream_c, STREAM_ALIGN*sizeof(float), stream_size))
+			break;
+		free(stream_a);
+		free(stream_b);
+		stream_a = stream_b = NULL;
+		size /= 2;
+	}
+
+	thr = calloc(stream_nthreads, sizeof(*thr));
+	if (!thr) {
+		fputs("couldn't allocate host stream threads\n", stderr);
+		exit(1);
+	}
+	pthread_barrier_init(&stream_barrier, NULL, stream_nthreads);
+	for (cl_uint t = 1; t < stream_nthreads; ++t)
+		if (pthread_create(thr + t, NULL, stream_thread, (void*)(size_t)t)) {
+			fputs("couldn't start host stream threads\n", stderr);
+			exit(1);
+		}
+
+	stream_run(ST_INIT);
+	for (int rep = 0; rep < STREAM_NTIMES; ++rep)
+		for (enum stream_op op = 0; op < NUM_STREAM_OPS; ++op)
+			stream_runtimes[op][rep] = stream_run(op);
+
+	stream_cur = ST_QUIT;
+	pthread_barrier_wait(&stream_barrier);
+	for (cl_uint t = 1; t < stream_nthreads; ++t)
+		pthread_join(thr[t], NULL);
+	pthread_barrier_destroy(&stream_barrier);
+	free(thr);
+
+	ok = stream_check();
+	for (enum stream_op op = 0; op < NUM_STREAM_OPS; ++op)
+		qsort(stream_runtimes[op], STREAM_NTIMES, sizeof(double), compare_runtime);
+
+	free(stream_a);
+	free(stream_b);
+	free(stream_c);
+	stream_a = stream_b = stream_c = NULL;
+	return ok;
+}
+
+// bandwidth in GB/s of op for a runtime in ms
+double stream_bw(enum stream_op op, double ms)
+{
+	return stream_op_arrays[op]*stream_size/ms*1.0e-6;
+}
+
+// print the results of the last run, in the format of bandwidth
+void stream_report(void)
+{
+	const size_t median = STREAM_NTIMES/2;
+
+	for (enum stream_op op = 0; op < NUM_STREAM_OPS; ++op) {
+		const double *rt = stream_runtimes[op];
+		double avg = 0;
+		for (int rep = 0; rep < STREAM_NTIMES; ++rep)
+			avg += rt[rep];
+		avg /= STREAM_NTIMES;
+
+		printf("%s\ttime (ms): best: %8g, median: %8g, worst: %8g, avg: %8g\n",
+			stream_op_name[op], rt[0], rt[median], rt[STREAM_NTIMES - 1], avg);
+		printf("\tBW (GB/s): best: %8g, median: %8g, worst: %8g, avg: %8g\n",
+			stream_bw(op, rt[0]), stream_bw(op, rt[median]),
+			stream_bw(op, rt[STREAM_NTIMES - 1]), stream_bw(op, avg));
+	}
+}
@@ -0,0 +1,478 @@
+/* Interference between a latency-critical stream of no-op kernels and a
+ * bandwidth-heavy stream of add kernels on separate queues of the same
+ * device: each is measured alone, then together, with default queue
+ * priorities and, where cl_khr_priority_hints or cl_khr_throttle_hints
+ * are supported, with the foreground queue hinted high and the background
+ * one low */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <CL/cl.h>
+
+#include "error.h"
+#include "trace.h"
+#include "phases.h"
+
+// from cl_ext.h, which older headers lack
+#ifndef CL_QUEUE_PRIORITY_KHR
+#define CL_QUEUE_PRIORITY_KHR 0x1096
+#define CL_QUEUE_PRIORITY_HIGH_KHR (1 << 0)
+#define CL_QUEUE_PRIORITY_LOW_KHR (1 << 2)
+#endif
+#ifndef CL_QUEUE_THROTTLE_KHR
+#define CL_QUEUE_THROTTLE_KHR 0x1097
+#define CL_QUEUE_THROTTLE_HIGH_KHR (1 << 0)
+#define CL_QUEUE_THROTTLE_LOW_KHR (1 << 2)
+#endif
+
+cl_uint np; // number of platforms
+cl_platform_id *platform; // list of platforms ids
+cl_platform_id p; // selected platform
+
+cl_uint nd; // number of devices in the selected platform
+cl_device_id *device; // list of device ids
+cl_device_id d; // selected device
+
+// context property: field 1 (the platform) will be set at runtime
+cl_context_properties ctx_prop[] = { CL_CONTEXT_PLATFORM, 0, 0, 0 };
+cl_context ctx; // context
+
+// generic string retrieval buffer. quick'n'dirty, hence fixed-size
+#define BUFSZ 1024
+char strbuf[BUFSZ];
+
+size_t gmem; // device global memory size
+size_t alloc_max; // max single-buffer-size on device
+size_t buf_size; // size of each buffer of the background stream
+cl_uint nels; // number of elements in each buffer
+
+// the add kernel of bandwidth, and the nop of ndrangelatency
+const char *src[] = {
+"kernel void add(global float *dst, global const float *src, uint n) {\n",
+"	uint i = get_global_id(0);\n",
+"	if (i < n) dst[i] += src[i];\n",
+"}\n",
+"kernel void nop() { return; }\n"
+};
+
+cl_program pg; // program
+cl_kernel k_add, k_nop; // actual kernels
+cl_mem buf[2]; // dst, src of the add kernels
+size_t gws; // global work size of the add kernel
+size_t wgm; // preferred workgroup size multiple (will be used as local size too)
+
+// macro to round size to the next multiple of base
+#define ROUND_MUL(size, base) \
+	((size + base - 1)/base)*base
+
+#define MB (1024*1024.0)
+
+// default number of foreground launches; the background runs meanwhile
+#define NLAT 1000
+
+// background kernels run alone, and kept in flight while running
+#define NBG_ALONE 32
+#define BG_DEPTH 4
+
+// at most this fraction of the device memory for the background buffers
+#define BUFS_PER_GMEM 8
+#define MAX_BUF_SIZE (256*1024*1024UL)
+
+// dst is read and written, src is read
+#define ADD_BYTES (3.0*buf_size)
+
+// queue hints to try
+enum hints {
+	HINT_NONE, // default queues
+	HINT_PRIORITY, // cl_khr_priority_hints: foreground high, background low
+	HINT_THROTTLE, // cl_khr_throttle_hints: foreground high, background low
+	NUM_HINTS
+};
+
+const char * const hint_name[] = {
+	"default queues", "priority hints", "throttle hints"
+};
+
+int hint_supported[NUM_HINTS] = { 1 };
+
+// foreground latency statistics, us
+struct fg_stats {
+	double rt[4]; // launch to completion, host side: p50, p90, p99, max
+	double wait[4]; // QUEUED to START on the device: p50, p90, p99, max
+};
+
+// background stream state, shared with its thread
+struct bg_state {
+	cl_command_queue q;
+	cl_uint max_kernels; // stop after this many; 0: run until stopped
+	pthread_mutex_t lock;
+	int stop;
+	// results
+	cl_uint nkernels;
+	cl_ulong first, last; // START of the first, END of the last kernel
+};
+
+// called by both threads, hence the local error
+cl_ulong event_time(cl_event evt, cl_profiling_info what)
+{
+	cl_ulong t;
+	cl_int error = clGetEventProfilingInfo(evt, what, sizeof(t), &t, NULL);
+	CHECK_ERROR("getting event profiling info");
+	return t;
+}
+
+// trace.h is not thread-safe: both streams trace through this
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void trace_locked(cl_event evt, const char *name)
+{
+	pthread_mutex_lock(&trace_lock);
+	trace_event(evt, name);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+int compare_double(const void *_a, const void *_b)
+{
+	const double a = *(const double*)_a;
+	const double b = *(const double*)_b;
+	return (a > b) - (a < b);
+}
+
+// p50, p90, p99 and max of n sorted samples
+void percentiles(const double *sample, cl_uint n, double *pc)
+{
+	pc[0] = sample[n/2];
+	pc[1] = sample[n*90/100];
+	pc[2] = sample[n*99/100];
+	pc[3] = sample[n - 1];
+}
+
+/* create a profiling queue with the given hint level for the foreground
+ * (high) or background (low) stream
+ */
+cl_command_queue create_queue(enum hints hint, int fg)
+{
+	cl_command_queue hq;
+#ifdef CL_VERSION_2_0
+	if (hint != HINT_NONE) {
+		const cl_queue_properties props[] = {
+			CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE,
+			hint == HINT_PRIORITY ? CL_QUEUE_PRIORITY_KHR : CL_QUEUE_THROTTLE_KHR,
+			hint == HINT_PRIORITY ?
+				(fg ? CL_QUEUE_PRIORITY_HIGH_KHR : CL_QUEUE_PRIORITY_LOW_KHR) :
+				(fg ? CL_QUEUE_THROTTLE_HIGH_KHR : CL_QUEUE_THROTTLE_LOW_KHR),
+			0
+		};
+		hq = clCreateCommandQueueWithProperties(ctx, d, props, &error);
+		CHECK_ERROR("creating hinted queue");
+		trace_name_queue(hq, fg ? "foreground" : "background");
+		return hq;
+	}
+#endif
+	hq = clCreateCommandQueue(ctx, d, CL_QUEUE_PROFILING_ENABLE, &error);
+	CHECK_ERROR("creating queue");
+	trace_name_queue(hq, fg ? "foreground" : "background");
+	return hq;
+}
+
+int bg_stopped(struct bg_state *bg)
+{
+	pthread_mutex_lock(&bg->lock);
+	const int stop = bg->stop;
+	pthread_mutex_unlock(&bg->lock);
+	return stop;
+}
+
+// background stream: add kernels, BG_DEPTH in flight, until stopped
+void *bg_thread(void *_bg)
+{
+	struct bg_state *bg = _bg;
+	cl_event evt[BG_DEPTH];
+	cl_uint issued = 0;
+	cl_int error; // the global one belongs to the foreground
+
+	bg->nkernels = 0;
+	for (;;) {
+		const int done = bg_stopped(bg) || (bg->max_kernels && issued == bg->max_kernels);
+		// keep the window full, then retire the oldest kernel
+		if (!done && issued - bg->nkernels < BG_DEPTH) {
+			error = clEnqueueNDRangeKernel(bg->q, k_add, 1, NULL, &gws, &wgm,
+				0, NULL, evt + issued % BG_DEPTH);
+			CHECK_ERROR("enqueueing add");
+			clFlush(bg->q);
+			++issued;
+			continue;
+		}
+		if (bg->nkernels == issued)
+			break;
+		cl_event *old = evt + bg->nkernels % BG_DEPTH;
+		error = clWaitForEvents(1, old);
+		CHECK_ERROR("waiting for add");
+		if (!bg->nkernels)
+			bg->first = event_time(*old, CL_PROFILING_COMMAND_START);
+		bg->last = event_time(*old, CL_PROFILING_COMMAND_END);
+		trace_locked(*old, "add");
+		clReleaseEvent(*old);
+		++bg->nkernels;
+	}
+	return NULL;
+}
+
+// background bandwidth of the last run, GB/s
+double bg_bandwidth(const struct bg_state *bg)
+{
+	return bg->nkernels ? bg->nkernels*ADD_BYTES/(bg->last - bg->first) : 0;
+}
+
+// nlat no-op launches on q, one at a time
+void fg_stream(cl_command_queue fq, cl_uint nlat, struct fg_stats *st)
+{
+	double *rt = calloc(nlat, sizeof(*rt));
+	double *wait = calloc(nlat, sizeof(*wait));
+	const size_t one = 1;
+
+	if (!rt || !wait) {
+		fputs("couldn't allocate timing arrays\n", stderr);
+		exit(1);
+	}
+	for (cl_uint i = 0; i < nlat; ++i) {
+		cl_event evt;
+		const double start = now();
+		error = clEnqueueNDRangeKernel(fq, k_nop, 1, NULL, &one, NULL, 0, NULL, &evt);
+		CHECK_ERROR("enqueueing nop");
+		error = clWaitForEvents(1, &evt);
+		CHECK_ERROR("waiting for nop");
+		rt[i] = (now() - start)*1.0e6;
+		wait[i] = (event_time(evt, CL_PROFILING_COMMAND_START) -
+			event_time(evt, CL_PROFILING_COMMAND_QUEUED))*1.0e-3;
+		trace_locked(evt, "nop");
+		clReleaseEvent(evt);
+	}
+	qsort(rt, nlat, sizeof(*rt), compare_double);
+	qsort(wait, nlat, sizeof(*wait), compare_double);
+	percentiles(rt, nlat, st->rt);
+	percentiles(wait, nlat, st->wait);
+	free(rt);
+	free(wait);
+}
+
+void print_fg(const char *what, const struct fg_stats *st, const struct fg_stats *alone)
+{
+	printf("%s: nop latency (us): p50 %g, p90 %g, p99 %g, max %g\n",
+		what, st->rt[0], st->rt[1], st->rt[2], st->rt[3]);
+	printf("\tqueued to start (us): p50 %g, p90 %g, p99 %g, max %g\n",
+		st->wait[0], st->wait[1], st->wait[2], st->wait[3]);
+	if (alone)
+		printf("\tvs alone: p50 %.3gx, p99 %.3gx\n",
+			st->rt[0]/alone->rt[0], st->rt[2]/alone->rt[2]);
+}
+
+int main(int argc, char *argv[])
+{
+	// selected platform and device number
+	cl_uint pn = 0, dn = 0;
+	cl_uint nlat = NLAT;
+	cl_uint dev_major = 1;
+
+	// set platform/device num and number of foreground launches from command line
+	if (argc > 1)
+		pn = atoi(argv[1]);
+	if (argc > 2)
+		dn = atoi(argv[2]);
+	if (argc > 3)
+		nlat = atoi(argv[3]);
+	if (nlat < 1)
+		nlat = 1;
+
+	error = clGetPlatformIDs(0, NULL, &np);
+	CHECK_ERROR("getting amount of platform IDs");
+	printf("%u platforms found\n", np);
+	if (pn >= np) {
+		fprintf(stderr, "there is no platform #%u\n" , pn);
+		exit(1);
+	}
+	// only allocate for IDs up to the intended one
+	platform = calloc(pn+1,sizeof(*platform));
+	// if allocation failed, next call will bomb. rely on this
+	error = clGetPlatformIDs(pn+1, platform, NULL);
+	CHECK_ERROR("getting platform IDs");
+
+	// choose platform
+	p = platform[pn];
+
+	error = clGetPlatformInfo(p, CL_PLATFORM_NAME, BUFSZ, strbuf, NULL);
+	CHECK_ERROR("getting platform name");
+	printf("using platform %u: %s\n", pn, strbuf);
+
+	error = clGetDeviceIDs(p, CL_DEVICE_TYPE_ALL, 0, NULL, &nd);
+	CHECK_ERROR("getting amount of device IDs");
+	printf("%u devices found\n", nd);
+	if (dn >= nd) {
+		fprintf(stderr, "there is no device #%u\n", dn);
+		exit(1);
+	}
+	// only allocate for IDs up to the intended one
+	device = calloc(dn+1,sizeof(*device));
+	// if allocation failed, next call will bomb. rely on this
+	error = clGetDeviceIDs(p, CL_DEVICE_TYPE_ALL, dn+1, device, NULL);
+	CHECK_ERROR("getting device IDs");
+
+	// choose device
+	d = device[dn];
+	error = clGetDeviceInfo(d, CL_DEVICE_NAME, BUFSZ, strbuf, NULL);
+	CHECK_ERROR("getting device name");
+	printf("using device %u: %s\n", dn, strbuf);
+
+	error = clGetDeviceInfo(d, CL_DEVICE_GLOBAL_MEM_SIZE,
+			sizeof(gmem), &gmem, NULL);
+	CHECK_ERROR("getting device global memory size");
+	error = clGetDeviceInfo(d, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+			sizeof(alloc_max), &alloc_max, NULL);
+	CHECK_ERROR("getting device max memory allocation size");
+
+	// the hints need clCreateCommandQueueWithProperties, from OpenCL 2.0
+	error = clGetDeviceInfo(d, CL_DEVICE_VERSION, BUFSZ, strbuf, NULL);
+	CHECK_ERROR("getting device version");
+	sscanf(strbuf, "OpenCL %u", &dev_major);
+	// the extension list can be much longer than strbuf
+	size_t ext_size;
+	error = clGetDeviceInfo(d, CL_DEVICE_EXTENSIONS, 0, NULL, &ext_size);
+	CHECK_ERROR("getting device extensions size");
+	char *ext = malloc(ext_size);
+	if (!ext) {
+		fputs("couldn't allocate extension list\n", stderr);
+		exit(1);
+	}
+	error = clGetDeviceInfo(d, CL_DEVICE_EXTENSIONS, ext_size, ext, NULL);
+	CHECK_ERROR("getting device extensions");
+#ifdef CL_VERSION_2_0
+	hint_supported[HINT_PRIORITY] = dev_major >= 2 && !!strstr(ext, "cl_khr_priority_hints");
+	hint_supported[HINT_THROTTLE] = dev_major >= 2 && !!strstr(ext, "cl_khr_throttle_hints");
+#endif
+	free(ext);
+	for (enum hints h = HINT_PRIORITY; h < NUM_HINTS; ++h)
+		if (!hint_supported[h])
+			printf("%s not supported\n", hint_name[h]);
+
+	// create context
+	ctx_prop[1] = (cl_context_properties)p;
+	ctx = clCreateContext(ctx_prop, 1, &d, NULL, NULL, &error);
+	CHECK_ERROR("creating context");
+
+	// create program
+	pg = clCreateProgramWithSource(ctx, sizeof(src)/sizeof(*src), src, NULL, &error);
+	CHECK_ERROR("creating program");
+
+	// build program
+	error = clBuildProgram(pg, 1, &d, NULL, NULL, NULL);
+	if (error == CL_BUILD_PROGRAM_FAILURE) {
+		error = clGetProgramBuildInfo(pg, d, CL_PROGRAM_BUILD_LOG,
+			BUFSZ, strbuf, NULL);
+		CHECK_ERROR("get program build info");
+		printf("=== BUILD LOG ===\n%s\n=========\n", strbuf);
+		error = CL_BUILD_PROGRAM_FAILURE;
+	}
+	CHECK_ERROR("building program");
+
+	// get kernels
+	k_add = clCreateKernel(pg, "add", &error);
+	CHECK_ERROR("creating kernel add");
+	k_nop = clCreateKernel(pg, "nop", &error);
+	CHECK_ERROR("creating kernel nop");
+
+	error = clGetKernelWorkGroupInfo(k_add, d, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+			sizeof(wgm), &wgm, NULL);
+	CHECK_ERROR("getting preferred workgroup size multiple");
+
+	size_t size = gmem/BUFS_PER_GMEM;
+	if (size > alloc_max)
+		size = alloc_max;
+	if (size > MAX_BUF_SIZE)
+		size = MAX_BUF_SIZE;
+	nels = size/sizeof(cl_float);
+	buf_size = nels*sizeof(cl_float);
+	gws = ROUND_MUL(nels, wgm);
+
+	const float patt = 1;
+	cl_command_queue fq = create_queue(HINT_NONE, 1);
+	for (int i = 0; i < 2; ++i) {
+		buf[i] = clCreateBuffer(ctx, CL_MEM_READ_WRITE, buf_size, NULL, &error);
+		CHECK_ERROR("allocating buffer");
+		error = clEnqueueFillBuffer(fq, buf[i], &patt, sizeof(patt), 0, buf_size,
+			0, NULL, NULL);
+		CHECK_ERROR("filling buffer");
+	}
+	clSetKernelArg(k_add, 0, sizeof(buf[0]), buf);
+	clSetKernelArg(k_add, 1, sizeof(buf[1]), buf + 1);
+	clSetKernelArg(k_add, 2, sizeof(nels), &nels);
+	error = clFinish(fq);
+	CHECK_ERROR("finishing fill");
+
+	printf("foreground: %u no-op launches; background: add kernel on %gMB buffers, %u in flight\n",
+		nlat, buf_size/MB, BG_DEPTH);
+
+	struct bg_state bg;
+	struct fg_stats fg_alone, fg;
+	pthread_t thr;
+
+	memset(&bg, 0, sizeof(bg));
+	pthread_mutex_init(&bg.lock, NULL);
+
+	// each stream alone, on default queues; a first foreground run is a warm-up
+	fg_stream(fq, nlat < 10 ? nlat : 10, &fg_alone);
+	fg_stream(fq, nlat, &fg_alone);
+	print_fg("foreground alone", &fg_alone, NULL);
+
+	bg.q = create_queue(HINT_NONE, 0);
+	bg.max_kernels = NBG_ALONE;
+	bg_thread(&bg);
+	const double bg_alone = bg_bandwidth(&bg);
+	printf("background alone: add kernel %gGB/s over %u kernels\n", bg_alone, bg.nkernels);
+	clReleaseCommandQueue(bg.q);
+	clReleaseCommandQueue(fq);
+
+	// both at once, with each kind of hint
+	for (enum hints h = 0; h < NUM_HINTS; ++h) {
+		if (!hint_supported[h])
+			continue;
+		fq = create_queue(h, 1);
+		bg.q = create_queue(h, 0);
+		bg.max_kernels = 0;
+		bg.stop = 0;
+
+		printf("== together, %s ==\n", hint_name[h]);
+		if (pthread_create(&thr, NULL, bg_thread, &bg)) {
+			fputs("couldn't start background thread\n", stderr);
+			exit(1);
+		}
+		fg_stream(fq, nlat, &fg);
+		pthread_mutex_lock(&bg.lock);
+		bg.stop = 1;
+		pthread_mutex_unlock(&bg.lock);
+		pthread_join(thr, NULL);
+
+		print_fg("foreground", &fg, &fg_alone);
+		const double bg_bw = bg_bandwidth(&bg);
+		printf("background: add kernel %gGB/s over %u kernels (%.3g%% of alone)\n",
+			bg_bw, bg.nkernels, bg_bw*100/bg_alone);
+
+		clReleaseCommandQueue(bg.q);
+		clReleaseCommandQueue(fq);
+	}
+
+	pthread_mutex_destroy(&bg.lock);
+	for (int i = 0; i < 2; ++i)
+		clReleaseMemObject(buf[i]);
+	clReleaseKernel(k_nop);
+	clReleaseKernel(k_add);
+	clReleaseProgram(pg);
+	clReleaseContext(ctx);
+	free(device);
+	free(platform);
+
+	return 0;
+}
@@ -0,0 +1,230 @@
+/* Probe how much device memory can actually be used: allocate and touch
+ * an increasing total, and find where allocations fail or performance
+ * degrades */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <CL/cl.h>
+
+#include "error.h"
+#include "verify.h"
+#include "trace.h"
+#include "phases.h"
+#include "overalloc.h"
+
+// allocations are made in chunks of this fraction of the device memory
+#define CHUNKS_PER_GMEM 64
+
+// the ramp grows the total by this fraction of the device memory per step,
+// up to MAX_RATIO times the device memory
+#define RAMP_STEPS 16
+#define MAX_RATIO 2
+
+// performance is considered degraded when the bandwidth of a pass over all
+// the chunks drops below this fraction of that of the first ramp step
+#define DEGRADE 0.5
+
+size_t chunk_size; // size of each chunk
+cl_uint chunk_els; // number of floats in each chunk
+
+cl_ulong event_time(cl_event evt, cl_profiling_info what)
+{
+	cl_ulong t;
+	error = clGetEventProfilingInfo(evt, what, sizeof(t), &t, NULL);
+	CHECK_ERROR("getting event profiling info");
+	return t;
+}
+
+/* allocate n chunks, touch each of them with a kernel, then time a second
+ * pass over all of them and check the result. Sets *bw to the bandwidth
+ * of the timed pass in GB/s. Errors are returned, not fatal.
+ */
+cl_int probe(cl_uint n, double *bw)
+{
+	cl_mem *chunk = calloc(n, sizeof(*chunk));
+	cl_event *evt = calloc(n, sizeof(*evt));
+	cl_int err = CL_SUCCESS;
+	cl_uint i;
+
+	*bw = 0;
+	if (!chunk || !evt) {
+		err = CL_OUT_OF_HOST_MEMORY;
+		goto out;
+	}
+
+	// allocation alone proves nothing: touch each chunk as it's allocated
+	for (i = 0; i < n; ++i) {
+		chunk[i] = clCreateBuffer(ctx, CL_MEM_READ_WRITE, chunk_size, NULL, &err);
+		if (err != CL_SUCCESS)
+			goto out;
+		cl_event touch;
+		err = fill_device(q, FILL_KERNEL, chunk[i], chunk_els, 0, 0, NULL, &touch);
+		if (err != CL_SUCCESS)
+			goto out;
+		trace_defer(touch, "touch");
+		clReleaseEvent(touch);
+		clFlush(q);
+	}
+	err = clFinish(q);
+	if (err != CL_SUCCESS)
+		goto out;
+	trace_flush();
+
+	// all chunks should now be resident: a second pass shows if they are
+	for (i = 0; i < n; ++i) {
+		err = fill_device(q, FILL_KERNEL, chunk[i], chunk_els, 1, 0, NULL, evt + i);
+		if (err != CL_SUCCESS)
+			goto out;
+	}
+	err = clFinish(q);
+	if (err != CL_SUCCESS)
+		goto out;
+	for (i = 0; i < n; ++i)
+		trace_event(evt[i], "pass");
+	*bw = (double)n*chunk_size/(event_time(evt[n - 1], CL_PROFILING_COMMAND_END) -
+		event_time(evt[0], CL_PROFILING_COMMAND_START));
+
+	// some platforms fail silently, so check what was written
+	for (i = 0; i < n; ++i) {
+		cl_uint nbad, first_bad;
+		cl_event vevt = NULL;
+		err = check_device(q, chunk[i], chunk_els, 1, 0, NULL, &nbad, &first_bad, &vevt);
+		if (vevt) {
+			trace_event(vevt, "verify");
+			clReleaseEvent(vevt);
+		}
+		if (err != CL_SUCCESS)
+			goto out;
+		if (nbad) {
+			fprintf(stderr, "chunk %u: %u mismatches, first @ %u\n", i, nbad, first_bad);
+			err = JUGGLE_MISMATCH;
+			goto out;
+		}
+	}
+
+out:
+	clFinish(q);
+	if (evt)
+		for (i = 0; i < n; ++i)
+			if (evt[i])
+				clReleaseEvent(evt[i]);
+	if (chunk)
+		for (i = 0; i < n; ++i)
+			if (chunk[i])
+				clReleaseMemObject(chunk[i]);
+	free(evt);
+	free(chunk);
+	return err;
+}
+
+// probe n chunks and print a table row; returns the bandwidth in GB/s,
+// or 0 if the probe failed
+double probe_row(cl_uint n, double base_bw)
+{
+	double bw;
+	const double start = now();
+	cl_int err = probe(n, &bw);
+	snprintf(strbuf, BUFSZ, "%u chunks", n);
+	trace_host(strbuf, start);
+
+	printf("%10.6g\t%6u\t%6.3g", n*(chunk_size/MB), n, (double)n*chunk_size/gmem);
+	if (err != CL_SUCCESS) {
+		printf("\tFAILED (%d)\n", err);
+		return 0;
+	}
+	printf("\t%10.4g\t%5.0f%%\n", bw, base_bw ? 100*bw/base_bw : 100);
+	return bw;
+}
+
+int main(int argc, char *argv[])
+{
+	// selected platform and device number
+	cl_uint pn = 0, dn = 0;
+
+	// set platform/device num from command line
+	if (argc > 1)
+		pn = atoi(argv[1]);
+	if (argc > 2)
+		dn = atoi(argv[2]);
+
+	setup(pn, dn);
+	verify_setup(ctx, d);
+
+	chunk_size = gmem/CHUNKS_PER_GMEM;
+	if (chunk_size > alloc_max)
+		chunk_size = alloc_max;
+	chunk_els = chunk_size/sizeof(cl_float);
+	chunk_size = chunk_els*sizeof(cl_float);
+
+	const cl_uint step = CHUNKS_PER_GMEM/RAMP_STEPS;
+	const cl_uint max_chunks = MAX_RATIO*gmem/chunk_size;
+
+	printf("CL_DEVICE_GLOBAL_MEM_SIZE: %gMB, CL_DEVICE_MAX_MEM_ALLOC_SIZE: %gMB\n",
+			gmem/MB, alloc_max/MB);
+	printf("probing with chunks of %gMB, up to %gMB\n", chunk_size/MB, max_chunks*(chunk_size/MB));
+
+	puts("total (MB)\tchunks\tratio\tGB/s\t% of first");
+
+	// ramp up the total, to see how performance evolves and to bracket the
+	// usable capacity: good is the last size with undegraded performance,
+	// bad the first one that failed or was degraded
+	double base_bw = 0;
+	cl_uint good = 0, bad = max_chunks + 1, fail = 0;
+	for (cl_uint n = step; n <= max_chunks; n += step) {
+		const double bw = probe_row(n, base_bw);
+		if (!bw) {
+			fail = n;
+			if (bad > n)
+				bad = n;
+			break;
+		}
+		if (!base_bw)
+			base_bw = bw;
+		if (bw >= DEGRADE*base_bw) {
+			if (bad > max_chunks)
+				good = n;
+		} else if (bad > n) {
+			bad = n;
+		}
+	}
+	const cl_uint degrade = bad <= max_chunks && bad != fail ? bad : 0;
+
+	if (!base_bw) {
+		fputs("could not use even the first step\n", stderr);
+		exit(1);
+	}
+
+	// binary search between the bracketing sizes, one chunk at a time
+	puts("refining:");
+	cl_uint lo = good, hi = bad;
+	while (hi - lo > 1) {
+		const cl_uint mid = lo + (hi - lo)/2;
+		if (probe_row(mid, base_bw) >= DEGRADE*base_bw)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	printf("usable capacity: %gMB (%.3g of CL_DEVICE_GLOBAL_MEM_SIZE)\n",
+		lo*(chunk_size/MB), (double)lo*chunk_size/gmem);
+	if (degrade)
+		printf("performance below %g%% from %gMB\n", DEGRADE*100, degrade*(chunk_size/MB));
+	else
+		printf("no performance degradation before %s\n",
+			fail ? "allocation failure" : "the end of the ramp");
+	if (fail)
+		printf("allocation or use failed at %gMB\n", fail*(chunk_size/MB));
+	else
+		printf("no failure up to %gMB\n", max_chunks*(chunk_size/MB));
+
+	verify_teardown();
+	release_kernels();
+	clReleaseProgram(pg);
+	clReleaseCommandQueue(q);
+	clReleaseContext(ctx);
+
+	return 0;
+}
@@ -0,0 +1,350 @@
+/* Kernel launch latency test, run by ndrangelatency and clbench.
+ *
+ * Requires error.h, trace.h and testenv.h.
+ */
+
+const char *latency_src[] = {
+	"kernel void nop() { return; }\n"
+};
+
+#ifdef CL_VERSION_2_0
+// parent kernel for the device-side enqueue test: it launches n no-op
+// children on the default device queue, each waiting for the previous one,
+// so that they are serialized like the host launches on an in-order queue
+const char *latency_dev_src[] = {
+	"kernel void parent(uint n, uint gws, global int *fail) {\n",
+	"	queue_t q = get_default_queue();\n",
+	"	ndrange_t ndr = ndrange_1D(gws);\n",
+	"	clk_event_t prev, next;\n",
+	"	int err = enqueue_kernel(q, CLK_ENQUEUE_FLAGS_NO_WAIT, ndr,\n",
+	"		0, NULL, &prev, ^{ return; });\n",
+	"	if (err) { *fail = err; return; }\n",
+	"	for (uint c = 1; c < n; ++c) {\n",
+	"		err = enqueue_kernel(q, CLK_ENQUEUE_FLAGS_NO_WAIT, ndr,\n",
+	"			1, &prev, &next, ^{ return; });\n",
+	"		release_event(prev);\n",
+	"		if (err) { *fail = err; return; }\n",
+	"		prev = next;\n",
+	"	}\n",
+	"	release_event(prev);\n",
+	"}\n"
+};
+#endif
+
+// collect statistics over LOOPS runs
+#define LOOPS 5
+#define MAXWG (1<<20) /* 2^20 max */
+
+// number of child launches compared in the device-side enqueue test
+#define CHILDREN 256
+
+int compare_ulong(const void * restrict _a, const void * restrict _b)
+{
+	const cl_ulong *a = (const cl_ulong *)_a;
+	const cl_ulong *b = (const cl_ulong *)_b;
+	if (*a > *b)
+		return 1;
+	if (*a < *b)
+		return -1;
+	return 0;
+}
+
+#ifdef CL_VERSION_2_0
+/* Compare CHILDREN launches of a no-op kernel done by a parent kernel
+ * through a device queue with CHILDREN launches done by the host on q.
+ * Only devices that report CL_DEVICE_QUEUE_ON_DEVICE_PROPERTIES are tested.
+ */
+cl_int test_device_enqueue(const struct test_env *env, cl_kernel nop)
+{
+	const cl_device_id d = env->dev->d;
+	const cl_command_queue q = env->q;
+	cl_command_queue dq = NULL;
+	cl_program pg = NULL;
+	cl_kernel parent = NULL;
+	cl_mem fail_buf = NULL;
+
+	cl_command_queue_properties dq_props = 0;
+	cl_uint dq_size = 0;
+
+	// per-child-launch times in ns, + 1: avg
+	cl_ulong host_span[LOOPS + 1] = {0};   // END(last) - START(first)
+	cl_ulong host_total[LOOPS + 1] = {0};  // END(last) - QUEUED(first)
+	cl_ulong dev_span[LOOPS + 1] = {0};    // END - START of parent
+	cl_ulong dev_total[LOOPS + 1] = {0};   // END - QUEUED of parent
+
+	cl_event evt[CHILDREN];
+
+	cl_int error = clGetDeviceInfo(d, CL_DEVICE_QUEUE_ON_DEVICE_PROPERTIES,
+		sizeof(dq_props), &dq_props, NULL);
+	if (error != CL_SUCCESS || !dq_props) {
+		puts("device does not support device-side enqueue, skipping");
+		return CL_SUCCESS;
+	}
+
+	error = clGetDeviceInfo(d, CL_DEVICE_QUEUE_ON_DEVICE_MAX_SIZE,
+		sizeof(dq_size), &dq_size, NULL);
+	CHECK_ERROR_OUT("getting device queue max size");
+
+	const cl_queue_properties dq_prop[] = {
+		CL_QUEUE_PROPERTIES, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE |
+			CL_QUEUE_ON_DEVICE | CL_QUEUE_ON_DEVICE_DEFAULT,
+		CL_QUEUE_SIZE, dq_size,
+		0
+	};
+	dq = clCreateCommandQueueWithProperties(env->ctx, d, dq_prop, &error);
+	CHECK_ERROR_OUT("creating device queue");
+
+	pg = clCreateProgramWithSource(env->ctx, sizeof(latency_dev_src)/sizeof(*latency_dev_src),
+		latency_dev_src, NULL, &error);
+	CHECK_ERROR_OUT("creating device-enqueue program");
+
+	error = clBuildProgram(pg, 1, &d, "-cl-std=CL2.0", NULL, NULL);
+	if (error == CL_BUILD_PROGRAM_FAILURE) {
+		error = clGetProgramBuildInfo(pg, d, CL_PROGRAM_BUILD_LOG,
+			BUFSZ, strbuf, NULL);
+		CHECK_ERROR_OUT("get program build info");
+		printf("=== BUILD LOG ===\n%s\n=========\n", strbuf);
+		error = CL_BUILD_PROGRAM_FAILURE;
+	}
+	CHECK_ERROR_OUT("building device-enqueue program");
+
+	parent = clCreateKernel(pg, "parent", &error);
+	CHECK_ERROR_OUT("creating kernel parent");
+
+	fail_buf = clCreateBuffer(env->ctx, CL_MEM_READ_WRITE, sizeof(cl_int), NULL, &error);
+	CHECK_ERROR_OUT("creating failure flag buffer");
+
+	const cl_uint nchildren = CHILDREN;
+	const size_t one = 1;
+
+	int gwshift = 10;
+	for (size_t gws = 1; gws <= MAXWG ; gws *= (1<<gwshift), gwshift = (gwshift+1)/2) {
+		const cl_uint child_gws = gws;
+		memset(host_span, 0, sizeof(host_span));
+		memset(host_total, 0, sizeof(host_total));
+		memset(dev_span, 0, sizeof(dev_span));
+		memset(dev_total, 0, sizeof(dev_total));
+
+		for (int loop = 0; loop < LOOPS; ++loop) {
+			cl_ulong queued, start, end;
+			cl_int fail = 0;
+
+			// host: CHILDREN launches on the in-order queue
+			for (cl_uint c = 0; c < CHILDREN; ++c) {
+				error = clEnqueueNDRangeKernel(q, nop, 1, NULL, &gws, NULL,
+					0, NULL, evt + c);
+				CHECK_ERROR_OUT("enqueue host child");
+			}
+			error = clFinish(q);
+			CHECK_ERROR_OUT("finish host children");
+
+			error = clGetEventProfilingInfo(evt[0], CL_PROFILING_COMMAND_QUEUED,
+				sizeof(cl_ulong), &queued, NULL);
+			CHECK_ERROR_OUT("QUEUED");
+			error = clGetEventProfilingInfo(evt[0], CL_PROFILING_COMMAND_START,
+				sizeof(cl_ulong), &start, NULL);
+			CHECK_ERROR_OUT("START");
+			error = clGetEventProfilingInfo(evt[CHILDREN-1], CL_PROFILING_COMMAND_END,
+				sizeof(cl_ulong), &end, NULL);
+			CHECK_ERROR_OUT("END");
+			for (cl_uint c = 0; c < CHILDREN; ++c)
+				clReleaseEvent(evt[c]);
+
+			host_span[loop] = (end - start)/CHILDREN;
+			host_total[loop] = (end - queued)/CHILDREN;
+
+			// device: one parent launching CHILDREN children
+			error = clEnqueueWriteBuffer(q, fail_buf, CL_TRUE, 0, sizeof(fail),
+				&fail, 0, NULL, NULL);
+			CHECK_ERROR_OUT("clearing failure flag");
+
+			clSetKernelArg(parent, 0, sizeof(nchildren), &nchildren);
+			clSetKernelArg(parent, 1, sizeof(child_gws), &child_gws);
+			clSetKernelArg(parent, 2, sizeof(fail_buf), &fail_buf);
+			error = clEnqueueNDRangeKernel(q, parent, 1, NULL, &one, NULL,
+				0, NULL, evt);
+			CHECK_ERROR_OUT("enqueue parent");
+			error = clFinish(q);
+			CHECK_ERROR_OUT("finish parent");
+
+			error = clEnqueueReadBuffer(q, fail_buf, CL_TRUE, 0, sizeof(fail),
+				&fail, 0, NULL, NULL);
+			CHECK_ERROR_OUT("reading failure flag");
+			if (fail) {
+				error = fail;
+				clReleaseEvent(evt[0]);
+				CHECK_ERROR_OUT("device-side enqueue_kernel");
+			}
+
+			// END of the parent excludes its children: COMPLETE is when
+			// the parent and all of its children are done
+			error = clGetEventProfilingInfo(evt[0], CL_PROFILING_COMMAND_QUEUED,
+				sizeof(cl_ulong), &queued, NULL);
+			CHECK_ERROR_OUT("QUEUED");
+			error = clGetEventProfilingInfo(evt[0], CL_PROFILING_COMMAND_START,
+				sizeof(cl_ulong), &start, NULL);
+			CHECK_ERROR_OUT("START");
+			error = clGetEventProfilingInfo(evt[0], CL_PROFILING_COMMAND_COMPLETE,
+				sizeof(cl_ulong), &end, NULL);
+			CHECK_ERROR_OUT("COMPLETE");
+			clReleaseEvent(evt[0]);
+
+			dev_span[loop] = (end - start)/CHILDREN;
+			dev_total[loop] = (end - queued)/CHILDREN;
+
+			host_span[LOOPS] += host_span[loop];
+			host_total[LOOPS] += host_total[loop];
+			dev_span[LOOPS] += dev_span[loop];
+			dev_total[LOOPS] += dev_total[loop];
+		}
+		host_span[LOOPS] /= LOOPS;
+		host_total[LOOPS] /= LOOPS;
+		dev_span[LOOPS] /= LOOPS;
+		dev_total[LOOPS] /= LOOPS;
+
+		qsort(host_span, LOOPS, sizeof(cl_ulong), compare_ulong);
+		qsort(host_total, LOOPS, sizeof(cl_ulong), compare_ulong);
+		qsort(dev_span, LOOPS, sizeof(cl_ulong), compare_ulong);
+		qsort(dev_total, LOOPS, sizeof(cl_ulong), compare_ulong);
+
+		printf("== %u child launches of %zu work-items ==\n", CHILDREN, gws);
+		puts("ns per launch\t:\tmin\tmed\tavg\tmax");
+		printf("host span\t:\t%lu\t%lu\t%lu\t%lu\n",
+			host_span[0], host_span[LOOPS/2],
+			host_span[LOOPS], host_span[LOOPS-1]);
+		printf("device span\t:\t%lu\t%lu\t%lu\t%lu\n",
+			dev_span[0], dev_span[LOOPS/2],
+			dev_span[LOOPS], dev_span[LOOPS-1]);
+		printf("host total\t:\t%lu\t%lu\t%lu\t%lu\n",
+			host_total[0], host_total[LOOPS/2],
+			host_total[LOOPS], host_total[LOOPS-1]);
+		printf("device total\t:\t%lu\t%lu\t%lu\t%lu\n",
+			dev_total[0], dev_total[LOOPS/2],
+			dev_total[LOOPS], dev_total[LOOPS-1]);
+	}
+
+out:
+	if (fail_buf)
+		clReleaseMemObject(fail_buf);
+	if (parent)
+		clReleaseKernel(parent);
+	if (pg)
+		clReleaseProgram(pg);
+	if (dq)
+		clReleaseCommandQueue(dq);
+
+	return error;
+}
+#endif
+
+/* launch latency of an empty kernel over a range of global work sizes,
+ * and of device-side launches where supported
+ */
+cl_int latency_test(const struct test_env *env)
+{
+	const cl_device_id d = env->dev->d;
+	const cl_command_queue q = env->q;
+	cl_program pg = NULL;
+	cl_kernel nop = NULL;
+
+	// + 1: avg
+	cl_ulong submit_time[LOOPS + 1] = {0}; // SUBMIT - QUEUE
+	cl_ulong launch_time[LOOPS + 1] = {0}; // START - SUBMIT
+	cl_ulong end_time[LOOPS + 1] = {0};    // END - START
+
+	cl_int error;
+
+	// create program
+	pg = clCreateProgramWithSource(env->ctx, sizeof(latency_src)/sizeof(*latency_src),
+		latency_src, NULL, &error);
+	CHECK_ERROR_OUT("creating program");
+
+	// build program
+	error = clBuildProgram(pg, 1, &d, NULL, NULL, NULL);
+#if 1
+	if (error == CL_BUILD_PROGRAM_FAILURE) {
+		error = clGetProgramBuildInfo(pg, d, CL_PROGRAM_BUILD_LOG,
+			BUFSZ, strbuf, NULL);
+		CHECK_ERROR_OUT("get program build info");
+		printf("=== BUILD LOG ===\n%s\n=========\n", strbuf);
+	}
+#endif
+	CHECK_ERROR_OUT("building program");
+
+	// get kernels
+	nop = clCreateKernel(pg, "nop", &error);
+	CHECK_ERROR_OUT("creating kernel nop");
+
+	int gwshift = 10; /* 10 + 5 + 3 + 2 = 20 */
+	for (size_t gws = 1; gws <= MAXWG ; gws *= (1<<gwshift), gwshift = (gwshift+1)/2) {
+		memset(submit_time, 0, sizeof(submit_time));
+		memset(launch_time, 0, sizeof(launch_time));
+		memset(end_time, 0, sizeof(end_time));
+
+		for (int loop = 0; loop < LOOPS; ++loop) {
+			cl_event evt;
+			cl_ulong queued;
+			error = clEnqueueNDRangeKernel(q, nop, 1, NULL, &gws, NULL,
+				0, NULL, &evt);
+			CHECK_ERROR_OUT("enqueue");
+			error = clFinish(q);
+			CHECK_ERROR_OUT("finish");
+
+			error = clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_QUEUED,
+				sizeof(cl_ulong), &queued, NULL);
+			CHECK_ERROR_OUT("QUEUED");
+			error = clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_SUBMIT,
+				sizeof(cl_ulong), submit_time + loop, NULL);
+			CHECK_ERROR_OUT("SUBMIT");
+			error = clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_START,
+				sizeof(cl_ulong), launch_time + loop, NULL);
+			CHECK_ERROR_OUT("START");
+			error = clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_END,
+				sizeof(cl_ulong), end_time + loop, NULL);
+			CHECK_ERROR_OUT("END");
+			trace_event(evt, "nop");
+			clReleaseEvent(evt);
+
+			end_time[loop] -= launch_time[loop];
+			launch_time[loop] -= submit_time[loop];
+			submit_time[loop] -= queued;
+
+			submit_time[LOOPS] += submit_time[loop];
+			launch_time[LOOPS] += launch_time[loop];
+			end_time[LOOPS] += end_time[loop];
+		}
+		submit_time[LOOPS] /= LOOPS;
+		launch_time[LOOPS] /= LOOPS;
+		end_time[LOOPS] /= LOOPS;
+
+		qsort(submit_time, LOOPS, sizeof(cl_ulong), compare_ulong);
+		qsort(launch_time, LOOPS, sizeof(cl_ulong), compare_ulong);
+		qsort(end_time, LOOPS, sizeof(cl_ulong), compare_ulong);
+
+		printf("== %zu work-items ==\n", gws);
+		puts("latency in ns\t:\tmin\tmed\tavg\tmax");
+		printf("submit\t\t:\t%lu\t%lu\t%lu\t%lu\n",
+			submit_time[0], submit_time[LOOPS/2],
+			submit_time[LOOPS], submit_time[LOOPS-1]);
+		printf("launch\t\t:\t%lu\t%lu\t%lu\t%lu\n",
+			launch_time[0], launch_time[LOOPS/2],
+			launch_time[LOOPS], launch_time[LOOPS-1]);
+		printf("end\t\t:\t%lu\t%lu\t%lu\t%lu\n",
+			end_time[0], end_time[LOOPS/2],
+			end_time[LOOPS], end_time[LOOPS-1]);
+	}
+
+#ifdef CL_VERSION_2_0
+	puts("== device-side enqueue ==");
+	error = test_device_enqueue(env, nop);
+#endif
+
+out:
+	if (nop)
+		clReleaseKernel(nop);
+	if (pg)
+		clReleaseProgram(pg);
+	clFinish(q);
+
+	return error;
+}
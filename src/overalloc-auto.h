@@ -0,0 +1,236 @@
+/* Overallocation test leaving the buffer juggling to the runtime alone,
+ * run by overalloc-auto and clbench.
+ *
+ * Requires error.h, verify.h, trace.h, phases.h and testenv.h.
+ */
+
+// kernel to force usage of the buffer
+const char *overalloc_auto_src[] = {
+"kernel void add(global float *dst, global const float *src, uint n) {\n",
+"	uint i = get_global_id(0);\n",
+"	if (i < n) dst[i] += src[i];\n",
+"}"
+};
+
+// macro to round size to the next multiple of base
+#define ROUND_MUL(size, base) \
+	((size + base - 1)/base)*base
+
+#define MB (1024*1024.0)
+
+/* buffers are filled as set by fill_mode and the result checked as set
+ * by check_mode
+ */
+void overalloc_auto_test(const struct test_env *env,
+	enum fill_mode fill_mode, enum check_mode check_mode)
+{
+	const cl_device_id d = env->dev->d;
+	const cl_context ctx = env->ctx;
+	const cl_command_queue q = env->q;
+
+	size_t gmem; // device global memory size
+	size_t alloc_max; // max single-buffer-size on device
+
+	cl_uint nbuf; // number of buffers to allocate
+	cl_mem *buf; // array of allocated buffers
+
+	cl_uint nels; // number of elements that fit in the allocated arrays
+	float *hbuf; // host buffer pointer
+
+	// expected result at a given timestep
+	float expected;
+
+	cl_program pg; // program
+	cl_kernel k; // actual kernel
+	size_t gws ; // global work size
+	size_t wgm ; // preferred workgroup size multiple (will be used as local size too)
+
+	// sync events for mem/launch ops
+	cl_event mem_evt = NULL, krn_evt = NULL;
+	cl_event map_evt = NULL, fill_evt = NULL, unmap_evt = NULL, mig_evt = NULL;
+
+	// wall-clock start of the current API call
+	double t0;
+	char label[32];
+
+	// generic iterator
+	cl_uint i;
+
+	phase_reset();
+
+	error = clGetDeviceInfo(d, CL_DEVICE_GLOBAL_MEM_SIZE,
+			sizeof(gmem), &gmem, NULL);
+	CHECK_ERROR("getting device global memory size");
+	error = clGetDeviceInfo(d, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+			sizeof(alloc_max), &alloc_max, NULL);
+	CHECK_ERROR("getting device max memory allocation size");
+
+	// create program
+	pg = clCreateProgramWithSource(ctx, sizeof(overalloc_auto_src)/sizeof(*overalloc_auto_src),
+			overalloc_auto_src, NULL, &error);
+	CHECK_ERROR("creating program");
+
+	// build program
+	error = clBuildProgram(pg, 1, &d, NULL, NULL, NULL);
+	CHECK_ERROR("building program");
+
+	// get kernel
+	k = clCreateKernel(pg, "add", &error);
+	CHECK_ERROR("creating kernel");
+
+	error = clGetKernelWorkGroupInfo(k, d, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+			sizeof(wgm), &wgm, NULL);
+	CHECK_ERROR("getting preferred workgroup size multiple");
+
+	verify_setup(ctx, d);
+	printf("filling buffers: %s, checking results: %s\n",
+			fill_mode_name[fill_mode], check_mode_name[check_mode]);
+
+	// number of elements on which kernel will be launched. it's ok if we don't
+	// cover every byte of the buffers
+	nels = alloc_max/sizeof(cl_float);
+
+	gws = ROUND_MUL(nels, wgm);
+
+	printf("will use %zu workitems grouped by %zu to process %u elements\n",
+			gws, wgm, nels);
+
+	// we will try and allocate at least one buffer more than needed to fill
+	// the device memory, and no less than 3 anyway
+	nbuf = gmem/alloc_max + 1;
+	if (nbuf < 3)
+		nbuf = 3;
+
+	printf("will try allocating %u buffers of %gMB each to overcommit %gMB\n",
+			nbuf, alloc_max/MB, gmem/MB);
+
+	buf = calloc(nbuf, sizeof(cl_mem));
+
+	if (!buf) {
+		fprintf(stderr, "could not prepare support for %u buffers\n", nbuf);
+		exit(1);
+	}
+
+	for (i = 0; i < nbuf; ++i) {
+		t0 = now();
+		buf[i] = clCreateBuffer(ctx, CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_WRITE, alloc_max,
+				NULL, &error);
+		phase_host(PH_ALLOC, t0);
+		CHECK_ERROR("allocating buffer");
+		printf("buffer %u allocated\n", i);
+	}
+	printf("allocation times (ms, host):");
+	phase_print(&iter_times, 1);
+	total_times.host[PH_ALLOC] = iter_times.host[PH_ALLOC];
+	iter_times.host[PH_ALLOC] = 0;
+
+	// memset the first buffer
+	hbuf = clEnqueueMapBuffer(q, buf[0], CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+			0, alloc_max, 0, NULL, NULL, &error);
+	CHECK_ERROR("mapping buffer 0");
+	memset(hbuf, 0, alloc_max);
+	error = clEnqueueUnmapMemObject(q, buf[0], hbuf, 0, NULL, NULL);
+	CHECK_ERROR("unmapping buffer 0");
+	hbuf = NULL;
+
+	// use the buffers
+	for (i = 1; i < nbuf; ++i) {
+		printf("testing buffer %u\n", i);
+
+		// for each buffer, we do a setup on CPU and then use it as second
+		// argument for the kernel
+		if (fill_mode == FILL_HOST) {
+			t0 = now();
+			hbuf = clEnqueueMapBuffer(q, buf[i], CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+					0, alloc_max, 0, NULL, &map_evt, &error);
+			phase_host(PH_MAP, t0);
+			CHECK_ERROR("mapping buffer");
+			t0 = now();
+			par_fill(hbuf, nels, i);
+			phase_host(PH_FILL, t0);
+			t0 = now();
+			error = clEnqueueUnmapMemObject(q, buf[i], hbuf, 0, NULL, &unmap_evt);
+			phase_host(PH_UNMAP, t0);
+			CHECK_ERROR("unmapping buffer");
+			hbuf = NULL;
+		} else {
+			t0 = now();
+			error = fill_device(q, fill_mode, buf[i], nels, i, 0, NULL, &fill_evt);
+			phase_host(PH_FILL, t0);
+			CHECK_ERROR("filling buffer on device");
+		}
+
+		// make sure all pending actions are completed
+		error =	clFinish(q);
+		CHECK_ERROR("settling down");
+
+		if (map_evt)
+			phase_event(PH_MAP, map_evt);
+		if (unmap_evt)
+			phase_event(PH_UNMAP, unmap_evt);
+		if (fill_evt)
+			phase_event(PH_FILL, fill_evt);
+		if (mig_evt)
+			phase_event(PH_MIGRATE, mig_evt);
+		map_evt = unmap_evt = fill_evt = mig_evt = NULL;
+
+		clSetKernelArg(k, 0, sizeof(buf[0]), buf);
+		clSetKernelArg(k, 1, sizeof(buf[i]), buf + i);
+		clSetKernelArg(k, 2, sizeof(nels), &nels);
+		t0 = now();
+		error = clEnqueueNDRangeKernel(q, k, 1, NULL, &gws, &wgm,
+				0, NULL, &krn_evt);
+		phase_host(PH_KERNEL, t0);
+		CHECK_ERROR("enqueueing kernel");
+
+		expected = i*(i+1)/2.0f;
+		t0 = now();
+		if (check_mode == CHECK_DEVICE) {
+			cl_uint nbad, first_bad;
+			error = check_device(q, buf[0], nels, expected, 1, &krn_evt,
+					&nbad, &first_bad, &mem_evt);
+			CHECK_ERROR("checking buffer 0 on device");
+			if (nbad) {
+				fprintf(stderr, "%u mismatches, first @ %u, expected %g\n",
+						nbad, first_bad, expected);
+				exit(1);
+			}
+		} else {
+			size_t first_bad;
+			hbuf = clEnqueueMapBuffer(q, buf[0], CL_TRUE, CL_MAP_READ,
+					0, alloc_max, 1, &krn_evt, &mem_evt, &error);
+			CHECK_ERROR("mapping buffer 0");
+			if (par_check(hbuf, nels, expected, &first_bad)) {
+				fprintf(stderr, "mismatch @ %zu: %g instead of %g\n",
+						first_bad, hbuf[first_bad], expected);
+				exit(1);
+			}
+			error = clEnqueueUnmapMemObject(q, buf[0], hbuf, 0, NULL, NULL);
+			CHECK_ERROR("unmapping buffer 0");
+			hbuf = NULL;
+			error = clFinish(q);
+			CHECK_ERROR("settling down");
+		}
+		phase_host(PH_VERIFY, t0);
+
+		// the kernel has completed by now, since verification waited for it
+		phase_event(PH_KERNEL, krn_evt);
+		phase_event(PH_VERIFY, mem_evt);
+		krn_evt = mem_evt = NULL;
+
+		snprintf(label, sizeof(label), "buffer %u", i);
+		phase_iter_done(label);
+	}
+
+	puts("Summary:");
+	phase_report();
+
+	for (i = 1; i <= nbuf; ++i) {
+		clReleaseMemObject(buf[nbuf - i]);
+		printf("buffer %u freed\n", nbuf  - i);
+	}
+	verify_teardown();
+	clReleaseKernel(k);
+	clReleaseProgram(pg);
+	free(buf);
+}
@@ -0,0 +1,420 @@
+/* Stream a file larger than device memory to the device, either zero-copy
+ * from a mapping of the file or through pinned staging buffers */
+
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <CL/cl.h>
+
+#include "error.h"
+#include "verify.h"
+#include "trace.h"
+#include "phases.h"
+#include "overalloc.h"
+
+#define DEFAULT_FILE "overalloc-file.dat"
+
+// default window size, in MB
+#define DEFAULT_WINDOW 64
+
+// the file is made of blocks of this many bytes, each holding a single value
+// that depends on its position; windows are whole numbers of blocks, which
+// are whole numbers of pages
+#define BLOCK (1024*1024)
+
+// number of staging buffers for the read() path
+#define NSTAGE 2
+
+// how many windows ahead to hint the kernel to read when advising
+#define READAHEAD 2
+
+int fd = -1; // the file
+size_t nwin; // number of windows in the file
+int generated; // whether the file was generated by this run, with the known pattern
+float *host_ref; // accumulator computed on the host, for files we didn't generate
+
+cl_mem acc; // accumulator, on the device
+cl_mem stage[NSTAGE]; // pinned staging buffers
+cl_command_queue mq; // queue for the staging maps, so they don't wait for all the kernels on q
+cl_event stage_evt[NSTAGE]; // last kernel using each staging buffer
+
+// block b of the file holds this value in all its elements; the values
+// are kept small, so that the sum over all the windows is exact
+float block_value(size_t b)
+{
+	return b % 256;
+}
+
+// expected value of the accumulator in block jb of the window
+float expected_sum(size_t jb)
+{
+	const size_t bpw = buf_size/BLOCK;
+	float sum = 0;
+	for (size_t w = 0; w < nwin; ++w)
+		sum += block_value(w*bpw + jb);
+	return sum;
+}
+
+void sys_error(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+/* open fname, generating it with the known pattern (and size bytes) only
+ * if it doesn't exist: existing files are streamed as they are
+ */
+void open_file(const char *fname, size_t size)
+{
+	fd = open(fname, O_RDONLY);
+	if (fd >= 0)
+		return;
+	if (errno != ENOENT)
+		sys_error(fname);
+
+	printf("generating %s (%gMB)\n", fname, size/MB);
+	generated = 1;
+	// O_EXCL: never overwrite a file that appeared in the meantime
+	fd = open(fname, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		sys_error(fname);
+	float *wbuf = malloc(BLOCK);
+	if (!wbuf) {
+		fputs("couldn't allocate write buffer\n", stderr);
+		exit(1);
+	}
+	for (size_t b = 0; b < size/BLOCK; ++b) {
+		par_fill(wbuf, BLOCK/sizeof(float), block_value(b));
+		size_t done = 0;
+		while (done < BLOCK) {
+			ssize_t ret = write(fd, (char *)wbuf + done, BLOCK - done);
+			if (ret < 0)
+				sys_error("writing file");
+			done += ret;
+		}
+	}
+	free(wbuf);
+	// flush to disk, so that the pages can be dropped from the cache
+	if (fsync(fd))
+		sys_error("syncing file");
+}
+
+/* sum the windows of the file on the host, in the same order as the
+ * device, as the reference for files with unknown contents
+ */
+void compute_host_ref(void)
+{
+	float *wbuf = malloc(buf_size);
+	host_ref = calloc(nels, sizeof(*host_ref));
+	if (!wbuf || !host_ref) {
+		fputs("couldn't allocate host reference\n", stderr);
+		exit(1);
+	}
+	for (size_t w = 0; w < nwin; ++w) {
+		size_t done = 0;
+		while (done < buf_size) {
+			ssize_t ret = pread(fd, (char *)wbuf + done, buf_size - done, w*buf_size + done);
+			if (ret < 0)
+				sys_error("reading file");
+			if (ret == 0) {
+				fputs("unexpected end of file\n", stderr);
+				exit(1);
+			}
+			done += ret;
+		}
+		for (size_t i = 0; i < nels; ++i)
+			host_ref[i] += wbuf[i];
+	}
+	free(wbuf);
+}
+
+// drop the file from the page cache, so that each run starts cold
+void drop_cache(void)
+{
+	int ret = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	if (ret)
+		fprintf(stderr, "warning: could not drop file from cache (%s)\n", strerror(ret));
+}
+
+void clear_acc(void)
+{
+	const float patt = 0;
+	error = clEnqueueFillBuffer(q, acc, &patt, sizeof(patt), 0, buf_size,
+		0, NULL, NULL);
+	CHECK_ERROR("clearing accumulator");
+	error = clFinish(q);
+	CHECK_ERROR("settling down");
+}
+
+// add window buffer win to the accumulator, once wait (if any) is complete
+void add_window(cl_mem win, cl_event wait, cl_event *evt)
+{
+	clSetKernelArg(k, 0, sizeof(acc), &acc);
+	clSetKernelArg(k, 1, sizeof(win), &win);
+	clSetKernelArg(k, 2, sizeof(nels), &nels);
+	error = clEnqueueNDRangeKernel(q, k, 1, NULL, &gws, &wgm,
+			wait != NULL, wait ? &wait : NULL, evt);
+	CHECK_ERROR("enqueueing kernel");
+	clFlush(q);
+}
+
+/* check the accumulator against the known pattern if we generated the
+ * file, or against the host reference if one was computed; otherwise
+ * (an existing file, without verification requested) there is nothing
+ * to check against
+ */
+void check_acc(const char *name)
+{
+	if (!generated && !host_ref)
+		return;
+
+	float *hbuf = clEnqueueMapBuffer(q, acc, CL_TRUE, CL_MAP_READ,
+			0, buf_size, 0, NULL, NULL, &error);
+	CHECK_ERROR("mapping accumulator");
+	// the same additions in the same order: the results must be identical,
+	// NaNs (which arbitrary data may hold) included
+	for (size_t i = 0; host_ref && i < nels; ++i) {
+		if (hbuf[i] != host_ref[i] && !(hbuf[i] != hbuf[i] && host_ref[i] != host_ref[i])) {
+			fprintf(stderr, "%s: mismatch @ %zu: %g instead of %g\n", name,
+				i, hbuf[i], host_ref[i]);
+			exit(1);
+		}
+	}
+	for (size_t jb = 0; !host_ref && jb < buf_size/BLOCK; ++jb) {
+		const size_t block_els = BLOCK/sizeof(float);
+		const float expected = expected_sum(jb);
+		size_t first_bad;
+		if (par_check(hbuf + jb*block_els, block_els, expected, &first_bad)) {
+			fprintf(stderr, "%s: mismatch @ %zu: %g instead of %g\n", name,
+				jb*block_els + first_bad, hbuf[jb*block_els + first_bad], expected);
+			exit(1);
+		}
+	}
+	clEnqueueUnmapMemObject(q, acc, hbuf, 0, NULL, NULL);
+	clFinish(q);
+}
+
+/* map the whole file, and wrap each window in a CL_MEM_USE_HOST_PTR
+ * buffer, so that the platform can read it directly from the mapping
+ */
+double stream_mmap(int advise)
+{
+	const size_t len = nwin*buf_size;
+	double start, elapsed;
+
+	drop_cache();
+	clear_acc();
+
+	start = now();
+	char *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		sys_error("mapping file");
+	if (advise)
+		posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
+
+	for (size_t w = 0; w < nwin; ++w) {
+		if (advise && w + READAHEAD < nwin)
+			posix_madvise(map + (w + READAHEAD)*buf_size, buf_size,
+				POSIX_MADV_WILLNEED);
+		cl_mem win = clCreateBuffer(ctx, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY,
+				buf_size, map + w*buf_size, &error);
+		CHECK_ERROR("wrapping window");
+		cl_event evt;
+		add_window(win, NULL, &evt);
+		trace_defer(evt, "add");
+		clReleaseEvent(evt);
+		// the buffer stays alive until the kernel is done with it
+		clReleaseMemObject(win);
+	}
+	error = clFinish(q);
+	CHECK_ERROR("finishing");
+	elapsed = now() - start;
+	trace_host("mmap", start);
+	trace_flush();
+
+	munmap(map, len);
+	check_acc("mmap");
+	return elapsed;
+}
+
+/* read() each window into one of NSTAGE CL_MEM_ALLOC_HOST_PTR staging
+ * buffers, while the kernel processes the previous one. Maps and unmaps go
+ * on their own queue, mq, so that a map only waits for the kernel that
+ * last used its staging buffer, and the kernels wait for the unmaps
+ */
+double stream_read(int advise)
+{
+	double start, elapsed;
+
+	drop_cache();
+	clear_acc();
+
+	start = now();
+	if (advise)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	if (lseek(fd, 0, SEEK_SET) < 0)
+		sys_error("seeking file");
+
+	for (size_t w = 0; w < nwin; ++w) {
+		const cl_uint s = w % NSTAGE;
+
+		if (advise && w + READAHEAD < nwin)
+			posix_fadvise(fd, (w + READAHEAD)*buf_size, buf_size,
+				POSIX_FADV_WILLNEED);
+
+		// wait for the kernel that last used the staging buffer
+		char *hbuf = clEnqueueMapBuffer(mq, stage[s], CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+				0, buf_size, stage_evt[s] != NULL, stage_evt[s] ? stage_evt + s : NULL,
+				NULL, &error);
+		CHECK_ERROR("mapping staging buffer");
+		if (stage_evt[s]) {
+			clReleaseEvent(stage_evt[s]);
+			stage_evt[s] = NULL;
+		}
+
+		const double read_start = now();
+		size_t done = 0;
+		while (done < buf_size) {
+			ssize_t ret = read(fd, hbuf + done, buf_size - done);
+			if (ret < 0)
+				sys_error("reading file");
+			if (ret == 0) {
+				fputs("unexpected end of file\n", stderr);
+				exit(1);
+			}
+			done += ret;
+		}
+		trace_host("read window", read_start);
+
+		cl_event unmap_evt;
+		error = clEnqueueUnmapMemObject(mq, stage[s], hbuf, 0, NULL, &unmap_evt);
+		CHECK_ERROR("unmapping staging buffer");
+		clFlush(mq);
+		add_window(stage[s], unmap_evt, stage_evt + s);
+		trace_defer(unmap_evt, "unmap");
+		trace_defer(stage_evt[s], "add");
+		clReleaseEvent(unmap_evt);
+	}
+	error = clFinish(q);
+	CHECK_ERROR("finishing");
+	elapsed = now() - start;
+	trace_host("read", start);
+	trace_flush();
+
+	for (cl_uint s = 0; s < NSTAGE; ++s)
+		if (stage_evt[s]) {
+			clReleaseEvent(stage_evt[s]);
+			stage_evt[s] = NULL;
+		}
+	check_acc("read");
+	return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	// selected platform and device number
+	cl_uint pn = 0, dn = 0;
+
+	const char *fname = DEFAULT_FILE;
+	size_t size = 0; // file size, defaults to twice the device memory
+	size_t window = DEFAULT_WINDOW*MB;
+	int advise = 0; // whether to give readahead hints
+	int verify = 0; // whether to verify existing files against a host reference
+
+	// set platform/device num, file, sizes and hints from command line
+	if (argc > 1)
+		pn = atoi(argv[1]);
+	if (argc > 2)
+		dn = atoi(argv[2]);
+	if (argc > 3)
+		fname = argv[3];
+	if (argc > 4)
+		size = atof(argv[4])*MB;
+	if (argc > 5)
+		window = atof(argv[5])*MB;
+	if (argc > 6)
+		advise = atoi(argv[6]);
+	if (argc > 7)
+		verify = atoi(argv[7]);
+
+	setup(pn, dn);
+
+	if (!size)
+		size = 2*gmem;
+
+	// windows must start at page boundaries, for the mapping
+	if (BLOCK % sysconf(_SC_PAGESIZE)) {
+		fprintf(stderr, "page size %ld does not divide the block size\n",
+			sysconf(_SC_PAGESIZE));
+		exit(1);
+	}
+	if (window > alloc_max)
+		window = alloc_max;
+	window = (window/BLOCK)*BLOCK;
+	if (!window)
+		window = BLOCK;
+	set_buf_size(window);
+
+	open_file(fname, size);
+	{
+		struct stat st;
+		if (fstat(fd, &st))
+			sys_error("stat");
+		nwin = st.st_size/buf_size;
+	}
+	if (!nwin) {
+		fprintf(stderr, "%s is smaller than a window\n", fname);
+		exit(1);
+	}
+
+	if (!generated && verify) {
+		puts("computing host reference");
+		compute_host_ref();
+	}
+
+	printf("streaming %zu windows of %gMB (%gMB total) from %s, %s readahead hints\n",
+			nwin, buf_size/MB, nwin*buf_size/MB, fname, advise ? "with" : "without");
+
+	mq = clCreateCommandQueue(ctx, d, CL_QUEUE_PROFILING_ENABLE, &error);
+	CHECK_ERROR("creating map queue");
+	trace_name_queue(q, "kernels");
+	trace_name_queue(mq, "maps");
+
+	acc = clCreateBuffer(ctx, CL_MEM_READ_WRITE, buf_size, NULL, &error);
+	CHECK_ERROR("allocating accumulator");
+	for (cl_uint s = 0; s < NSTAGE; ++s) {
+		stage[s] = clCreateBuffer(ctx, CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_ONLY,
+				buf_size, NULL, &error);
+		CHECK_ERROR("allocating staging buffer");
+	}
+
+	const double data_bytes = (double)nwin*buf_size;
+	double elapsed;
+
+	elapsed = stream_mmap(advise);
+	printf("mmap + USE_HOST_PTR: %gms, %gGB/s\n", elapsed*1.0e3, data_bytes/elapsed*1.0e-9);
+	elapsed = stream_read(advise);
+	printf("read + ALLOC_HOST_PTR staging: %gms, %gGB/s\n", elapsed*1.0e3, data_bytes/elapsed*1.0e-9);
+
+	close(fd);
+	free(host_ref);
+	for (cl_uint s = 0; s < NSTAGE; ++s)
+		clReleaseMemObject(stage[s]);
+	clReleaseMemObject(acc);
+	clReleaseCommandQueue(mq);
+
+	release_kernels();
+	clReleaseProgram(pg);
+	clReleaseCommandQueue(q);
+	clReleaseContext(ctx);
+
+	return 0;
+}
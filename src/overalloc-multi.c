@@ -0,0 +1,275 @@
+/* Spread a working set that overcommits one device across all the devices
+ * of a platform, and bring each buffer to the first device when needed */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <CL/cl.h>
+
+#include "error.h"
+#include "verify.h"
+#include "trace.h"
+#include "phases.h"
+#include "overalloc.h"
+
+// buffers are made small enough that a fair number of them fit on a device
+#define BUFS_PER_GMEM 16
+
+// default size of the working set, relative to the memory of the first device
+#define DEFAULT_RATIO 1.5
+
+// how buffers are placed and brought to the first device, which holds the
+// accumulator and runs all the kernels
+enum spread_mode {
+	SPREAD_NONE, // all buffers on the first device: plain oversubscription
+	SPREAD_COPY, // round-robin, copied to staging buffers on the first device
+	SPREAD_MIGRATE, // round-robin, migrated to the first device and back
+	NUM_SPREAD_MODES
+};
+
+const char * const spread_mode_name[] = { "single", "copy", "migrate" };
+
+cl_command_queue *dq; // one queue per device, dq[0] is q
+size_t *dgmem; // global memory size of each device
+
+cl_uint nbuf; // number of buffers, buf[0] is the accumulator
+cl_mem *buf;
+
+// staging buffers on the first device for the copy mode, and the last
+// kernel that used each of them
+cl_mem stage[2];
+cl_event stage_evt[2];
+
+// device holding buffer i
+cl_uint home(enum spread_mode mode, cl_uint i)
+{
+	return mode == SPREAD_NONE ? 0 : i % nd;
+}
+
+// enqueue buf[0] += src on the first device
+void add(cl_mem src, cl_uint nwait, const cl_event *wait, cl_event *evt)
+{
+	clSetKernelArg(k, 0, sizeof(buf[0]), buf);
+	clSetKernelArg(k, 1, sizeof(src), &src);
+	clSetKernelArg(k, 2, sizeof(nels), &nels);
+	error = clEnqueueNDRangeKernel(q, k, 1, NULL, &gws, &wgm,
+			nwait, wait, evt);
+	CHECK_ERROR("enqueueing kernel");
+}
+
+void finish_all(void)
+{
+	for (cl_uint dev = 0; dev < nd; ++dev) {
+		error = clFinish(dq[dev]);
+		CHECK_ERROR("finishing");
+	}
+}
+
+// run the whole accumulation with the given mode, return the throughput in GB/s
+double run(enum spread_mode mode)
+{
+	const float zero = 0;
+	float expected = 0;
+	double start, elapsed;
+	cl_uint i, nstaged = 0;
+
+	// place each buffer on its device by filling it there
+	error = clEnqueueFillBuffer(q, buf[0], &zero, sizeof(zero), 0, buf_size,
+			0, NULL, NULL);
+	CHECK_ERROR("clearing accumulator");
+	for (i = 1; i < nbuf; ++i) {
+		const float patt = store_value(i);
+		error = clEnqueueFillBuffer(dq[home(mode, i)], buf[i], &patt, sizeof(patt),
+				0, buf_size, 0, NULL, NULL);
+		CHECK_ERROR("filling buffer");
+		expected += patt;
+	}
+	for (i = 0; i < 2 && mode == SPREAD_COPY; ++i) {
+		error = clEnqueueFillBuffer(q, stage[i], &zero, sizeof(zero), 0, buf_size,
+				0, NULL, NULL);
+		CHECK_ERROR("placing staging buffer");
+	}
+	finish_all();
+
+	start = now();
+	for (i = 1; i < nbuf; ++i) {
+		const cl_uint h = home(mode, i);
+		cl_event evt;
+
+		if (h == 0) {
+			add(buf[i], 0, NULL, &evt);
+			trace_defer(evt, "add");
+			clReleaseEvent(evt);
+		} else if (mode == SPREAD_COPY) {
+			// the device holding the buffer pushes it to the first one,
+			// once the kernel that last used the staging buffer is done
+			const cl_uint s = nstaged++ % 2;
+			error = clEnqueueCopyBuffer(dq[h], buf[i], stage[s], 0, 0, buf_size,
+					stage_evt[s] != NULL, stage_evt[s] ? stage_evt + s : NULL, &evt);
+			CHECK_ERROR("copying buffer to the first device");
+			clFlush(dq[h]);
+			trace_defer(evt, "copy to first device");
+			if (stage_evt[s])
+				clReleaseEvent(stage_evt[s]);
+			add(stage[s], 1, &evt, stage_evt + s);
+			trace_defer(stage_evt[s], "add");
+			clReleaseEvent(evt);
+		} else {
+			cl_event mig_evt;
+			error = clEnqueueMigrateMemObjects(q, 1, buf + i, 0, 0, NULL, &mig_evt);
+			CHECK_ERROR("migrating buffer to the first device");
+			trace_defer(mig_evt, "migrate to first device");
+			clReleaseEvent(mig_evt);
+			add(buf[i], 0, NULL, &evt);
+			trace_defer(evt, "add");
+			// and back home once the kernel is done with it
+			error = clEnqueueMigrateMemObjects(dq[h], 1, buf + i, 0, 1, &evt, &mig_evt);
+			CHECK_ERROR("migrating buffer back");
+			clFlush(dq[h]);
+			trace_defer(mig_evt, "migrate back");
+			clReleaseEvent(mig_evt);
+			clReleaseEvent(evt);
+		}
+		clFlush(q);
+	}
+	finish_all();
+	elapsed = now() - start;
+	trace_host(spread_mode_name[mode], start);
+	trace_flush();
+
+	for (i = 0; i < 2; ++i)
+		if (stage_evt[i]) {
+			clReleaseEvent(stage_evt[i]);
+			stage_evt[i] = NULL;
+		}
+
+	float *hbuf = clEnqueueMapBuffer(q, buf[0], CL_TRUE, CL_MAP_READ,
+			0, buf_size, 0, NULL, NULL, &error);
+	CHECK_ERROR("mapping accumulator");
+	error = check_host(hbuf, expected);
+	clEnqueueUnmapMemObject(q, buf[0], hbuf, 0, NULL, NULL);
+	clFinish(q);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "%s: wrong result\n", spread_mode_name[mode]);
+		exit(1);
+	}
+
+	return (nbuf - 1)*(buf_size/elapsed)*1.0e-9;
+}
+
+int main(int argc, char *argv[])
+{
+	// selected platform
+	cl_uint pn = 0;
+
+	// size of the working set, relative to the memory of the first device
+	double ratio = DEFAULT_RATIO;
+
+	// set platform num and ratio from command line
+	if (argc > 1)
+		pn = atoi(argv[1]);
+	if (argc > 2)
+		ratio = atof(argv[2]);
+
+	select_platform(pn);
+
+	error = clGetDeviceIDs(p, CL_DEVICE_TYPE_ALL, 0, NULL, &nd);
+	CHECK_ERROR("getting amount of device IDs");
+	printf("%u devices found\n", nd);
+	device = calloc(nd, sizeof(*device));
+	dq = calloc(nd, sizeof(*dq));
+	dgmem = calloc(nd, sizeof(*dgmem));
+	if (!device || !dq || !dgmem) {
+		fputs("couldn't allocate device data\n", stderr);
+		exit(1);
+	}
+	error = clGetDeviceIDs(p, CL_DEVICE_TYPE_ALL, nd, device, NULL);
+	CHECK_ERROR("getting device IDs");
+
+	// one context over all the devices
+	ctx_prop[1] = (cl_context_properties)p;
+	ctx = clCreateContext(ctx_prop, nd, device, NULL, NULL, &error);
+	CHECK_ERROR("creating context");
+
+	alloc_max = 0;
+	for (cl_uint dev = 0; dev < nd; ++dev) {
+		size_t dmax;
+		error = clGetDeviceInfo(device[dev], CL_DEVICE_NAME, BUFSZ, strbuf, NULL);
+		CHECK_ERROR("getting device name");
+		error = clGetDeviceInfo(device[dev], CL_DEVICE_GLOBAL_MEM_SIZE,
+				sizeof(dgmem[dev]), dgmem + dev, NULL);
+		CHECK_ERROR("getting device global memory size");
+		error = clGetDeviceInfo(device[dev], CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+				sizeof(dmax), &dmax, NULL);
+		CHECK_ERROR("getting device max memory allocation size");
+		if (!alloc_max || dmax < alloc_max)
+			alloc_max = dmax;
+		printf("device %u: %s, %gMB\n", dev, strbuf, dgmem[dev]/MB);
+
+		dq[dev] = clCreateCommandQueue(ctx, device[dev], CL_QUEUE_PROFILING_ENABLE, &error);
+		CHECK_ERROR("creating queue");
+	}
+	if (nd < 2)
+		puts("only one device: spreading will not help");
+
+	// the first device holds the accumulator and runs the kernels
+	d = device[0];
+	q = dq[0];
+	gmem = dgmem[0];
+
+	build_program(nd, device);
+	error = clGetKernelWorkGroupInfo(k, d, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+			sizeof(wgm), &wgm, NULL);
+	CHECK_ERROR("getting preferred workgroup size multiple");
+
+	size_t size = gmem/BUFS_PER_GMEM;
+	if (size > alloc_max)
+		size = alloc_max;
+	set_buf_size(size);
+
+	nbuf = ratio*gmem/buf_size + 0.5;
+	if (nbuf < 2)
+		nbuf = 2;
+
+	printf("will use %u buffers of %gMB (%gMB, %g times the memory of device 0)\n",
+			nbuf, buf_size/MB, nbuf*(buf_size/MB), nbuf*buf_size/(double)gmem);
+
+	buf = calloc(nbuf, sizeof(cl_mem));
+	if (!buf) {
+		fprintf(stderr, "could not prepare support for %u buffers\n", nbuf);
+		exit(1);
+	}
+	for (cl_uint i = 0; i < nbuf; ++i) {
+		buf[i] = clCreateBuffer(ctx, CL_MEM_READ_WRITE, buf_size, NULL, &error);
+		CHECK_ERROR("allocating buffer");
+	}
+	for (cl_uint i = 0; i < 2; ++i) {
+		stage[i] = clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, buf_size,
+				NULL, &error);
+		CHECK_ERROR("allocating staging buffer");
+	}
+
+	double single_bw = 0;
+	for (enum spread_mode mode = 0; mode < NUM_SPREAD_MODES; ++mode) {
+		const double bw = run(mode);
+		if (mode == SPREAD_NONE)
+			single_bw = bw;
+		printf("%-8s\t%8.4g GB/s\t%6.3gx\n", spread_mode_name[mode], bw, bw/single_bw);
+	}
+
+	for (cl_uint i = 0; i < 2; ++i)
+		clReleaseMemObject(stage[i]);
+	for (cl_uint i = 0; i < nbuf; ++i)
+		clReleaseMemObject(buf[i]);
+	free(buf);
+
+	release_kernels();
+	clReleaseProgram(pg);
+	for (cl_uint dev = 0; dev < nd; ++dev)
+		clReleaseCommandQueue(dq[dev]);
+	clReleaseContext(ctx);
+
+	return 0;
+}
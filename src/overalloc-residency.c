@@ -0,0 +1,201 @@
+/* Compare device residency management policies on a replayed buffer
+ * access trace that overcommits the device memory */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <CL/cl.h>
+
+#include "error.h"
+#include "verify.h"
+#include "trace.h"
+#include "phases.h"
+#include "overalloc.h"
+#include "schedule.h"
+#include "residency.h"
+
+// buffers are made small enough that a fair number of them fit on the device
+#define BUFS_PER_GMEM 16
+
+// how many schedule entries the lookahead policy prefetches
+#define LOOKAHEAD 2
+
+cl_uint nbuf; // number of source buffers
+cl_mem *buf; // source buffers
+cl_mem acc; // accumulator, always on the device
+
+// migrations go to their own queue, so that prefetches can overlap kernels
+cl_command_queue mq;
+
+cl_uint *sched; // access trace
+cl_uint nsched; // length of the access trace
+
+// run the trace once with the given policy
+cl_int run_policy(enum residency_policy policy, cl_uint capacity)
+{
+	struct residency r;
+	cl_event wait, krn_evt;
+	const float patt = 0;
+	float *hbuf = NULL;
+	double expected = 0;
+	double start, elapsed;
+	cl_uint i;
+
+	// start with a zeroed accumulator and everything on the host
+	error = clEnqueueFillBuffer(q, acc, &patt, sizeof(patt), 0, buf_size,
+		0, NULL, NULL);
+	CHECK_ERROR("clearing accumulator");
+	error = clEnqueueMigrateMemObjects(q, nbuf, buf, CL_MIGRATE_MEM_OBJECT_HOST,
+		0, NULL, NULL);
+	CHECK_ERROR("migrating buffers to host");
+	error = clFinish(q);
+	CHECK_ERROR("settling down");
+
+	error = residency_init(&r, policy, mq, buf, nbuf, buf_size, capacity,
+		sched, nsched, LOOKAHEAD);
+	CHECK_ERROR("initializing residency manager");
+
+	start = now();
+	for (i = 0; i < nsched; ++i) {
+		const cl_uint b = sched[i];
+
+		error = residency_acquire(&r, b, &wait);
+		CHECK_ERROR("acquiring buffer");
+
+		clSetKernelArg(k, 0, sizeof(acc), &acc);
+		clSetKernelArg(k, 1, sizeof(buf[b]), buf + b);
+		clSetKernelArg(k, 2, sizeof(nels), &nels);
+		error = clEnqueueNDRangeKernel(q, k, 1, NULL, &gws, &wgm,
+				wait != NULL, wait ? &wait : NULL, &krn_evt);
+		CHECK_ERROR("enqueueing kernel");
+		clFlush(q);
+
+		error = residency_release(&r, b, krn_evt);
+		CHECK_ERROR("releasing buffer");
+		trace_defer(krn_evt, "add");
+		clReleaseEvent(krn_evt);
+
+		expected += b;
+	}
+	error = clFinish(q);
+	CHECK_ERROR("finishing");
+	error = clFinish(mq);
+	CHECK_ERROR("finishing migrations");
+	elapsed = now() - start;
+	trace_host(residency_policy_name[policy], start);
+	trace_flush();
+
+	hbuf = clEnqueueMapBuffer(q, acc, CL_TRUE, CL_MAP_READ,
+			0, buf_size, 0, NULL, NULL, &error);
+	CHECK_ERROR("mapping accumulator");
+	error = check_host(hbuf, expected);
+	clEnqueueUnmapMemObject(q, acc, hbuf, 0, NULL, NULL);
+	clFinish(q);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "policy %s: wrong result\n", residency_policy_name[policy]);
+		exit(1);
+	}
+
+	printf("%-10s\t%10.4g\t%10.4g", residency_policy_name[policy],
+		elapsed*1.0e3, nsched*(buf_size/elapsed)*1.0e-9);
+	if (policy == RES_NONE)
+		puts("\t-\t-\t-\t-");
+	else
+		printf("\t%u\t%u\t%.4g\t%.4g\n", r.nfetch, r.nevict,
+			r.bytes_to_device/MB, r.bytes_to_host/MB);
+
+	residency_destroy(&r);
+	return CL_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	// selected platform and device number
+	cl_uint pn = 0, dn = 0;
+
+	// access schedule (or trace file)
+	enum schedule_kind sched_kind = SCHED_ZIPF;
+	const char *trace_file = NULL;
+
+	// set platform/device num and schedule from command line
+	if (argc > 1)
+		pn = atoi(argv[1]);
+	if (argc > 2)
+		dn = atoi(argv[2]);
+	if (argc > 3)
+		sched_kind = parse_schedule(argv[3], &trace_file);
+
+	setup(pn, dn);
+
+	size_t size = gmem/BUFS_PER_GMEM;
+	if (size > alloc_max)
+		size = alloc_max;
+	set_buf_size(size);
+
+	mq = clCreateCommandQueue(ctx, d, CL_QUEUE_PROFILING_ENABLE, &error);
+	CHECK_ERROR("creating migration queue");
+	trace_name_queue(q, "kernels");
+	trace_name_queue(mq, "migrations");
+
+	// leave room for the accumulator and some slack
+	const cl_uint capacity = gmem/buf_size - 2;
+
+	if (sched_kind == SCHED_TRACE) {
+		// as many buffers as the trace references
+		cl_uint maxidx;
+		sched = load_trace(trace_file, &nsched, &maxidx);
+		nbuf = maxidx + 1;
+		printf("loaded trace of %u accesses to %u buffers from %s\n",
+			nsched, nbuf, trace_file);
+	} else {
+		// twice as many buffers as fit on the device
+		nbuf = 2*gmem/buf_size;
+		sched = make_schedule(sched_kind, NULL, 0, nbuf, &nsched);
+		printf("generated %s schedule of %u accesses to %u buffers\n",
+			schedule_name[sched_kind], nsched, nbuf);
+	}
+
+	printf("will use %zu workitems grouped by %zu to process %u elements per buffer\n",
+			gws, wgm, nels);
+	printf("will allocate %u buffers of %gMB each, %u fit on the device (%gMB)\n",
+			nbuf, buf_size/MB, capacity, gmem/MB);
+
+	buf = calloc(nbuf, sizeof(cl_mem));
+	if (!buf) {
+		fprintf(stderr, "could not prepare support for %u buffers\n", nbuf);
+		exit(1);
+	}
+
+	acc = clCreateBuffer(ctx, CL_MEM_READ_WRITE, buf_size, NULL, &error);
+	CHECK_ERROR("allocating accumulator");
+	for (cl_uint i = 0; i < nbuf; ++i) {
+		const float patt = i;
+		buf[i] = clCreateBuffer(ctx, CL_MEM_READ_ONLY, buf_size, NULL, &error);
+		CHECK_ERROR("allocating buffer");
+		error = clEnqueueFillBuffer(q, buf[i], &patt, sizeof(patt), 0, buf_size,
+			0, NULL, NULL);
+		CHECK_ERROR("filling buffer");
+	}
+	error = clFinish(q);
+	CHECK_ERROR("settling down");
+
+	puts("policy    \ttime (ms)\tGB/s\tfetches\tevicts\tMB in\tMB out");
+	for (enum residency_policy policy = 0; policy < NUM_RES_POLICIES; ++policy)
+		run_policy(policy, capacity);
+
+	for (cl_uint i = 0; i < nbuf; ++i)
+		clReleaseMemObject(buf[i]);
+	clReleaseMemObject(acc);
+	free(buf);
+	free(sched);
+
+	release_kernels();
+	clReleaseProgram(pg);
+	clReleaseCommandQueue(mq);
+	clReleaseCommandQueue(q);
+	clReleaseContext(ctx);
+
+	return 0;
+}
@@ -0,0 +1,389 @@
+/* Stream a dataset larger than device memory through a ring of device
+ * staging buffers, overlapping upload, compute and download */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdlib.h>
+#include <CL/cl.h>
+
+#include "error.h"
+#include "trace.h"
+
+cl_uint np; // number of platforms
+cl_platform_id *platform; // list of platforms ids
+cl_platform_id p; // selected platform
+
+cl_uint nd; // number of devices in the selected platform
+cl_device_id *device; // list of device ids
+cl_device_id d; // selected device
+
+// context property: field 1 (the platform) will be set at runtime
+cl_context_properties ctx_prop[] = { CL_CONTEXT_PLATFORM, 0, 0, 0 };
+cl_context ctx; // context
+
+// we use separate queues for uploads, kernels and downloads, so that
+// the platform is free to overlap them
+cl_command_queue up_q, krn_q, down_q;
+
+// generic string retrieval buffer. quick'n'dirty, hence fixed-size
+#define BUFSZ 1024
+char strbuf[BUFSZ];
+
+size_t gmem; // device global memory size
+size_t alloc_max; // max single-buffer-size on device
+size_t buf_size; // size of each chunk
+
+cl_uint nbuf; // number of chunks (‘host’ buffers)
+cl_mem *hostbuf; // array of ‘host’ buffers
+
+// ring of ‘device’ staging buffers
+#define MAX_STAGES 4
+cl_uint nstage = 3;
+cl_mem stage[MAX_STAGES];
+
+cl_uint nels; // number of elements in each chunk
+cl_uint e; // index to iterate over buffer elements on CPU
+float *hbuf; // host buffer pointer
+
+// kernel to process a chunk in place
+const char *src[] = {
+"kernel void process(global float *data, uint n) {\n",
+"	uint i = get_global_id(0);\n",
+"	if (i < n) data[i] = 2*data[i] + 1;\n",
+"}"
+};
+
+cl_program pg; // program
+cl_kernel k; // actual kernel
+size_t gws ; // global work size
+size_t wgm ; // preferred workgroup size multiple (will be used as local size too)
+
+// per-chunk events for the upload, kernel and download of each chunk
+cl_event *up_evt, *krn_evt, *down_evt;
+
+// macro to round size to the next multiple of base
+#define ROUND_MUL(size, base) \
+	((size + base - 1)/base)*base
+
+#define MB (1024*1024.0)
+
+cl_ulong event_time(cl_event evt, cl_profiling_info what)
+{
+	cl_ulong t;
+	error = clGetEventProfilingInfo(evt, what, sizeof(t), &t, NULL);
+	CHECK_ERROR("getting event profiling info");
+	return t;
+}
+
+cl_ulong event_duration(cl_event evt)
+{
+	return event_time(evt, CL_PROFILING_COMMAND_END) -
+		event_time(evt, CL_PROFILING_COMMAND_START);
+}
+
+// fill each ‘host’ buffer with its index
+void fill_chunks(void)
+{
+	for (cl_uint i = 0; i < nbuf; ++i) {
+		hbuf = clEnqueueMapBuffer(up_q, hostbuf[i], CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+				0, buf_size, 0, NULL, NULL, &error);
+		CHECK_ERROR("mapping buffer");
+		for (e = 0; e < nels; ++e)
+			hbuf[e] = i;
+		error = clEnqueueUnmapMemObject(up_q, hostbuf[i], hbuf, 0, NULL, NULL);
+		CHECK_ERROR("unmapping buffer");
+		hbuf = NULL;
+	}
+	error = clFinish(up_q);
+	CHECK_ERROR("settling down");
+}
+
+// check that each chunk was processed exactly once
+void verify_chunks(void)
+{
+	for (cl_uint i = 0; i < nbuf; ++i) {
+		const float expected = 2.0f*i + 1;
+		hbuf = clEnqueueMapBuffer(up_q, hostbuf[i], CL_TRUE, CL_MAP_READ,
+				0, buf_size, 0, NULL, NULL, &error);
+		CHECK_ERROR("mapping buffer");
+		for (e = 0; e < nels; ++e)
+			if (hbuf[e] != expected) {
+				fprintf(stderr, "chunk %u: mismatch @ %u: %g instead of %g\n",
+						i, e, hbuf[e], expected);
+				exit(1);
+			}
+		error = clEnqueueUnmapMemObject(up_q, hostbuf[i], hbuf, 0, NULL, NULL);
+		CHECK_ERROR("unmapping buffer");
+		hbuf = NULL;
+	}
+	error = clFinish(up_q);
+	CHECK_ERROR("settling down");
+}
+
+/* stream all chunks through the first nring staging buffers, with
+ * uploads on uq, kernels on kq and downloads on dq. Passing the same
+ * queue three times with a single staging buffer gives the serial
+ * reference.
+ */
+void stream(const char *name, cl_uint nring,
+	cl_command_queue uq, cl_command_queue kq, cl_command_queue dq)
+{
+	cl_ulong up_busy = 0, krn_busy = 0, down_busy = 0;
+
+	fill_chunks();
+
+	for (cl_uint i = 0; i < nbuf; ++i) {
+		const cl_uint s = i % nring;
+
+		// the staging buffer is free once the chunk that used it
+		// nring steps ago has been downloaded
+		error = clEnqueueCopyBuffer(uq, hostbuf[i], stage[s], 0, 0, buf_size,
+				i >= nring, i >= nring ? down_evt + i - nring : NULL,
+				up_evt + i);
+		CHECK_ERROR("enqueueing upload");
+
+		clSetKernelArg(k, 0, sizeof(cl_mem), stage + s);
+		clSetKernelArg(k, 1, sizeof(nels), &nels);
+		error = clEnqueueNDRangeKernel(kq, k, 1, NULL, &gws, &wgm,
+				1, up_evt + i, krn_evt + i);
+		CHECK_ERROR("enqueueing kernel");
+
+		error = clEnqueueCopyBuffer(dq, stage[s], hostbuf[i], 0, 0, buf_size,
+				1, krn_evt + i, down_evt + i);
+		CHECK_ERROR("enqueueing download");
+
+		// make sure each queue gets going while we enqueue the rest
+		clFlush(uq);
+		clFlush(kq);
+		clFlush(dq);
+	}
+
+	error = clFinish(uq);
+	CHECK_ERROR("finishing uploads");
+	error = clFinish(kq);
+	CHECK_ERROR("finishing kernels");
+	error = clFinish(dq);
+	CHECK_ERROR("finishing downloads");
+
+	const cl_ulong start = event_time(up_evt[0], CL_PROFILING_COMMAND_START);
+	const cl_ulong end = event_time(down_evt[nbuf - 1], CL_PROFILING_COMMAND_END);
+
+	for (cl_uint i = 0; i < nbuf; ++i) {
+		up_busy += event_duration(up_evt[i]);
+		krn_busy += event_duration(krn_evt[i]);
+		down_busy += event_duration(down_evt[i]);
+		trace_event(up_evt[i], "upload");
+		trace_event(krn_evt[i], "process");
+		trace_event(down_evt[i], "download");
+		clReleaseEvent(up_evt[i]);
+		clReleaseEvent(krn_evt[i]);
+		clReleaseEvent(down_evt[i]);
+	}
+
+	verify_chunks();
+
+	const double elapsed = end - start; // ns
+	const double data_bytes = (double)nbuf*buf_size;
+
+	printf("%s (%u staging buffer%s):\n", name, nring, nring > 1 ? "s" : "");
+	printf("\tend-to-end: %gms, dataset: %gGB/s, transfers: %gGB/s\n",
+		elapsed*1.0e-6, data_bytes/elapsed, 2*data_bytes/elapsed);
+	printf("\tbusy (ms): upload: %g, kernel: %g, download: %g, overlap: %gx\n",
+		up_busy*1.0e-6, krn_busy*1.0e-6, down_busy*1.0e-6,
+		(up_busy + krn_busy + down_busy)/elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+	// selected platform and device number
+	cl_uint pn = 0, dn = 0;
+
+	// OpenCL error
+	cl_int error;
+
+	// generic iterator
+	cl_uint i;
+
+	// major/minor version of the platform OpenCL version
+	cl_uint ocl_major, ocl_minor;
+
+	// set platform/device num and number of staging buffers from command line
+	if (argc > 1)
+		pn = atoi(argv[1]);
+	if (argc > 2)
+		dn = atoi(argv[2]);
+	if (argc > 3)
+		nstage = atoi(argv[3]);
+
+	if (nstage < 2 || nstage > MAX_STAGES) {
+		fprintf(stderr, "number of staging buffers must be between 2 and %u\n",
+			MAX_STAGES);
+		exit(1);
+	}
+
+	error = clGetPlatformIDs(0, NULL, &np);
+	CHECK_ERROR("getting amount of platform IDs");
+	printf("%u platforms found\n", np);
+	if (pn >= np) {
+		fprintf(stderr, "there is no platform #%u\n" , pn);
+		exit(1);
+	}
+	// only allocate for IDs up to the intended one
+	platform = calloc(pn+1,sizeof(*platform));
+	// if allocation failed, next call will bomb. rely on this
+	error = clGetPlatformIDs(pn+1, platform, NULL);
+	CHECK_ERROR("getting platform IDs");
+
+	// choose platform
+	p = platform[pn];
+
+	error = clGetPlatformInfo(p, CL_PLATFORM_NAME, BUFSZ, strbuf, NULL);
+	CHECK_ERROR("getting platform name");
+	printf("using platform %u: %s\n", pn, strbuf);
+
+	error = clGetPlatformInfo(p, CL_PLATFORM_VERSION, BUFSZ, strbuf, NULL);
+	CHECK_ERROR("getting platform version");
+	// we need 1.2 at least
+	i = sscanf(strbuf, "OpenCL %u.%u ", &ocl_major, &ocl_minor);
+	if (i != 2) {
+		fprintf(stderr, "%s:%u: unable to determine platform OpenCL version\n",
+			__func__, __LINE__);
+		exit(1);
+	}
+	if (ocl_major == 1 && ocl_minor < 2) {
+		fprintf(stderr, "%s:%u: Platform version %s is not at least 1.2\n",
+			__func__, __LINE__, strbuf);
+		exit(1);
+	}
+
+	error = clGetDeviceIDs(p, CL_DEVICE_TYPE_ALL, 0, NULL, &nd);
+	CHECK_ERROR("getting amount of device IDs");
+	printf("%u devices found\n", nd);
+	if (dn >= nd) {
+		fprintf(stderr, "there is no device #%u\n", dn);
+		exit(1);
+	}
+	// only allocate for IDs up to the intended one
+	device = calloc(dn+1,sizeof(*device));
+	// if allocation failed, next call will bomb. rely on this
+	error = clGetDeviceIDs(p, CL_DEVICE_TYPE_ALL, dn+1, device, NULL);
+	CHECK_ERROR("getting device IDs");
+
+	// choose device
+	d = device[dn];
+	error = clGetDeviceInfo(d, CL_DEVICE_NAME, BUFSZ, strbuf, NULL);
+	CHECK_ERROR("getting device name");
+	printf("using device %u: %s\n", dn, strbuf);
+
+	error = clGetDeviceInfo(d, CL_DEVICE_GLOBAL_MEM_SIZE,
+			sizeof(gmem), &gmem, NULL);
+	CHECK_ERROR("getting device global memory size");
+	error = clGetDeviceInfo(d, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+			sizeof(alloc_max), &alloc_max, NULL);
+	CHECK_ERROR("getting device max memory allocation size");
+
+	// create context
+	ctx_prop[1] = (cl_context_properties)p;
+	ctx = clCreateContext(ctx_prop, 1, &d, NULL, NULL, &error);
+	CHECK_ERROR("creating context");
+
+	// create queues
+	up_q = clCreateCommandQueue(ctx, d, CL_QUEUE_PROFILING_ENABLE, &error);
+	CHECK_ERROR("creating upload queue");
+	krn_q = clCreateCommandQueue(ctx, d, CL_QUEUE_PROFILING_ENABLE, &error);
+	CHECK_ERROR("creating kernel queue");
+	down_q = clCreateCommandQueue(ctx, d, CL_QUEUE_PROFILING_ENABLE, &error);
+	CHECK_ERROR("creating download queue");
+	trace_name_queue(up_q, "upload");
+	trace_name_queue(krn_q, "kernel");
+	trace_name_queue(down_q, "download");
+
+	// create program
+	pg = clCreateProgramWithSource(ctx, sizeof(src)/sizeof(*src), src, NULL, &error);
+	CHECK_ERROR("creating program");
+
+	// build program
+	error = clBuildProgram(pg, 1, &d, NULL, NULL, NULL);
+	CHECK_ERROR("building program");
+
+	// get kernel
+	k = clCreateKernel(pg, "process", &error);
+	CHECK_ERROR("creating kernel");
+
+	error = clGetKernelWorkGroupInfo(k, d, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+			sizeof(wgm), &wgm, NULL);
+	CHECK_ERROR("getting preferred workgroup size multiple");
+
+	// the staging ring should take no more than half of the device memory
+	buf_size = alloc_max;
+	if (buf_size > gmem/2/nstage)
+		buf_size = gmem/2/nstage;
+
+	nels = buf_size/sizeof(cl_float);
+	buf_size = nels*sizeof(cl_float);
+
+	gws = ROUND_MUL(nels, wgm);
+
+	printf("will use %zu workitems grouped by %zu to process %u elements per chunk\n",
+			gws, wgm, nels);
+
+	// enough chunks to overcommit the device memory, and at least
+	// two full turns of the ring
+	nbuf = gmem/buf_size + 1;
+	if (nbuf < 2*nstage)
+		nbuf = 2*nstage;
+
+	printf("will try streaming %u chunks of %gMB each (%gMB) through %u staging buffers, device memory: %gMB\n",
+			nbuf, buf_size/MB, nbuf*(buf_size/MB), nstage, gmem/MB);
+
+	hostbuf = calloc(nbuf, sizeof(cl_mem));
+	up_evt = calloc(nbuf, sizeof(cl_event));
+	krn_evt = calloc(nbuf, sizeof(cl_event));
+	down_evt = calloc(nbuf, sizeof(cl_event));
+
+	if (!hostbuf || !up_evt || !krn_evt || !down_evt) {
+		fprintf(stderr, "could not prepare support for %u buffers\n", nbuf);
+		exit(1);
+	}
+
+	// allocate ‘host’ buffers
+	for (i = 0; i < nbuf; ++i) {
+		hostbuf[i] = clCreateBuffer(ctx, CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_WRITE, buf_size,
+				NULL, &error);
+		CHECK_ERROR("allocating host buffer");
+		error = clEnqueueMigrateMemObjects(up_q, 1, hostbuf + i,
+				CL_MIGRATE_MEM_OBJECT_HOST | CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED,
+				0, NULL, NULL);
+		CHECK_ERROR("migrating buffer to host");
+	}
+	printf("%u host buffers allocated and migrated to host\n", nbuf);
+
+	// allocate ‘device’ staging buffers
+	for (i = 0; i < nstage; ++i) {
+		stage[i] = clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, buf_size,
+				NULL, &error);
+		CHECK_ERROR("allocating staging buffer");
+		printf("staging buffer %u allocated\n", i);
+	}
+
+	stream("serial", 1, up_q, up_q, up_q);
+	stream("pipelined", nstage, up_q, krn_q, down_q);
+
+	for (i = 1; i <= nstage; ++i) {
+		clReleaseMemObject(stage[nstage - i]);
+		printf("staging buffer %u freed\n", nstage - i);
+	}
+	for (i = 1; i <= nbuf; ++i)
+		clReleaseMemObject(hostbuf[nbuf - i]);
+	printf("%u host buffers freed\n", nbuf);
+
+	clReleaseKernel(k);
+	clReleaseProgram(pg);
+	clReleaseCommandQueue(down_q);
+	clReleaseCommandQueue(krn_q);
+	clReleaseCommandQueue(up_q);
+	clReleaseContext(ctx);
+
+	return 0;
+}
@@ -0,0 +1,240 @@
+/* Sweep the oversubscription ratio of the device memory with each
+ * buffer juggling strategy and storage type, and look for the
+ * throughput cliff */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <CL/cl.h>
+
+#include "error.h"
+#include "verify.h"
+#include "trace.h"
+#include "phases.h"
+#include "overalloc.h"
+#include "schedule.h"
+
+// default oversubscription ratios, relative to CL_DEVICE_GLOBAL_MEM_SIZE
+const char default_ratios[] = "0.25,0.5,0.75,1,1.25,1.5,2,3,4";
+
+#define MAX_RATIOS 64
+double ratio[MAX_RATIOS];
+cl_uint nratios;
+
+// buffers are made small enough that the sweep has a reasonable resolution
+#define BUFS_PER_GMEM 16
+
+// throughput is considered to have fallen off a cliff when it drops below
+// this fraction of the throughput at the first ratio
+#define CLIFF 0.5
+
+// median iteration throughput (GB/s of float elements) for each storage,
+// strategy and ratio, 0 if the run failed
+double median_bw[NUM_STORAGE][NUM_STRATS][MAX_RATIOS];
+
+double signof(double val)
+{
+	return (val > 0) - (val < 0);
+}
+
+int compare_double(const void *_a, const void *_b)
+{
+	const double *a = (const double*)_a;
+	const double *b = (const double*)_b;
+	return signof(*a - *b);
+}
+
+// parse a comma-separated list of ratios
+void parse_ratios(const char *list)
+{
+	char *copy = strdup(list);
+	char *tok = strtok(copy, ",");
+	nratios = 0;
+	while (tok && nratios < MAX_RATIOS) {
+		ratio[nratios] = atof(tok);
+		if (ratio[nratios] <= 0) {
+			fprintf(stderr, "invalid ratio %s\n", tok);
+			exit(1);
+		}
+		++nratios;
+		tok = strtok(NULL, ",");
+	}
+	free(copy);
+}
+
+int main(int argc, char *argv[])
+{
+	// selected platform and device number
+	cl_uint pn = 0, dn = 0;
+
+	// strategies to test
+	int use_strat[NUM_STRATS] = { 1, 1, 1 };
+
+	// storage types to test
+	int use_storage[NUM_STORAGE] = { 1 };
+
+	// buffer access schedule
+	enum schedule_kind sched_kind = SCHED_SEQ;
+	const char *trace_file = NULL;
+
+	// set platform/device num, ratios, strategies, schedule and storage types
+	// from command line
+	if (argc > 1)
+		pn = atoi(argv[1]);
+	if (argc > 2)
+		dn = atoi(argv[2]);
+	parse_ratios(argc > 3 ? argv[3] : default_ratios);
+	if (argc > 4) {
+		memset(use_strat, 0, sizeof(use_strat));
+		for (enum strategy s = 0; s < NUM_STRATS; ++s)
+			use_strat[s] = strstr(argv[4], strategy_name[s]) != NULL;
+	}
+	if (argc > 5)
+		sched_kind = parse_schedule(argv[5], &trace_file);
+	if (argc > 6) {
+		memset(use_storage, 0, sizeof(use_storage));
+		for (enum storage t = 0; t < NUM_STORAGE; ++t)
+			use_storage[t] = strstr(argv[6], storage_name[t]) != NULL;
+	}
+
+	setup(pn, dn);
+
+	size_t size = gmem/BUFS_PER_GMEM;
+	if (size > alloc_max)
+		size = alloc_max;
+	set_buf_size(size);
+
+	printf("will use %zu workitems grouped by %zu to process %u elements per buffer of %gMB\n",
+			gws, wgm, nels, buf_size/MB);
+	printf("buffer access schedule: %s\n", trace_file ? trace_file : schedule_name[sched_kind]);
+
+	for (enum storage t = 0; t < NUM_STORAGE; ++t) {
+		if (!use_storage[t])
+			continue;
+		set_storage(t);
+
+		for (enum strategy s = 0; s < NUM_STRATS; ++s) {
+			if (!use_strat[s])
+				continue;
+
+			for (cl_uint r = 0; r < nratios; ++r) {
+				// buffers needed to cover the given fraction of the device memory
+				// with float elements, and at least two, so that there is something
+				// to add: all storage types process the same number of elements
+				cl_uint nbuf = ratio[r]*gmem/buf_size + 0.5;
+				if (nbuf < 2)
+					nbuf = 2;
+
+				cl_uint nsched;
+				cl_uint *sched = make_schedule(sched_kind, trace_file, 1, nbuf, &nsched);
+
+				struct juggle_stats stats;
+				stats.iter_time = calloc(nsched, sizeof(double));
+				if (!stats.iter_time) {
+					fputs("couldn't allocate timing array\n", stderr);
+					exit(1);
+				}
+
+				printf("== %s, %s, ratio %g: %u buffers, %gMB, %u accesses ==\n",
+					strategy_name[s], storage_name[t], ratio[r], nbuf,
+					(buf_size + (nbuf - 1)*store_size)/MB, nsched);
+
+				const double run_start = now();
+				cl_int err = juggle(s, nbuf, sched, nsched, &stats);
+				snprintf(strbuf, BUFSZ, "%s, %s, ratio %g",
+					strategy_name[s], storage_name[t], ratio[r]);
+				trace_host(strbuf, run_start);
+
+				if (stats.niters > 0) {
+					double total = 0;
+					fputs("iteration GB/s:", stdout);
+					for (cl_uint i = 0; i < stats.niters; ++i) {
+						total += stats.iter_time[i];
+						printf(" %.3g", buf_size/stats.iter_time[i]*1.0e-9);
+					}
+					puts("");
+
+					qsort(stats.iter_time, stats.niters, sizeof(double), compare_double);
+					const double best = stats.iter_time[0];
+					const double med = stats.iter_time[stats.niters/2];
+					const double worst = stats.iter_time[stats.niters - 1];
+					const double avg = total/stats.niters;
+
+					printf("alloc: %gms, iterations: %u, total: %gms\n",
+						stats.alloc_time*1.0e3, stats.niters, total*1.0e3);
+					printf("\tBW (GB/s): best: %8g, median: %8g, worst: %8g, avg: %8g\n",
+						buf_size/best*1.0e-9, buf_size/med*1.0e-9,
+						buf_size/worst*1.0e-9, buf_size/avg*1.0e-9);
+				}
+
+				if (err == CL_SUCCESS) {
+					median_bw[t][s][r] = buf_size/stats.iter_time[stats.niters/2]*1.0e-9;
+				} else {
+					printf("FAILED after %u iterations: %s %d\n", stats.niters,
+						err == JUGGLE_MISMATCH ? "mismatch" : "error", err);
+					median_bw[t][s][r] = 0;
+				}
+
+				free(stats.iter_time);
+				free(sched);
+			}
+		}
+	}
+
+	for (enum storage t = 0; t < NUM_STORAGE; ++t) {
+		if (!use_storage[t])
+			continue;
+
+		printf("Summary for %s storage: median iteration GB/s of float elements "
+			"(relative to the first ratio%s)\n", storage_name[t],
+			t != STORE_FLOAT && use_storage[STORE_FLOAT] ? "; to float storage" : "");
+		fputs("ratio\t", stdout);
+		for (enum strategy s = 0; s < NUM_STRATS; ++s)
+			if (use_strat[s])
+				printf("\t%-16s", strategy_name[s]);
+		puts("");
+		for (cl_uint r = 0; r < nratios; ++r) {
+			printf("%g\t", ratio[r]);
+			for (enum strategy s = 0; s < NUM_STRATS; ++s) {
+				if (!use_strat[s])
+					continue;
+				if (median_bw[t][s][r] > 0) {
+					printf("\t%7.3g (%3.0f%%", median_bw[t][s][r],
+						median_bw[t][s][0] > 0 ? 100*median_bw[t][s][r]/median_bw[t][s][0] : 0);
+					if (t != STORE_FLOAT && median_bw[STORE_FLOAT][s][r] > 0)
+						printf("; %.2fx", median_bw[t][s][r]/median_bw[STORE_FLOAT][s][r]);
+					fputs(")", stdout);
+				} else {
+					printf("\t%-16s", "failed");
+				}
+			}
+			puts("");
+		}
+
+		for (enum strategy s = 0; s < NUM_STRATS; ++s) {
+			if (!use_strat[s])
+				continue;
+			cl_uint r = 1;
+			for (; r < nratios; ++r)
+				if (median_bw[t][s][r] < CLIFF*median_bw[t][s][0])
+					break;
+			if (median_bw[t][s][0] == 0)
+				printf("%s: failed at the first ratio\n", strategy_name[s]);
+			else if (r < nratios)
+				printf("%s: cliff at ratio %g (below %g%% of ratio %g)\n",
+					strategy_name[s], ratio[r], CLIFF*100, ratio[0]);
+			else
+				printf("%s: no cliff up to ratio %g\n",
+					strategy_name[s], ratio[nratios - 1]);
+		}
+	}
+
+	release_kernels();
+	clReleaseProgram(pg);
+	clReleaseCommandQueue(q);
+	clReleaseContext(ctx);
+
+	return 0;
+}
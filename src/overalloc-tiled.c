@@ -0,0 +1,147 @@
+/* Process arrays larger than CL_DEVICE_MAX_MEM_ALLOC_SIZE by splitting
+ * them into tiles, and compare with a single allocation */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <CL/cl.h>
+
+#include "error.h"
+#include "verify.h"
+#include "trace.h"
+#include "phases.h"
+#include "overalloc.h"
+#include "tiled.h"
+
+// number of timed passes per configuration, the best one is reported
+#define NREPS 5
+
+// number of tile sizes tried: alloc_max, alloc_max/2, ...
+#define TILE_SPLITS 4
+
+cl_ulong event_time(cl_event evt, cl_profiling_info what)
+{
+	cl_ulong t;
+	error = clGetEventProfilingInfo(evt, what, sizeof(t), &t, NULL);
+	CHECK_ERROR("getting event profiling info");
+	return t;
+}
+
+/* run add over two tiled arrays of nels elements with the given tile size,
+ * print a table row and return the bandwidth in GB/s, or 0 if the arrays
+ * could not be allocated
+ */
+double run_tiled(const char *name, size_t nels, size_t tile, double base_bw)
+{
+	struct tiled_array dst, src;
+	cl_event *evt;
+	double best = 0, launch = 0;
+	size_t first_bad;
+
+	error = tiled_create(&dst, ctx, CL_MEM_READ_WRITE, nels, tile);
+	if (error == CL_SUCCESS) {
+		error = tiled_create(&src, ctx, CL_MEM_READ_ONLY, nels, tile);
+		if (error != CL_SUCCESS)
+			tiled_release(&dst);
+	}
+	if (error != CL_SUCCESS) {
+		printf("%-6s\t%10.4g\t%6s\tallocation failed (%d)\n", name, tile/MB, "-", error);
+		return 0;
+	}
+
+	evt = calloc(dst.ntiles, sizeof(*evt));
+	if (!evt) {
+		fputs("couldn't allocate events\n", stderr);
+		exit(1);
+	}
+
+	error = tiled_fill(q, &dst, 0);
+	CHECK_ERROR("clearing destination");
+	error = tiled_fill(q, &src, 1);
+	CHECK_ERROR("filling source");
+
+	// one untimed pass to make everything resident
+	for (int rep = 0; rep <= NREPS; ++rep) {
+		const double start = now();
+		error = tiled_run(q, k, wgm, &dst, &src, evt);
+		CHECK_ERROR("running tiles");
+		const double enqueued = now() - start;
+		error = clFinish(q);
+		CHECK_ERROR("finishing");
+
+		// the tiles run in order, so the span is from the start of
+		// the first to the end of the last
+		const cl_ulong span = event_time(evt[dst.ntiles - 1], CL_PROFILING_COMMAND_END) -
+			event_time(evt[0], CL_PROFILING_COMMAND_START);
+		for (cl_uint i = 0; i < dst.ntiles; ++i) {
+			trace_event(evt[i], name);
+			clReleaseEvent(evt[i]);
+		}
+
+		// dst is read and written, src is read
+		const double bw = 3.0*nels*sizeof(cl_float)/span;
+		if (rep > 0 && bw > best) {
+			best = bw;
+			launch = enqueued/dst.ntiles;
+		}
+	}
+
+	if (tiled_check(q, &dst, NREPS + 1, &first_bad)) {
+		fprintf(stderr, "tile size %gMB: mismatch @ %zu\n", tile/MB, first_bad);
+		exit(1);
+	}
+
+	printf("%-6s\t%10.4g\t%6u\t%10.4g\t%10.4g\t%12.4g\n", name, tile/MB, dst.ntiles, best,
+		base_bw ? best/base_bw*100 : 100, launch*1.0e6);
+
+	free(evt);
+	tiled_release(&src);
+	tiled_release(&dst);
+	return best;
+}
+
+int main(int argc, char *argv[])
+{
+	// selected platform and device number
+	cl_uint pn = 0, dn = 0;
+
+	// logical size of each array, bytes
+	size_t size = 0;
+
+	// set platform/device num and size from command line
+	if (argc > 1)
+		pn = atoi(argv[1]);
+	if (argc > 2)
+		dn = atoi(argv[2]);
+	if (argc > 3)
+		size = atof(argv[3])*MB;
+
+	setup(pn, dn);
+
+	// by default, two arrays taking up three quarters of the device memory
+	if (!size)
+		size = gmem/8*3;
+	const size_t nels = size/sizeof(cl_float);
+
+	printf("max allocation %gMB, arrays of %gMB (%zu elements)\n",
+			alloc_max/MB, nels*sizeof(cl_float)/MB, nels);
+
+	puts("layout\ttile (MB)\ttiles\tGB/s\t% of single\tlaunch (us)");
+
+	// baseline: the largest array that fits in a single allocation
+	const size_t base_els = nels*sizeof(cl_float) > alloc_max ?
+		alloc_max/sizeof(cl_float) : nels;
+	const double base_bw = run_tiled("single", base_els, alloc_max, 0);
+
+	for (cl_uint s = 0; s < TILE_SPLITS; ++s)
+		run_tiled("tiled", nels, alloc_max >> s, base_bw);
+
+	release_kernels();
+	clReleaseProgram(pg);
+	clReleaseCommandQueue(q);
+	clReleaseContext(ctx);
+
+	return 0;
+}
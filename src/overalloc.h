@@ -0,0 +1,627 @@
+/* Buffer juggling strategies shared by the overallocation benchmarks.
+ *
+ * Each strategy allocates nbuf buffers of nels elements and fills them
+ * once on the host, then for each buffer in the access schedule (see
+ * schedule.h) adds it on the device to the accumulator buf[0], checking
+ * the result on the host, as overalloc-auto, overalloc-migrate and
+ * overalloc-migrate-copy do with the sequential schedule 1..nbuf-1.
+ * Buffers are not refilled on access, so that data only moves as the
+ * strategy (or, for auto, the platform) decides, and schedules that
+ * reuse buffers can show it.
+ * The accumulator is always float, while the other buffers can be
+ * stored as float, half, or 16- or 8-bit fixed point, and are widened
+ * to float by the kernel: for the same number of elements, the reduced
+ * precision types move and occupy less memory.
+ * Errors are not fatal: the strategy releases what it allocated and
+ * returns the error, so that callers can keep going with a different
+ * configuration.
+ * The transfers and kernels of each access are traced, as well as the
+ * host fill and check (see trace.h).
+ *
+ * Requires error.h, verify.h, trace.h and phases.h (for now()).
+ */
+
+cl_uint np; // number of platforms
+cl_platform_id *platform; // list of platforms ids
+cl_platform_id p; // selected platform
+
+cl_uint nd; // number of devices in the selected platform
+cl_device_id *device; // list of device ids
+cl_device_id d; // selected device
+
+// context property: field 1 (the platform) will be set at runtime
+cl_context_properties ctx_prop[] = { CL_CONTEXT_PLATFORM, 0, 0, 0 };
+cl_context ctx; // context
+cl_command_queue q; // command queue
+
+// generic string retrieval buffer. quick'n'dirty, hence fixed-size
+#define BUFSZ 1024
+char strbuf[BUFSZ];
+
+size_t gmem; // device global memory size
+size_t alloc_max; // max single-buffer-size on device
+size_t buf_size; // size of each float buffer
+size_t store_size; // size of each source buffer with the selected storage
+
+cl_uint nels; // number of elements that fit in each buffer
+
+// storage types for the source buffers
+enum storage {
+	STORE_FLOAT,
+	STORE_HALF, // read with vload_half
+	STORE_SHORT, // fixed point, scaled by SHORT_SCALE
+	STORE_CHAR, // fixed point, scaled by CHAR_SCALE
+	NUM_STORAGE
+};
+
+const char * const storage_name[] = { "float", "half", "short", "char" };
+const size_t storage_size[] = { sizeof(cl_float), sizeof(cl_half), sizeof(cl_short), sizeof(cl_char) };
+
+// fixed point scales: the stored integer is the value times the scale.
+// Source values are at most 15 (see store_value), so the scales are the
+// largest powers of two that keep them in range
+#define SHORT_SCALE 2048
+#define CHAR_SCALE 8
+
+#define STRINGIFY(x) #x
+#define XSTRINGIFY(x) STRINGIFY(x)
+
+enum storage storage; // selected storage
+
+// kernels to force usage of the buffer, one per storage type
+const char *src[] = {
+"kernel void add(global float *dst, global const float *src, uint n) {\n",
+"	uint i = get_global_id(0);\n",
+"	if (i < n) dst[i] += src[i];\n",
+"}\n",
+"kernel void add_half(global float *dst, global const half *src, uint n) {\n",
+"	uint i = get_global_id(0);\n",
+"	if (i < n) dst[i] += vload_half(i, src);\n",
+"}\n",
+"kernel void add_short(global float *dst, global const short *src, uint n) {\n",
+"	uint i = get_global_id(0);\n",
+"	if (i < n) dst[i] += convert_float(src[i])/SHORT_SCALE;\n",
+"}\n",
+"kernel void add_char(global float *dst, global const char *src, uint n) {\n",
+"	uint i = get_global_id(0);\n",
+"	if (i < n) dst[i] += convert_float(src[i])/CHAR_SCALE;\n",
+"}"
+};
+
+const char * const kernel_name[] = { "add", "add_half", "add_short", "add_char" };
+
+cl_program pg; // program
+cl_kernel k; // actual kernel, for the selected storage
+cl_kernel k_store[NUM_STORAGE]; // kernels for each storage
+size_t gws ; // global work size
+size_t wgm ; // preferred workgroup size multiple (will be used as local size too)
+
+// macro to round size to the next multiple of base
+#define ROUND_MUL(size, base) \
+	((size + base - 1)/base)*base
+
+#define MB (1024*1024.0)
+
+// the buffer juggling strategies
+enum strategy {
+	STRAT_AUTO, // let the platform evict buffers as it sees fit
+	STRAT_MIGRATE, // migrate each buffer to the host after use
+	STRAT_COPY, // copy ‘host’ buffers to two ‘device’ buffers
+	NUM_STRATS
+};
+
+const char * const strategy_name[] = { "auto", "migrate", "copy" };
+
+// non-OpenCL failure: the accumulator did not hold the expected value
+#define JUGGLE_MISMATCH 1
+
+// like CHECK_ERROR, but bail out to the cleanup code instead of exiting
+#define CHECK_JUGGLE(what) do { \
+	if (error != CL_SUCCESS) { \
+		fprintf(stderr, "%s:%u: %s : error %d\n", \
+			__func__, __LINE__, what, error);\
+		goto out; \
+	} \
+} while (0)
+
+/* Select platform pn. Platforms older than OpenCL 1.2 are rejected, since
+ * the migrate and copy strategies need it.
+ */
+void select_platform(cl_uint pn)
+{
+	cl_uint ocl_major, ocl_minor;
+
+	error = clGetPlatformIDs(0, NULL, &np);
+	CHECK_ERROR("getting amount of platform IDs");
+	printf("%u platforms found\n", np);
+	if (pn >= np) {
+		fprintf(stderr, "there is no platform #%u\n" , pn);
+		exit(1);
+	}
+	// only allocate for IDs up to the intended one
+	platform = calloc(pn+1,sizeof(*platform));
+	// if allocation failed, next call will bomb. rely on this
+	error = clGetPlatformIDs(pn+1, platform, NULL);
+	CHECK_ERROR("getting platform IDs");
+
+	// choose platform
+	p = platform[pn];
+
+	error = clGetPlatformInfo(p, CL_PLATFORM_NAME, BUFSZ, strbuf, NULL);
+	CHECK_ERROR("getting platform name");
+	printf("using platform %u: %s\n", pn, strbuf);
+
+	error = clGetPlatformInfo(p, CL_PLATFORM_VERSION, BUFSZ, strbuf, NULL);
+	CHECK_ERROR("getting platform version");
+	// we need 1.2 at least
+	if (sscanf(strbuf, "OpenCL %u.%u ", &ocl_major, &ocl_minor) != 2) {
+		fprintf(stderr, "%s:%u: unable to determine platform OpenCL version\n",
+			__func__, __LINE__);
+		exit(1);
+	}
+	if (ocl_major == 1 && ocl_minor < 2) {
+		fprintf(stderr, "%s:%u: Platform version %s is not at least 1.2\n",
+			__func__, __LINE__, strbuf);
+		exit(1);
+	}
+}
+
+// build the program for the given devices of the context, and get the kernels
+void build_program(cl_uint ndev, const cl_device_id *devs)
+{
+	// create program
+	pg = clCreateProgramWithSource(ctx, sizeof(src)/sizeof(*src), src, NULL, &error);
+	CHECK_ERROR("creating program");
+
+	// build program
+	error = clBuildProgram(pg, ndev, devs,
+		"-DSHORT_SCALE=" XSTRINGIFY(SHORT_SCALE) ".0f -DCHAR_SCALE=" XSTRINGIFY(CHAR_SCALE) ".0f",
+		NULL, NULL);
+	CHECK_ERROR("building program");
+
+	// get kernels
+	for (enum storage t = 0; t < NUM_STORAGE; ++t) {
+		k_store[t] = clCreateKernel(pg, kernel_name[t], &error);
+		CHECK_ERROR("creating kernel");
+	}
+	k = k_store[STORE_FLOAT];
+}
+
+/* Select platform pn and device dn, create context and queue, build the
+ * program and get the kernels.
+ */
+void setup(cl_uint pn, cl_uint dn)
+{
+	select_platform(pn);
+
+	error = clGetDeviceIDs(p, CL_DEVICE_TYPE_ALL, 0, NULL, &nd);
+	CHECK_ERROR("getting amount of device IDs");
+	printf("%u devices found\n", nd);
+	if (dn >= nd) {
+		fprintf(stderr, "there is no device #%u\n", dn);
+		exit(1);
+	}
+	// only allocate for IDs up to the intended one
+	device = calloc(dn+1,sizeof(*device));
+	// if allocation failed, next call will bomb. rely on this
+	error = clGetDeviceIDs(p, CL_DEVICE_TYPE_ALL, dn+1, device, NULL);
+	CHECK_ERROR("getting device IDs");
+
+	// choose device
+	d = device[dn];
+	error = clGetDeviceInfo(d, CL_DEVICE_NAME, BUFSZ, strbuf, NULL);
+	CHECK_ERROR("getting device name");
+	printf("using device %u: %s\n", dn, strbuf);
+
+	error = clGetDeviceInfo(d, CL_DEVICE_GLOBAL_MEM_SIZE,
+			sizeof(gmem), &gmem, NULL);
+	CHECK_ERROR("getting device global memory size");
+	error = clGetDeviceInfo(d, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+			sizeof(alloc_max), &alloc_max, NULL);
+	CHECK_ERROR("getting device max memory allocation size");
+
+	// create context
+	ctx_prop[1] = (cl_context_properties)p;
+	ctx = clCreateContext(ctx_prop, 1, &d, NULL, NULL, &error);
+	CHECK_ERROR("creating context");
+
+	// create queue
+	q = clCreateCommandQueue(ctx, d, CL_QUEUE_PROFILING_ENABLE, &error);
+	CHECK_ERROR("creating queue");
+
+	build_program(1, &d);
+
+	error = clGetKernelWorkGroupInfo(k, d, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+			sizeof(wgm), &wgm, NULL);
+	CHECK_ERROR("getting preferred workgroup size multiple");
+}
+
+// set the size of the (float) buffers, and the number of elements and
+// work-items derived from it
+void set_buf_size(size_t size)
+{
+	nels = size/sizeof(cl_float);
+	buf_size = nels*sizeof(cl_float);
+	store_size = nels*storage_size[storage];
+	gws = ROUND_MUL(nels, wgm);
+}
+
+// select the storage type of the source buffers
+void set_storage(enum storage t)
+{
+	storage = t;
+	k = k_store[t];
+	store_size = nels*storage_size[t];
+}
+
+void release_kernels(void)
+{
+	for (enum storage t = 0; t < NUM_STORAGE; ++t)
+		clReleaseKernel(k_store[t]);
+	k = NULL;
+}
+
+// statistics collected by a strategy run
+struct juggle_stats {
+	double alloc_time; // time to allocate all buffers, in seconds
+	cl_uint niters; // number of iterations completed
+	double *iter_time; // wall-clock time of each iteration, in seconds
+};
+
+// value of the elements of source buffer idx, exactly representable in
+// all storage types
+float store_value(cl_uint idx)
+{
+	return idx & 15;
+}
+
+// round a float to half, flushing denormals to zero
+cl_half float_to_half(float f)
+{
+	union { float f; cl_uint u; } v = { f };
+	const cl_ushort sign = (v.u >> 16) & 0x8000;
+	const int exp = (int)((v.u >> 23) & 0xff) - 127 + 15;
+	const cl_uint mant = v.u & 0x7fffff;
+	if (exp <= 0)
+		return sign;
+	if (exp >= 31)
+		return sign | 0x7c00;
+	return sign | (exp << 10) | (mant >> 13);
+}
+
+// fill nbytes at dst with copies of the psize bytes at patt, doubling
+// the filled part at each step
+void fill_pattern(void *dst, size_t nbytes, const void *patt, size_t psize)
+{
+	char *d = dst;
+	size_t done = psize < nbytes ? psize : nbytes;
+	memcpy(d, patt, done);
+	while (done < nbytes) {
+		const size_t n = done < nbytes - done ? done : nbytes - done;
+		memcpy(d + done, d, n);
+		done += n;
+	}
+}
+
+// fill the nels elements of the source buffer at hbuf with val, in the
+// selected storage
+void fill_host(void *hbuf, float val)
+{
+	cl_half h;
+	cl_short sh;
+	cl_char ch;
+
+	switch (storage) {
+	case STORE_FLOAT:
+		par_fill(hbuf, nels, val);
+		break;
+	case STORE_HALF:
+		h = float_to_half(val);
+		fill_pattern(hbuf, store_size, &h, sizeof(h));
+		break;
+	case STORE_SHORT:
+		sh = val*SHORT_SCALE;
+		fill_pattern(hbuf, store_size, &sh, sizeof(sh));
+		break;
+	case STORE_CHAR:
+		ch = val*CHAR_SCALE;
+		fill_pattern(hbuf, store_size, &ch, sizeof(ch));
+		break;
+	default:
+		break;
+	}
+}
+
+// check that the nels floats at hbuf are all equal to expected
+cl_int check_host(const float *hbuf, float expected)
+{
+	size_t first_bad;
+	if (par_check(hbuf, nels, expected, &first_bad)) {
+		fprintf(stderr, "mismatch @ %zu: %g instead of %g\n",
+				first_bad, hbuf[first_bad], expected);
+		return JUGGLE_MISMATCH;
+	}
+	return CL_SUCCESS;
+}
+
+// fill source buffer idx of the selected storage through a map
+cl_int fill_source(cl_mem b, cl_uint idx)
+{
+	void *hbuf = clEnqueueMapBuffer(q, b, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+			0, store_size, 0, NULL, NULL, &error);
+	if (error != CL_SUCCESS)
+		return error;
+	fill_host(hbuf, store_value(idx));
+	return clEnqueueUnmapMemObject(q, b, hbuf, 0, NULL, NULL);
+}
+
+// the auto and migrate strategies only differ by the migration of the
+// buffer used in the previous iteration
+cl_int juggle_inplace(cl_uint nbuf, const cl_uint *sched, cl_uint nsched,
+	int migrate, struct juggle_stats *stats)
+{
+	cl_mem *buf = calloc(nbuf, sizeof(cl_mem));
+	cl_event krn_evt = NULL;
+	// migrations of the previous buffer out and of the current one in,
+	// only requested when tracing
+	cl_event mig_evt[2] = { NULL, NULL };
+	cl_event *mig_ret = trace_enabled() ? mig_evt : NULL;
+	cl_mem mapped = NULL;
+	float *hbuf = NULL;
+	float expected = 0;
+	cl_uint i, prev = 0;
+	double start;
+
+	if (!buf) {
+		fprintf(stderr, "could not prepare support for %u buffers\n", nbuf);
+		return CL_OUT_OF_HOST_MEMORY;
+	}
+
+	stats->niters = 0;
+
+	start = now();
+	for (i = 0; i < nbuf; ++i) {
+		// the accumulator is float, the others use the selected storage
+		buf[i] = clCreateBuffer(ctx, CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_WRITE,
+				i ? store_size : buf_size, NULL, &error);
+		CHECK_JUGGLE("allocating buffer");
+	}
+	stats->alloc_time = now() - start;
+
+	// memset the first buffer
+	hbuf = clEnqueueMapBuffer(q, buf[0], CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+			0, buf_size, 0, NULL, NULL, &error);
+	CHECK_JUGGLE("mapping buffer 0");
+	mapped = buf[0];
+	memset(hbuf, 0, buf_size);
+	error = clEnqueueUnmapMemObject(q, mapped, hbuf, 0, NULL, NULL);
+	CHECK_JUGGLE("unmapping buffer 0");
+	hbuf = NULL;
+
+	// fill the other buffers once; with migrate, they all start on the host
+	start = now();
+	for (i = 1; i < nbuf; ++i) {
+		error = fill_source(buf[i], i);
+		CHECK_JUGGLE("filling buffer");
+		if (migrate) {
+			error = clEnqueueMigrateMemObjects(q, 1, buf + i,
+					CL_MIGRATE_MEM_OBJECT_HOST, 0, NULL, NULL);
+			CHECK_JUGGLE("migrating buffer to host");
+		}
+	}
+	error = clFinish(q);
+	CHECK_JUGGLE("settling down");
+	trace_host("fill", start);
+
+	for (cl_uint s = 0; s < nsched; ++s) {
+		i = sched[s];
+		start = now();
+
+		// migrate previous buffer out of the device, and this one in:
+		// these are the only transfers of the source buffers
+		if (migrate) {
+			if (prev > 0 && prev != i) {
+				error = clEnqueueMigrateMemObjects(q, 1, buf + prev,
+						CL_MIGRATE_MEM_OBJECT_HOST, 0, NULL, mig_ret);
+				CHECK_JUGGLE("migrating previous buffer to host");
+			}
+			error = clEnqueueMigrateMemObjects(q, 1, buf + i, 0, 0, NULL,
+					mig_ret ? mig_ret + 1 : NULL);
+			CHECK_JUGGLE("migrating buffer to device");
+		}
+		error =	clFinish(q);
+		CHECK_JUGGLE("settling down");
+		for (cl_uint m = 0; m < 2; ++m) {
+			if (!mig_evt[m])
+				continue;
+			trace_event(mig_evt[m], m ? "migrate to device" : "migrate to host");
+			clReleaseEvent(mig_evt[m]);
+			mig_evt[m] = NULL;
+		}
+
+		clSetKernelArg(k, 0, sizeof(buf[0]), buf);
+		clSetKernelArg(k, 1, sizeof(buf[i]), buf + i);
+		clSetKernelArg(k, 2, sizeof(nels), &nels);
+		error = clEnqueueNDRangeKernel(q, k, 1, NULL, &gws, &wgm,
+				0, NULL, &krn_evt);
+		CHECK_JUGGLE("enqueueing kernel");
+
+		hbuf = clEnqueueMapBuffer(q, buf[0], CL_TRUE, CL_MAP_READ,
+				0, buf_size, 1, &krn_evt, NULL, &error);
+		CHECK_JUGGLE("mapping buffer 0");
+		mapped = buf[0];
+		trace_event(krn_evt, "add");
+		const double check_start = now();
+		expected += store_value(i);
+		error = check_host(hbuf, expected);
+		if (error != CL_SUCCESS)
+			goto out;
+		trace_host("check", check_start);
+		error = clEnqueueUnmapMemObject(q, mapped, hbuf, 0, NULL, NULL);
+		CHECK_JUGGLE("unmapping buffer 0");
+		hbuf = NULL;
+		clReleaseEvent(krn_evt);
+		krn_evt = NULL;
+		prev = i;
+
+		stats->iter_time[stats->niters++] = now() - start;
+	}
+
+out:
+	if (hbuf)
+		clEnqueueUnmapMemObject(q, mapped, hbuf, 0, NULL, NULL);
+	if (krn_evt)
+		clReleaseEvent(krn_evt);
+	for (i = 0; i < 2; ++i)
+		if (mig_evt[i])
+			clReleaseEvent(mig_evt[i]);
+	clFinish(q);
+	for (i = 0; i < nbuf; ++i)
+		if (buf[i])
+			clReleaseMemObject(buf[i]);
+	free(buf);
+	return error;
+}
+
+cl_int juggle_copy(cl_uint nbuf, const cl_uint *sched, cl_uint nsched,
+	struct juggle_stats *stats)
+{
+	cl_mem *hostbuf = calloc(nbuf, sizeof(cl_mem));
+	cl_mem devbuf[2] = { NULL, NULL };
+	cl_event krn_evt = NULL, mem_evt = NULL;
+	// copy to the device, only requested when tracing
+	cl_event cpy_evt = NULL;
+	cl_mem mapped = NULL;
+	float *hbuf = NULL;
+	const float patt = 0;
+	float expected = 0;
+	cl_uint i;
+	double start;
+
+	if (!hostbuf) {
+		fprintf(stderr, "could not prepare support for %u buffers\n", nbuf);
+		return CL_OUT_OF_HOST_MEMORY;
+	}
+
+	stats->niters = 0;
+
+	start = now();
+	for (i = 0; i < nbuf; ++i) {
+		// hostbuf[0] receives the accumulator, the others use the selected storage
+		hostbuf[i] = clCreateBuffer(ctx, CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_ONLY,
+				i ? store_size : buf_size, NULL, &error);
+		CHECK_JUGGLE("allocating host buffer");
+		error = clEnqueueMigrateMemObjects(q, 1, hostbuf + i,
+				CL_MIGRATE_MEM_OBJECT_HOST | CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED,
+				0, NULL, NULL);
+		CHECK_JUGGLE("migrating buffer to host");
+	}
+	for (i = 0; i < 2; ++i) {
+		devbuf[i] = clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+				i ? store_size : buf_size, NULL, &error);
+		CHECK_JUGGLE("allocating devbuffer");
+	}
+	error = clEnqueueFillBuffer(q, devbuf[0], &patt, sizeof(patt),
+			0, buf_size, 0, NULL, NULL);
+	CHECK_JUGGLE("enqueueing memset");
+	error = clFinish(q);
+	CHECK_JUGGLE("settling down");
+	stats->alloc_time = now() - start;
+
+	// fill the ‘host’ buffers once, the copies are the only transfers
+	start = now();
+	for (i = 1; i < nbuf; ++i) {
+		error = fill_source(hostbuf[i], i);
+		CHECK_JUGGLE("filling buffer");
+	}
+	error = clFinish(q);
+	CHECK_JUGGLE("settling down");
+	trace_host("fill", start);
+
+	for (cl_uint s = 0; s < nsched; ++s) {
+		i = sched[s];
+		start = now();
+
+		// copy ‘host’ to ‘device’ buffer
+		error = clEnqueueCopyBuffer(q, hostbuf[i], devbuf[1], 0, 0, store_size,
+				0, NULL, trace_enabled() ? &cpy_evt : NULL);
+		CHECK_JUGGLE("copying data to device");
+		error =	clFinish(q);
+		CHECK_JUGGLE("settling down");
+		if (cpy_evt) {
+			trace_event(cpy_evt, "copy to device");
+			clReleaseEvent(cpy_evt);
+			cpy_evt = NULL;
+		}
+
+		clSetKernelArg(k, 0, sizeof(cl_mem), devbuf);
+		clSetKernelArg(k, 1, sizeof(cl_mem), devbuf + 1);
+		clSetKernelArg(k, 2, sizeof(nels), &nels);
+		error = clEnqueueNDRangeKernel(q, k, 1, NULL, &gws, &wgm,
+				0, NULL, &krn_evt);
+		CHECK_JUGGLE("enqueueing kernel");
+
+		error = clEnqueueCopyBuffer(q, devbuf[0], hostbuf[0],
+				0, 0, buf_size, 1, &krn_evt, &mem_evt);
+		CHECK_JUGGLE("copying data to host");
+
+		hbuf = clEnqueueMapBuffer(q, hostbuf[0], CL_TRUE, CL_MAP_READ,
+				0, buf_size, 1, &mem_evt, NULL, &error);
+		CHECK_JUGGLE("mapping buffer 0");
+		mapped = hostbuf[0];
+		trace_event(krn_evt, "add");
+		trace_event(mem_evt, "copy to host");
+		const double check_start = now();
+		expected += store_value(i);
+		error = check_host(hbuf, expected);
+		if (error != CL_SUCCESS)
+			goto out;
+		trace_host("check", check_start);
+		error = clEnqueueUnmapMemObject(q, mapped, hbuf, 0, NULL, NULL);
+		CHECK_JUGGLE("unmapping buffer 0");
+		hbuf = NULL;
+		clReleaseEvent(krn_evt);
+		clReleaseEvent(mem_evt);
+		krn_evt = mem_evt = NULL;
+
+		stats->iter_time[stats->niters++] = now() - start;
+	}
+
+out:
+	if (hbuf)
+		clEnqueueUnmapMemObject(q, mapped, hbuf, 0, NULL, NULL);
+	if (krn_evt)
+		clReleaseEvent(krn_evt);
+	if (mem_evt)
+		clReleaseEvent(mem_evt);
+	if (cpy_evt)
+		clReleaseEvent(cpy_evt);
+	clFinish(q);
+	for (i = 0; i < 2; ++i)
+		if (devbuf[i])
+			clReleaseMemObject(devbuf[i]);
+	for (i = 0; i < nbuf; ++i)
+		if (hostbuf[i])
+			clReleaseMemObject(hostbuf[i]);
+	free(hostbuf);
+	return error;
+}
+
+/* Run strategy s over nbuf buffers, using them in the order given by the
+ * nsched entries of sched, which must all be in [1, nbuf): buffer 0 is
+ * the accumulator. stats->iter_time must have room for nsched entries.
+ */
+cl_int juggle(enum strategy s, cl_uint nbuf, const cl_uint *sched, cl_uint nsched,
+	struct juggle_stats *stats)
+{
+	switch (s) {
+	case STRAT_AUTO:
+		return juggle_inplace(nbuf, sched, nsched, 0, stats);
+	case STRAT_MIGRATE:
+		return juggle_inplace(nbuf, sched, nsched, 1, stats);
+	case STRAT_COPY:
+		return juggle_copy(nbuf, sched, nsched, stats);
+	default:
+		return CL_INVALID_VALUE;
+	}
+}
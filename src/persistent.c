@@ -0,0 +1,512 @@
+/* Persistent-kernel work queue vs one launch per task: tiny tasks (scale
+ * and offset a slice of a buffer) run either as one NDRange each, or are
+ * pulled by the work-groups of a single long-running kernel from a queue
+ * fed by the host. Tasks per second and per-task latency are compared for
+ * several task sizes.
+ *
+ * The live queue needs fine-grain SVM buffers with SVM atomics (OpenCL
+ * 2.0), so that host and device see each other's updates while the
+ * kernel runs. On all devices, a batch variant also runs: task
+ * descriptors are written to a mapped buffer and a persistent kernel is
+ * launched to drain them, with work-groups claiming tasks by atomic_inc.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <CL/cl.h>
+
+#include "error.h"
+#include "trace.h"
+#include "phases.h"
+
+cl_uint np; // number of platforms
+cl_platform_id *platform; // list of platforms ids
+cl_platform_id p; // selected platform
+
+cl_uint nd; // number of devices in the selected platform
+cl_device_id *device; // list of device ids
+cl_device_id d; // selected device
+
+// context property: field 1 (the platform) will be set at runtime
+cl_context_properties ctx_prop[] = { CL_CONTEXT_PLATFORM, 0, 0, 0 };
+cl_context ctx; // context
+cl_command_queue q; // command queue
+
+// generic string retrieval buffer. quick'n'dirty, hence fixed-size
+#define BUFSZ 1024
+char strbuf[BUFSZ];
+
+// the task: each one updates a slot of tsize floats of data
+#define TASK_BODY \
+"		global float *s = data + (size_t)slot*tsize;\n" \
+"		for (uint j = lid; j < tsize; j += lsz)\n" \
+"			s[j] = s[j]*0.5f + 1.0f;\n"
+
+const char *src[] = {
+// one launch per task, over (at least) tsize work-items
+"kernel void task(global float *data, uint tsize, uint slot) {\n",
+"	const uint lid = get_global_id(0), lsz = get_global_size(0);\n",
+"	{\n",
+TASK_BODY,
+"	}\n",
+"}\n",
+// persistent kernel over ntasks descriptors (slots) filled by the host
+// before the launch; ctl[0] is the claim counter
+"kernel void batch(global float *data, uint tsize, global const uint *tasks,\n",
+"	uint ntasks, volatile global int *ctl) {\n",
+"	const uint lid = get_local_id(0), lsz = get_local_size(0);\n",
+"	local int id;\n",
+"	for (;;) {\n",
+"		if (lid == 0)\n",
+"			id = atomic_inc(ctl);\n",
+"		barrier(CLK_LOCAL_MEM_FENCE);\n",
+"		const int my = id;\n",
+"		if (my >= (int)ntasks)\n",
+"			return;\n",
+"		const uint slot = tasks[my];\n",
+TASK_BODY,
+"		barrier(CLK_LOCAL_MEM_FENCE);\n",
+"	}\n",
+"}\n"
+};
+
+#ifdef CL_VERSION_2_0
+/* Live persistent kernel: each work-group takes a ticket from ctl[HEAD],
+ * waits until the host has published that many tasks in ctl[TAIL] (or
+ * set ctl[QUIT]), runs the task in slot ticket % nslots and flags
+ * done[ticket]; all in fine-grain SVM with SVM atomics.
+ */
+const char *svm_src[] = {
+"#define CTL_HEAD 0\n", // as in the enum below
+"#define CTL_TAIL 1\n",
+"#define CTL_QUIT 2\n",
+"#define TICKET(what) atomic_load_explicit(what, memory_order_acquire, memory_scope_all_svm_devices)\n",
+"kernel void persistent(global float *data, uint tsize, uint nslots,\n",
+"	global atomic_int *ctl, global atomic_int *done) {\n",
+"	const uint lid = get_local_id(0), lsz = get_local_size(0);\n",
+"	local int id;\n",
+"	for (;;) {\n",
+"		if (lid == 0) {\n",
+"			id = atomic_fetch_add_explicit(ctl + CTL_HEAD, 1,\n",
+"				memory_order_relaxed, memory_scope_all_svm_devices);\n",
+"			while (id >= TICKET(ctl + CTL_TAIL))\n",
+"				if (TICKET(ctl + CTL_QUIT)) {\n",
+"					id = -1;\n",
+"					break;\n",
+"				}\n",
+"		}\n",
+"		work_group_barrier(CLK_LOCAL_MEM_FENCE);\n",
+"		const int my = id;\n",
+"		if (my < 0)\n",
+"			return;\n",
+"		const uint slot = my % nslots;\n",
+TASK_BODY,
+"		work_group_barrier(CLK_GLOBAL_MEM_FENCE);\n",
+"		if (lid == 0)\n",
+"			atomic_store_explicit(done + my, 1,\n",
+"				memory_order_release, memory_scope_all_svm_devices);\n",
+"		work_group_barrier(CLK_LOCAL_MEM_FENCE);\n",
+"	}\n",
+"}\n"
+};
+#endif
+
+// control words of the live queue, also defined in svm_src
+enum { CTL_HEAD, CTL_TAIL, CTL_QUIT, NUM_CTL };
+
+cl_program pg, svm_pg; // programs
+cl_kernel k_task, k_batch, k_persistent; // actual kernels
+size_t lws; // local work size, the preferred workgroup size multiple
+cl_uint ncu; // compute units: number of persistent work-groups
+int have_svm; // whether the device has fine-grain SVM buffers with atomics
+
+// task sizes, in floats
+const cl_uint task_sizes[] = { 1, 16, 256, 4096, 65536 };
+#define NUM_SIZES (sizeof(task_sizes)/sizeof(*task_sizes))
+#define MAX_TASK_SIZE 65536
+
+// tasks cycle over this many slots of the data buffer
+#define NSLOTS 64
+
+// tasks for the throughput runs, and one at a time for the latency runs
+#define NTASKS 10000
+#define NLAT 1000
+
+// give up waiting for the persistent kernel after this long, seconds:
+// the device may not run it concurrently with the host
+#define STALL_TIMEOUT 10.0
+
+cl_mem data; // NSLOTS*MAX_TASK_SIZE floats
+
+// results of a mode, for a task size; 0 when not run
+struct result {
+	double tasks_s; // throughput
+	double lat_us[2]; // per-task latency: p50, p99
+};
+
+enum mode { MODE_LAUNCH, MODE_PERSISTENT, MODE_BATCH, NUM_MODES };
+const char * const mode_name[] = {
+	"launch per task", "persistent (SVM)", "batch (mapped)"
+};
+
+int compare_double(const void *_a, const void *_b)
+{
+	const double a = *(const double*)_a;
+	const double b = *(const double*)_b;
+	return (a > b) - (a < b);
+}
+
+// sort the latency samples and store p50 and p99 in r, in us
+void latency_stats(double *sample, cl_uint n, struct result *r)
+{
+	qsort(sample, n, sizeof(*sample), compare_double);
+	r->lat_us[0] = sample[n/2]*1.0e6;
+	r->lat_us[1] = sample[n*99/100]*1.0e6;
+}
+
+void launch_task(cl_uint tsize, cl_uint slot)
+{
+	const size_t gws = ((tsize + lws - 1)/lws)*lws;
+	clSetKernelArg(k_task, 2, sizeof(slot), &slot);
+	error = clEnqueueNDRangeKernel(q, k_task, 1, NULL, &gws, &lws, 0, NULL, NULL);
+	CHECK_ERROR("enqueueing task");
+}
+
+// one NDRange per task
+void run_launch(cl_uint tsize, struct result *r, double *sample)
+{
+	clSetKernelArg(k_task, 0, sizeof(data), &data);
+	clSetKernelArg(k_task, 1, sizeof(tsize), &tsize);
+
+	double start = now();
+	for (cl_uint t = 0; t < NTASKS; ++t)
+		launch_task(tsize, t % NSLOTS);
+	error = clFinish(q);
+	CHECK_ERROR("finishing tasks");
+	r->tasks_s = NTASKS/(now() - start);
+	trace_host("launch throughput", start);
+
+	for (cl_uint t = 0; t < NLAT; ++t) {
+		start = now();
+		launch_task(tsize, t % NSLOTS);
+		error = clFinish(q);
+		CHECK_ERROR("finishing task");
+		sample[t] = now() - start;
+	}
+	latency_stats(sample, NLAT, r);
+}
+
+// descriptors in a mapped buffer, drained by a persistent kernel
+void run_batch(cl_uint tsize, struct result *r)
+{
+	const cl_uint ntasks = NTASKS;
+	const size_t gws = ncu*lws;
+	const cl_int zero = 0;
+
+	cl_mem tasks = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR,
+		NTASKS*sizeof(cl_uint), NULL, &error);
+	CHECK_ERROR("allocating task descriptors");
+	cl_mem ctl = clCreateBuffer(ctx, CL_MEM_READ_WRITE, sizeof(cl_int), NULL, &error);
+	CHECK_ERROR("allocating claim counter");
+
+	// the timed part includes feeding the descriptors
+	const double start = now();
+	cl_uint *desc = clEnqueueMapBuffer(q, tasks, CL_TRUE, CL_MAP_WRITE, 0,
+		NTASKS*sizeof(cl_uint), 0, NULL, NULL, &error);
+	CHECK_ERROR("mapping task descriptors");
+	for (cl_uint t = 0; t < NTASKS; ++t)
+		desc[t] = t % NSLOTS;
+	error = clEnqueueUnmapMemObject(q, tasks, desc, 0, NULL, NULL);
+	CHECK_ERROR("unmapping task descriptors");
+	error = clEnqueueFillBuffer(q, ctl, &zero, sizeof(zero), 0, sizeof(zero), 0, NULL, NULL);
+	CHECK_ERROR("clearing claim counter");
+
+	clSetKernelArg(k_batch, 0, sizeof(data), &data);
+	clSetKernelArg(k_batch, 1, sizeof(tsize), &tsize);
+	clSetKernelArg(k_batch, 2, sizeof(tasks), &tasks);
+	clSetKernelArg(k_batch, 3, sizeof(ntasks), &ntasks);
+	clSetKernelArg(k_batch, 4, sizeof(ctl), &ctl);
+	error = clEnqueueNDRangeKernel(q, k_batch, 1, NULL, &gws, &lws, 0, NULL, NULL);
+	CHECK_ERROR("enqueueing batch");
+	error = clFinish(q);
+	CHECK_ERROR("finishing batch");
+	r->tasks_s = NTASKS/(now() - start);
+	trace_host("batch", start);
+
+	clReleaseMemObject(ctl);
+	clReleaseMemObject(tasks);
+}
+
+#ifdef CL_VERSION_2_0
+int *svm_ctl, *svm_done; // control words and done flags, in fine-grain SVM
+
+// wait for done[t], returning 0 if the kernel makes no progress
+int wait_done(cl_uint t)
+{
+	const double start = now();
+	while (!__atomic_load_n(svm_done + t, __ATOMIC_ACQUIRE))
+		if (now() - start > STALL_TIMEOUT)
+			return 0;
+	return 1;
+}
+
+void publish(cl_uint ntasks)
+{
+	__atomic_store_n(svm_ctl + CTL_TAIL, (int)ntasks, __ATOMIC_RELEASE);
+}
+
+// the live queue: a persistent kernel fed through fine-grain SVM
+void run_persistent(cl_uint tsize, struct result *r, double *sample)
+{
+	const size_t gws = ncu*lws;
+	const cl_uint nslots = NSLOTS;
+	cl_event evt;
+	int ok = 1;
+
+	memset(svm_ctl, 0, NUM_CTL*sizeof(*svm_ctl));
+	memset(svm_done, 0, (NTASKS + NLAT + 1)*sizeof(*svm_done));
+
+	clSetKernelArg(k_persistent, 0, sizeof(data), &data);
+	clSetKernelArg(k_persistent, 1, sizeof(tsize), &tsize);
+	clSetKernelArg(k_persistent, 2, sizeof(nslots), &nslots);
+	clSetKernelArgSVMPointer(k_persistent, 3, svm_ctl);
+	clSetKernelArgSVMPointer(k_persistent, 4, svm_done);
+	error = clEnqueueNDRangeKernel(q, k_persistent, 1, NULL, &gws, &lws, 0, NULL, &evt);
+	CHECK_ERROR("enqueueing persistent kernel");
+	clFlush(q);
+
+	// a first task, to wait for the kernel to start
+	double start = now();
+	publish(1);
+	ok = wait_done(0);
+	if (ok)
+		printf("\tpersistent kernel started in %gus\n", (now() - start)*1.0e6);
+
+	// all tasks at once
+	start = now();
+	publish(1 + NTASKS);
+	for (cl_uint t = 1; ok && t <= NTASKS; ++t)
+		ok = wait_done(t);
+	r->tasks_s = ok ? NTASKS/(now() - start) : 0;
+
+	// one at a time
+	for (cl_uint t = 0; ok && t < NLAT; ++t) {
+		start = now();
+		publish(2 + NTASKS + t);
+		ok = wait_done(1 + NTASKS + t);
+		sample[t] = now() - start;
+	}
+	if (ok)
+		latency_stats(sample, NLAT, r);
+	else
+		puts("\tpersistent kernel stalled: the device doesn't run it alongside the host");
+
+	__atomic_store_n(svm_ctl + CTL_QUIT, 1, __ATOMIC_RELEASE);
+	error = clWaitForEvents(1, &evt);
+	CHECK_ERROR("waiting for persistent kernel");
+	trace_event(evt, "persistent");
+	clReleaseEvent(evt);
+}
+#endif
+
+// build a program, printing the build log on failure
+cl_program build(const char **source, cl_uint nlines, const char *options)
+{
+	cl_program bpg = clCreateProgramWithSource(ctx, nlines, source, NULL, &error);
+	CHECK_ERROR("creating program");
+	error = clBuildProgram(bpg, 1, &d, options, NULL, NULL);
+	if (error == CL_BUILD_PROGRAM_FAILURE) {
+		error = clGetProgramBuildInfo(bpg, d, CL_PROGRAM_BUILD_LOG,
+			BUFSZ, strbuf, NULL);
+		CHECK_ERROR("get program build info");
+		printf("=== BUILD LOG ===\n%s\n=========\n", strbuf);
+		error = CL_BUILD_PROGRAM_FAILURE;
+	}
+	CHECK_ERROR("building program");
+	return bpg;
+}
+
+int main(int argc, char *argv[])
+{
+	// selected platform and device number
+	cl_uint pn = 0, dn = 0;
+	cl_uint dev_major = 1;
+
+	// set platform/device num from command line
+	if (argc > 1)
+		pn = atoi(argv[1]);
+	if (argc > 2)
+		dn = atoi(argv[2]);
+
+	error = clGetPlatformIDs(0, NULL, &np);
+	CHECK_ERROR("getting amount of platform IDs");
+	printf("%u platforms found\n", np);
+	if (pn >= np) {
+		fprintf(stderr, "there is no platform #%u\n" , pn);
+		exit(1);
+	}
+	// only allocate for IDs up to the intended one
+	platform = calloc(pn+1,sizeof(*platform));
+	// if allocation failed, next call will bomb. rely on this
+	error = clGetPlatformIDs(pn+1, platform, NULL);
+	CHECK_ERROR("getting platform IDs");
+
+	// choose platform
+	p = platform[pn];
+
+	error = clGetPlatformInfo(p, CL_PLATFORM_NAME, BUFSZ, strbuf, NULL);
+	CHECK_ERROR("getting platform name");
+	printf("using platform %u: %s\n", pn, strbuf);
+
+	error = clGetDeviceIDs(p, CL_DEVICE_TYPE_ALL, 0, NULL, &nd);
+	CHECK_ERROR("getting amount of device IDs");
+	printf("%u devices found\n", nd);
+	if (dn >= nd) {
+		fprintf(stderr, "there is no device #%u\n", dn);
+		exit(1);
+	}
+	// only allocate for IDs up to the intended one
+	device = calloc(dn+1,sizeof(*device));
+	// if allocation failed, next call will bomb. rely on this
+	error = clGetDeviceIDs(p, CL_DEVICE_TYPE_ALL, dn+1, device, NULL);
+	CHECK_ERROR("getting device IDs");
+
+	// choose device
+	d = device[dn];
+	error = clGetDeviceInfo(d, CL_DEVICE_NAME, BUFSZ, strbuf, NULL);
+	CHECK_ERROR("getting device name");
+	printf("using device %u: %s\n", dn, strbuf);
+
+	error = clGetDeviceInfo(d, CL_DEVICE_MAX_COMPUTE_UNITS,
+			sizeof(ncu), &ncu, NULL);
+	CHECK_ERROR("getting device compute units");
+	error = clGetDeviceInfo(d, CL_DEVICE_VERSION, BUFSZ, strbuf, NULL);
+	CHECK_ERROR("getting device version");
+	sscanf(strbuf, "OpenCL %u", &dev_major);
+#ifdef CL_VERSION_2_0
+	cl_device_svm_capabilities svm_caps = 0;
+	if (dev_major >= 2 && clGetDeviceInfo(d, CL_DEVICE_SVM_CAPABILITIES,
+			sizeof(svm_caps), &svm_caps, NULL) != CL_SUCCESS)
+		svm_caps = 0;
+	have_svm = (svm_caps & CL_DEVICE_SVM_FINE_GRAIN_BUFFER) && (svm_caps & CL_DEVICE_SVM_ATOMICS);
+#endif
+	if (!have_svm)
+		puts("no fine-grain SVM buffers with atomics: the live persistent queue is skipped");
+
+	// create context
+	ctx_prop[1] = (cl_context_properties)p;
+	ctx = clCreateContext(ctx_prop, 1, &d, NULL, NULL, &error);
+	CHECK_ERROR("creating context");
+
+	// create queue
+	q = clCreateCommandQueue(ctx, d, CL_QUEUE_PROFILING_ENABLE, &error);
+	CHECK_ERROR("creating queue");
+
+	pg = build(src, sizeof(src)/sizeof(*src), NULL);
+	k_task = clCreateKernel(pg, "task", &error);
+	CHECK_ERROR("creating kernel task");
+	k_batch = clCreateKernel(pg, "batch", &error);
+	CHECK_ERROR("creating kernel batch");
+
+	error = clGetKernelWorkGroupInfo(k_task, d, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+			sizeof(lws), &lws, NULL);
+	CHECK_ERROR("getting preferred workgroup size multiple");
+
+#ifdef CL_VERSION_2_0
+	if (have_svm) {
+		svm_pg = build(svm_src, sizeof(svm_src)/sizeof(*svm_src), "-cl-std=CL2.0");
+		k_persistent = clCreateKernel(svm_pg, "persistent", &error);
+		CHECK_ERROR("creating kernel persistent");
+		const cl_svm_mem_flags svm_flags = CL_MEM_READ_WRITE |
+			CL_MEM_SVM_FINE_GRAIN_BUFFER | CL_MEM_SVM_ATOMICS;
+		svm_ctl = clSVMAlloc(ctx, svm_flags, NUM_CTL*sizeof(*svm_ctl), 0);
+		svm_done = clSVMAlloc(ctx, svm_flags, (NTASKS + NLAT + 1)*sizeof(*svm_done), 0);
+		if (!svm_ctl || !svm_done) {
+			fputs("couldn't allocate SVM control words\n", stderr);
+			exit(1);
+		}
+	}
+#endif
+
+	const float zero = 0;
+	data = clCreateBuffer(ctx, CL_MEM_READ_WRITE, NSLOTS*MAX_TASK_SIZE*sizeof(cl_float),
+		NULL, &error);
+	CHECK_ERROR("allocating data buffer");
+	error = clEnqueueFillBuffer(q, data, &zero, sizeof(zero), 0,
+		NSLOTS*MAX_TASK_SIZE*sizeof(cl_float), 0, NULL, NULL);
+	CHECK_ERROR("clearing data buffer");
+
+	printf("%u tasks for throughput, %u one at a time for latency; "
+		"%u persistent work-groups of %zu work-items\n",
+		NTASKS, NLAT, ncu, lws);
+
+	double *sample = calloc(NLAT, sizeof(*sample));
+	struct result res[NUM_SIZES][NUM_MODES];
+	if (!sample) {
+		fputs("couldn't allocate timing array\n", stderr);
+		exit(1);
+	}
+	memset(res, 0, sizeof(res));
+
+	for (size_t s = 0; s < NUM_SIZES; ++s) {
+		const cl_uint tsize = task_sizes[s];
+		printf("== tasks of %u floats ==\n", tsize);
+
+		run_launch(tsize, res[s] + MODE_LAUNCH, sample);
+#ifdef CL_VERSION_2_0
+		if (have_svm)
+			run_persistent(tsize, res[s] + MODE_PERSISTENT, sample);
+#endif
+		run_batch(tsize, res[s] + MODE_BATCH);
+
+		for (enum mode m = 0; m < NUM_MODES; ++m) {
+			const struct result *r = res[s] + m;
+			if (!r->tasks_s)
+				continue;
+			printf("%s:\t%g tasks/s", mode_name[m], r->tasks_s);
+			if (r->lat_us[0])
+				printf(", latency p50 %gus, p99 %gus", r->lat_us[0], r->lat_us[1]);
+			puts("");
+		}
+	}
+
+	puts("Summary (vs launch per task):");
+	puts("floats\tlaunch tasks/s\tpersistent x\tbatch x\tlaunch p50 us\tpersistent p50 us");
+	for (size_t s = 0; s < NUM_SIZES; ++s) {
+		const struct result *r = res[s];
+		printf("%u\t%g\t", task_sizes[s], r[MODE_LAUNCH].tasks_s);
+		if (r[MODE_PERSISTENT].tasks_s)
+			printf("%.3g\t", r[MODE_PERSISTENT].tasks_s/r[MODE_LAUNCH].tasks_s);
+		else
+			printf("-\t");
+		printf("%.3g\t%g\t", r[MODE_BATCH].tasks_s/r[MODE_LAUNCH].tasks_s,
+			r[MODE_LAUNCH].lat_us[0]);
+		if (r[MODE_PERSISTENT].lat_us[0])
+			printf("%g\n", r[MODE_PERSISTENT].lat_us[0]);
+		else
+			puts("-");
+	}
+
+	free(sample);
+#ifdef CL_VERSION_2_0
+	if (have_svm) {
+		clSVMFree(ctx, svm_done);
+		clSVMFree(ctx, svm_ctl);
+		clReleaseKernel(k_persistent);
+		clReleaseProgram(svm_pg);
+	}
+#endif
+	clReleaseMemObject(data);
+	clReleaseKernel(k_batch);
+	clReleaseKernel(k_task);
+	clReleaseProgram(pg);
+	clReleaseCommandQueue(q);
+	clReleaseContext(ctx);
+	free(device);
+	free(platform);
+
+	return 0;
+}
@@ -0,0 +1,132 @@
+/* Per-phase timing for the overallocation tests.
+ *
+ * Each phase of a test iteration (mapping, filling, migrating, running
+ * the kernel, ...) accumulates the host wall-clock time spent in the
+ * API calls and, when there is an associated event, the device time
+ * between its START and END. Iteration times are reported and then
+ * added to the totals, so that it's possible to see which phase absorbs
+ * the eviction cost when memory is overcommitted.
+ *
+ * Both are also written to the timeline trace, when enabled.
+ *
+ * Requires error.h and trace.h; the including file must define
+ * _POSIX_C_SOURCE for clock_gettime, and queues must have profiling
+ * enabled.
+ */
+
+#include <time.h>
+
+enum phase {
+	PH_ALLOC, // buffer allocation
+	PH_MAP, // mapping for the fill
+	PH_FILL, // filling, on the host or the device
+	PH_UNMAP, // unmapping after the fill
+	PH_MIGRATE, // memory object migration
+	PH_COPY, // buffer copies
+	PH_KERNEL, // the actual kernel
+	PH_VERIFY, // mapping and checking the result
+	NUM_PHASES
+};
+
+const char * const phase_name[] = {
+	"alloc", "map", "fill", "unmap", "migrate", "copy", "kernel", "verify"
+};
+
+struct phase_times {
+	double host[NUM_PHASES]; // host wall-clock, ms
+	double dev[NUM_PHASES]; // device START to END, ms
+	cl_uint nevt[NUM_PHASES]; // number of events contributing to dev
+};
+
+struct phase_times iter_times, total_times;
+cl_uint phase_iters; // number of iterations added to total_times
+
+// host wall-clock time in seconds
+double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1.0e-9;
+}
+
+// account the host time since start (from now()) to phase ph
+void phase_host(enum phase ph, double start)
+{
+	iter_times.host[ph] += (now() - start)*1.0e3;
+	trace_host(phase_name[ph], start);
+}
+
+// account the device time of the completed command evt to phase ph,
+// and release the event
+void phase_event(enum phase ph, cl_event evt)
+{
+	cl_ulong start, end;
+	error = clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_START,
+		sizeof(start), &start, NULL);
+	CHECK_ERROR("get start");
+	error = clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_END,
+		sizeof(end), &end, NULL);
+	CHECK_ERROR("get end");
+	iter_times.dev[ph] += (end - start)*1.0e-6;
+	++iter_times.nevt[ph];
+	trace_event(evt, phase_name[ph]);
+	clReleaseEvent(evt);
+}
+
+void phase_print(const struct phase_times *t, double scale)
+{
+	for (enum phase ph = 0; ph < NUM_PHASES; ++ph) {
+		if (t->host[ph] == 0 && !t->nevt[ph])
+			continue;
+		printf(" %s %.4g", phase_name[ph], t->host[ph]*scale);
+		if (t->nevt[ph])
+			printf("/%.4g", t->dev[ph]*scale);
+	}
+	puts("");
+}
+
+// report the times of the iteration, add them to the totals and reset them
+void phase_iter_done(const char *label)
+{
+	printf("%s times (ms, host/device):", label);
+	phase_print(&iter_times, 1);
+	for (enum phase ph = 0; ph < NUM_PHASES; ++ph) {
+		total_times.host[ph] += iter_times.host[ph];
+		total_times.dev[ph] += iter_times.dev[ph];
+		total_times.nevt[ph] += iter_times.nevt[ph];
+	}
+	++phase_iters;
+	memset(&iter_times, 0, sizeof(iter_times));
+}
+
+// clear all times, for a new test in the same process
+void phase_reset(void)
+{
+	memset(&iter_times, 0, sizeof(iter_times));
+	memset(&total_times, 0, sizeof(total_times));
+	phase_iters = 0;
+}
+
+void phase_report(void)
+{
+	double host = 0, dev = 0;
+
+	puts("phase\ttotal host (ms)\ttotal device (ms)\tavg host (ms)\tavg device (ms)");
+	for (enum phase ph = 0; ph < NUM_PHASES; ++ph) {
+		// allocation happens once, not per iteration
+		const cl_uint n = ph == PH_ALLOC || !phase_iters ? 1 : phase_iters;
+		host += total_times.host[ph];
+		dev += total_times.dev[ph];
+		printf("%s\t%15.6g\t", phase_name[ph], total_times.host[ph]);
+		if (total_times.nevt[ph])
+			printf("%17.6g\t", total_times.dev[ph]);
+		else
+			printf("%17s\t", "-");
+		printf("%13.6g\t", total_times.host[ph]/n);
+		if (total_times.nevt[ph])
+			printf("%14.6g\n", total_times.dev[ph]/n);
+		else
+			printf("%14s\n", "-");
+	}
+	printf("all\t%15.6g\t%17.6g\n", host, dev);
+}
@@ -0,0 +1,260 @@
+/* Explicit device residency manager.
+ *
+ * Keeps track of which of a set of buffers are believed to be resident
+ * on the device, and issues clEnqueueMigrateMemObjects on its own queue
+ * to bring buffers in before they are used and push them out when room
+ * is needed, according to a pluggable policy. The buffers must be used
+ * in the order given by the access schedule: each use is bracketed by
+ * residency_acquire(), which returns the event the kernel should wait
+ * for, and residency_release(), which takes the event of the kernel,
+ * so that a buffer is never evicted while still in use.
+ *
+ * Migrations are only hints to the platform, so all of this reflects
+ * what we believe, not necessarily what happens. They are deferred to
+ * the trace (see trace.h, which must be included first), to be traced
+ * at the next trace_flush().
+ */
+
+enum residency_policy {
+	RES_NONE, // no hints at all, let the platform do its thing
+	RES_EVICT, // migrate each buffer back to the host right after use
+	RES_LRU, // evict the least recently used buffer when full
+	RES_LOOKAHEAD, // evict the buffer used furthest in the future, prefetch the next ones
+	NUM_RES_POLICIES
+};
+
+const char * const residency_policy_name[] = {
+	"none", "evict", "lru", "lookahead"
+};
+
+struct residency {
+	enum residency_policy policy;
+	cl_command_queue mq; // queue for migrations
+
+	cl_uint nbuf; // number of managed buffers
+	const cl_mem *buf; // managed buffers
+	size_t buf_size; // size of each managed buffer
+	cl_uint capacity; // number of buffers that fit on the device
+
+	const cl_uint *sched; // access schedule
+	cl_uint nsched; // length of the access schedule
+	cl_uint pos; // current position in the access schedule
+	cl_uint lookahead; // how many schedule entries to prefetch
+
+	cl_uint nresident; // number of buffers believed resident
+	char *resident; // whether each buffer is believed resident
+	cl_ulong *last_use; // LRU timestamp of each buffer
+	cl_event *ready; // last migration of each buffer to the device
+	cl_event *busy; // last kernel using each buffer
+
+	// statistics
+	cl_uint nfetch, nevict;
+	size_t bytes_to_device, bytes_to_host;
+};
+
+cl_int residency_init(struct residency *r, enum residency_policy policy,
+	cl_command_queue mq, const cl_mem *buf, cl_uint nbuf, size_t buf_size,
+	cl_uint capacity, const cl_uint *sched, cl_uint nsched, cl_uint lookahead)
+{
+	memset(r, 0, sizeof(*r));
+	r->policy = policy;
+	r->mq = mq;
+	r->buf = buf;
+	r->nbuf = nbuf;
+	r->buf_size = buf_size;
+	r->capacity = capacity ? capacity : 1;
+	r->sched = sched;
+	r->nsched = nsched;
+	r->lookahead = lookahead;
+
+	r->resident = calloc(nbuf, sizeof(*r->resident));
+	r->last_use = calloc(nbuf, sizeof(*r->last_use));
+	r->ready = calloc(nbuf, sizeof(*r->ready));
+	r->busy = calloc(nbuf, sizeof(*r->busy));
+	if (!r->resident || !r->last_use || !r->ready || !r->busy)
+		return CL_OUT_OF_HOST_MEMORY;
+	return CL_SUCCESS;
+}
+
+void residency_release_events(cl_event *evt, cl_uint n)
+{
+	for (cl_uint i = 0; i < n; ++i)
+		if (evt[i]) {
+			clReleaseEvent(evt[i]);
+			evt[i] = NULL;
+		}
+}
+
+void residency_destroy(struct residency *r)
+{
+	if (r->ready)
+		residency_release_events(r->ready, r->nbuf);
+	if (r->busy)
+		residency_release_events(r->busy, r->nbuf);
+	free(r->resident);
+	free(r->last_use);
+	free(r->ready);
+	free(r->busy);
+	memset(r, 0, sizeof(*r));
+}
+
+// position of the next use of buffer idx in the schedule at or after from,
+// or nsched if it is not used anymore
+cl_uint residency_next_use(const struct residency *r, cl_uint idx, cl_uint from)
+{
+	for (cl_uint s = from; s < r->nsched; ++s)
+		if (r->sched[s] == idx)
+			return s;
+	return r->nsched;
+}
+
+cl_int residency_fetch(struct residency *r, cl_uint idx)
+{
+	if (r->ready[idx]) {
+		clReleaseEvent(r->ready[idx]);
+		r->ready[idx] = NULL;
+	}
+	cl_int err = clEnqueueMigrateMemObjects(r->mq, 1, r->buf + idx, 0,
+		0, NULL, r->ready + idx);
+	if (err != CL_SUCCESS)
+		return err;
+	trace_defer(r->ready[idx], "fetch");
+	r->resident[idx] = 1;
+	++r->nresident;
+	++r->nfetch;
+	r->bytes_to_device += r->buf_size;
+	return CL_SUCCESS;
+}
+
+cl_int residency_evict(struct residency *r, cl_uint idx)
+{
+	// only get an event if it is going to be traced
+	cl_event evt = NULL;
+
+	// don't pull the buffer from under a kernel that is still using it
+	cl_int err = clEnqueueMigrateMemObjects(r->mq, 1, r->buf + idx,
+		CL_MIGRATE_MEM_OBJECT_HOST, r->busy[idx] != NULL,
+		r->busy[idx] ? r->busy + idx : NULL, trace_enabled() ? &evt : NULL);
+	if (err != CL_SUCCESS)
+		return err;
+	if (evt) {
+		trace_defer(evt, "evict");
+		clReleaseEvent(evt);
+	}
+	r->resident[idx] = 0;
+	--r->nresident;
+	++r->nevict;
+	r->bytes_to_host += r->buf_size;
+	return CL_SUCCESS;
+}
+
+/* choose a resident buffer to evict, other than keep. For the lookahead
+ * policy, *next is set to the schedule position of the next use of the
+ * victim, so that the caller can decide whether the eviction is worth it.
+ * Returns nbuf if there is no candidate.
+ */
+cl_uint residency_victim(const struct residency *r, cl_uint keep, cl_uint *next)
+{
+	cl_uint victim = r->nbuf;
+	cl_ulong oldest = ~(cl_ulong)0;
+	cl_uint furthest = 0;
+
+	for (cl_uint i = 0; i < r->nbuf; ++i) {
+		if (!r->resident[i] || i == keep)
+			continue;
+		if (r->policy == RES_LOOKAHEAD) {
+			cl_uint n = residency_next_use(r, i, r->pos + 1);
+			if (victim == r->nbuf || n > furthest) {
+				victim = i;
+				furthest = n;
+			}
+		} else if (r->last_use[i] < oldest) {
+			victim = i;
+			oldest = r->last_use[i];
+		}
+	}
+	if (next)
+		*next = furthest;
+	return victim;
+}
+
+// make room for one more buffer, keeping keep
+cl_int residency_make_room(struct residency *r, cl_uint keep)
+{
+	while (r->nresident >= r->capacity) {
+		cl_uint victim = residency_victim(r, keep, NULL);
+		if (victim == r->nbuf)
+			break;
+		cl_int err = residency_evict(r, victim);
+		if (err != CL_SUCCESS)
+			return err;
+	}
+	return CL_SUCCESS;
+}
+
+/* Buffer idx is about to be used, at the current position in the schedule.
+ * *wait is set to the event the user of the buffer should wait for, or NULL.
+ */
+cl_int residency_acquire(struct residency *r, cl_uint idx, cl_event *wait)
+{
+	cl_int err = CL_SUCCESS;
+
+	*wait = NULL;
+	r->last_use[idx] = r->pos + 1;
+
+	if (r->policy == RES_NONE)
+		goto done;
+
+	if (!r->resident[idx]) {
+		err = residency_make_room(r, idx);
+		if (err == CL_SUCCESS)
+			err = residency_fetch(r, idx);
+		if (err != CL_SUCCESS)
+			return err;
+	}
+	*wait = r->ready[idx];
+
+	if (r->policy == RES_LOOKAHEAD) {
+		// prefetch the upcoming buffers, but only evicting buffers
+		// that are needed later than the one we are bringing in
+		for (cl_uint s = r->pos + 1; s <= r->pos + r->lookahead && s < r->nsched; ++s) {
+			const cl_uint b = r->sched[s];
+			if (r->resident[b])
+				continue;
+			if (r->nresident >= r->capacity) {
+				cl_uint next;
+				cl_uint victim = residency_victim(r, idx, &next);
+				if (victim == r->nbuf || next <= s)
+					break;
+				err = residency_evict(r, victim);
+				if (err != CL_SUCCESS)
+					return err;
+			}
+			err = residency_fetch(r, b);
+			if (err != CL_SUCCESS)
+				return err;
+		}
+	}
+
+	clFlush(r->mq);
+done:
+	++r->pos;
+	return err;
+}
+
+/* The use of buffer idx was enqueued, and will be completed when evt is */
+cl_int residency_release(struct residency *r, cl_uint idx, cl_event evt)
+{
+	if (r->busy[idx])
+		clReleaseEvent(r->busy[idx]);
+	r->busy[idx] = evt;
+	if (evt)
+		clRetainEvent(evt);
+
+	if (r->policy == RES_EVICT && r->resident[idx]) {
+		cl_int err = residency_evict(r, idx);
+		clFlush(r->mq);
+		return err;
+	}
+	return CL_SUCCESS;
+}
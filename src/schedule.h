@@ -0,0 +1,174 @@
+/* Buffer access schedules for the overallocation benchmarks.
+ *
+ * A schedule is an array of buffer indices in [first, nbuf), giving the
+ * order in which buffers are used. Besides the plain sequential visit of
+ * each buffer once, which is the easiest case for any eviction heuristic,
+ * we have uniformly random accesses, cyclic passes over all the buffers
+ * (the worst case for LRU when they don't fit), Zipfian hot/cold reuse,
+ * and replay of a trace read from a file.
+ *
+ * Generation is deterministic, so that runs with different strategies
+ * or policies see the same accesses.
+ */
+
+#include <math.h>
+
+enum schedule_kind {
+	SCHED_SEQ, // each buffer once, in order
+	SCHED_RANDOM, // uniformly random, with reuse
+	SCHED_CYCLIC, // several passes over all buffers, in order
+	SCHED_ZIPF, // Zipfian popularity over a random ranking of the buffers
+	SCHED_TRACE, // replay from file
+	NUM_SCHEDS
+};
+
+const char * const schedule_name[] = {
+	"seq", "random", "cyclic", "zipf", "trace"
+};
+
+// number of accesses per buffer for the random and Zipfian schedules,
+// and number of passes for the cyclic one
+#define SCHED_ACCESSES_PER_BUF 4
+
+// Zipf exponent
+#define SCHED_ZIPF_S 1.0
+
+// xorshift32 state for schedule generation, reset to the seed for each
+// schedule, so that the same kind over the same buffers always gives the
+// same schedule
+#define SCHED_SEED 2463534242u
+cl_uint sched_rng = SCHED_SEED;
+
+cl_uint sched_rand(void)
+{
+	sched_rng ^= sched_rng << 13;
+	sched_rng ^= sched_rng >> 17;
+	sched_rng ^= sched_rng << 5;
+	return sched_rng;
+}
+
+/* Parse a schedule specification: one of the schedule names, or the
+ * name of a trace file. Sets *fname for traces.
+ */
+enum schedule_kind parse_schedule(const char *spec, const char **fname)
+{
+	*fname = NULL;
+	for (enum schedule_kind s = 0; s < SCHED_TRACE; ++s)
+		if (!strcmp(spec, schedule_name[s]))
+			return s;
+	*fname = spec;
+	return SCHED_TRACE;
+}
+
+/* Read a trace of whitespace-separated buffer indices from fname.
+ * Sets *len to the number of accesses and *maxidx to the largest index.
+ */
+cl_uint *load_trace(const char *fname, cl_uint *len, cl_uint *maxidx)
+{
+	FILE *f = fopen(fname, "r");
+	cl_uint *trace = NULL;
+	cl_uint alloc = 0, idx;
+
+	if (!f) {
+		perror(fname);
+		exit(1);
+	}
+	*len = *maxidx = 0;
+	while (fscanf(f, "%u", &idx) == 1) {
+		if (*len == alloc) {
+			alloc = alloc ? 2*alloc : 256;
+			trace = realloc(trace, alloc*sizeof(*trace));
+			if (!trace) {
+				fputs("couldn't allocate trace\n", stderr);
+				exit(1);
+			}
+		}
+		trace[(*len)++] = idx;
+		if (idx > *maxidx)
+			*maxidx = idx;
+	}
+	fclose(f);
+	if (!*len) {
+		fprintf(stderr, "%s: empty trace\n", fname);
+		exit(1);
+	}
+	return trace;
+}
+
+/* Build a schedule of the given kind over buffers [first, nbuf), returning
+ * it and setting *len to its length. Trace indices are wrapped into range.
+ */
+cl_uint *make_schedule(enum schedule_kind kind, const char *fname,
+	cl_uint first, cl_uint nbuf, cl_uint *len)
+{
+	const cl_uint n = nbuf - first;
+	cl_uint *sched = NULL;
+	cl_uint i;
+
+	sched_rng = SCHED_SEED;
+
+	if (kind == SCHED_TRACE) {
+		cl_uint maxidx;
+		sched = load_trace(fname, len, &maxidx);
+		for (i = 0; i < *len; ++i)
+			sched[i] = first + sched[i] % n;
+		return sched;
+	}
+
+	*len = kind == SCHED_SEQ ? n : SCHED_ACCESSES_PER_BUF*n;
+	sched = calloc(*len, sizeof(*sched));
+	if (!sched) {
+		fputs("couldn't allocate schedule\n", stderr);
+		exit(1);
+	}
+
+	switch (kind) {
+	case SCHED_SEQ:
+	case SCHED_CYCLIC:
+		for (i = 0; i < *len; ++i)
+			sched[i] = first + i % n;
+		break;
+	case SCHED_RANDOM:
+		for (i = 0; i < *len; ++i)
+			sched[i] = first + sched_rand() % n;
+		break;
+	case SCHED_ZIPF: {
+		// cumulative popularity of the buffer ranks, and a random
+		// permutation mapping ranks to buffers
+		double *cdf = calloc(n, sizeof(*cdf));
+		cl_uint *perm = calloc(n, sizeof(*perm));
+		if (!cdf || !perm) {
+			fputs("couldn't allocate schedule\n", stderr);
+			exit(1);
+		}
+		double sum = 0;
+		for (i = 0; i < n; ++i) {
+			sum += 1/pow(i + 1, SCHED_ZIPF_S);
+			cdf[i] = sum;
+			perm[i] = i;
+		}
+		for (i = n - 1; i > 0; --i) {
+			cl_uint j = sched_rand() % (i + 1);
+			cl_uint t = perm[i]; perm[i] = perm[j]; perm[j] = t;
+		}
+		for (i = 0; i < *len; ++i) {
+			const double u = sched_rand()/4294967296.0*sum;
+			cl_uint lo = 0, hi = n - 1;
+			while (lo < hi) {
+				cl_uint mid = (lo + hi)/2;
+				if (cdf[mid] < u)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			sched[i] = first + perm[lo];
+		}
+		free(cdf);
+		free(perm);
+		break;
+	}
+	default:
+		break;
+	}
+	return sched;
+}
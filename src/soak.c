@@ -0,0 +1,541 @@
+/* Soak test: run the bandwidth workload (set and add kernels, map of the
+ * result) and/or the ndrangelatency one (no-op launches) for a given
+ * duration, recording throughput, latency, host memory, open descriptors,
+ * threads and mappings, and OpenCL reference counts in time windows, then
+ * look for statistically significant drift and throttling-like drops */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <CL/cl.h>
+
+#include "error.h"
+#include "trace.h"
+#include "phases.h"
+
+cl_uint np; // number of platforms
+cl_platform_id *platform; // list of platforms ids
+cl_platform_id p; // selected platform
+
+cl_uint nd; // number of devices in the selected platform
+cl_device_id *device; // list of device ids
+cl_device_id d; // selected device
+
+// context property: field 1 (the platform) will be set at runtime
+cl_context_properties ctx_prop[] = { CL_CONTEXT_PLATFORM, 0, 0, 0 };
+cl_context ctx; // context
+cl_command_queue q; // command queue
+
+// generic string retrieval buffer. quick'n'dirty, hence fixed-size
+#define BUFSZ 1024
+char strbuf[BUFSZ];
+
+size_t gmem; // device global memory size
+size_t alloc_max; // max single-buffer-size on device
+size_t buf_size; // actual buffer size
+cl_uint nels; // number of elements in each buffer
+
+// the kernels of bandwidth, and the nop of ndrangelatency
+const char *src[] = {
+"kernel void set(global float * restrict dst, global float * restrict src, uint n) {\n",
+"	uint i = get_global_id(0);\n",
+"	if (i < n) { dst[i] = 0; src[i] = i; }\n",
+"}\n",
+"kernel void add(global float * restrict dst, global const float * restrict src, uint n) {\n",
+"	uint i = get_global_id(0);\n",
+"	if (i < n) dst[i] += src[i];\n",
+"}\n",
+"kernel void nop() { return; }\n"
+};
+
+cl_program pg; // program
+cl_kernel k_set, k_add, k_nop; // actual kernels
+cl_mem buf[2]; // dst, src
+size_t gws; // global work size
+size_t wgm; // preferred workgroup size multiple (will be used as local size too)
+
+// macro to round size to the next multiple of base
+#define ROUND_MUL(size, base) \
+	((size + base - 1)/base)*base
+
+#define MB (1024*1024.0)
+
+// defaults: total duration and window length, seconds
+#define DEFAULT_DURATION 600
+#define DEFAULT_WINDOW 10
+
+// no-op launches per latency iteration
+#define NLAT 100
+
+// |t| of a regression slope above which drift is significant (p < ~0.005
+// for more than a handful of windows)
+#define DRIFT_T 3.0
+
+// a window below this fraction of the best throughput so far counts as throttled
+#define THROTTLE_FRACTION 0.9
+
+enum workload { WL_BANDWIDTH, WL_LATENCY, NUM_WORKLOADS };
+const char * const workload_name[] = { "bandwidth", "latency" };
+
+// what is recorded in each window
+enum metric {
+	M_ADD, // add kernel bandwidth, GB/s
+	M_MAP, // map bandwidth, GB/s
+	M_LAT, // median no-op launch latency, us
+	M_RSS, // host resident set size, MB
+	M_FDS, // open file descriptors
+	M_THREADS, // threads of the process
+	M_MAPS, // memory mappings of the process
+	M_CTX_REFS, // reference count of the context
+	M_QUEUE_REFS, // reference count of the queue
+	M_PROGRAM_REFS, // reference count of the program
+	NUM_METRICS
+};
+
+const char * const metric_name[] = {
+	"add GB/s", "map GB/s", "nop us", "RSS MB", "fds", "threads", "maps",
+	"ctx refs", "queue refs", "program refs"
+};
+
+// whether an increase of the metric is bad (otherwise, a decrease is)
+const int metric_up_is_bad[] = { 0, 0, 1, 1, 1, 1, 1, 1, 1, 1 };
+
+struct window {
+	double t; // end of the window, seconds since the start
+	cl_uint iters;
+	double m[NUM_METRICS];
+};
+
+struct window *win;
+cl_uint nwin, win_cap;
+
+// sample arrays for the current window
+double *lat_sample;
+cl_uint nlat, lat_cap;
+
+cl_ulong event_duration(cl_event evt)
+{
+	cl_ulong start, end;
+	error = clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_START,
+		sizeof(start), &start, NULL);
+	CHECK_ERROR("get start");
+	error = clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_END,
+		sizeof(end), &end, NULL);
+	CHECK_ERROR("get end");
+	return end - start;
+}
+
+int compare_double(const void *_a, const void *_b)
+{
+	const double a = *(const double*)_a;
+	const double b = *(const double*)_b;
+	return (a > b) - (a < b);
+}
+
+// resident set size of the process, MB
+double host_rss(void)
+{
+	unsigned long size, resident = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+	fclose(f);
+	return resident*sysconf(_SC_PAGESIZE)/MB;
+}
+
+// number of entries of a /proc directory, without . and ..
+long count_dir(const char *path)
+{
+	DIR *dir = opendir(path);
+	struct dirent *de;
+	long n = 0;
+	if (!dir)
+		return 0;
+	while ((de = readdir(dir)))
+		if (de->d_name[0] != '.')
+			++n;
+	closedir(dir);
+	return n;
+}
+
+// number of lines of a /proc file
+long count_lines(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	long n = 0;
+	int c;
+	if (!f)
+		return 0;
+	while ((c = fgetc(f)) != EOF)
+		n += c == '\n';
+	fclose(f);
+	return n;
+}
+
+void create_buffers(void)
+{
+	for (int i = 0; i < 2; ++i) {
+		buf[i] = clCreateBuffer(ctx, CL_MEM_READ_WRITE, buf_size, NULL, &error);
+		CHECK_ERROR("allocating buffer");
+	}
+	clSetKernelArg(k_set, 0, sizeof(buf[0]), buf);
+	clSetKernelArg(k_set, 1, sizeof(buf[1]), buf + 1);
+	clSetKernelArg(k_set, 2, sizeof(nels), &nels);
+	clSetKernelArg(k_add, 0, sizeof(buf[0]), buf);
+	clSetKernelArg(k_add, 1, sizeof(buf[1]), buf + 1);
+	clSetKernelArg(k_add, 2, sizeof(nels), &nels);
+}
+
+void release_buffers(void)
+{
+	for (int i = 0; i < 2; ++i) {
+		clReleaseMemObject(buf[i]);
+	}
+}
+
+// one iteration of the bandwidth workload; adds bytes and device ns
+// of the add kernel and of the map
+void bandwidth_iter(double *add_bytes, double *add_ns, double *map_bytes, double *map_ns)
+{
+	cl_event set_event, add_event, map_event;
+
+	error = clEnqueueNDRangeKernel(q, k_set, 1, NULL, &gws, &wgm, 0, NULL, &set_event);
+	CHECK_ERROR("enqueueing kernel set");
+	error = clEnqueueNDRangeKernel(q, k_add, 1, NULL, &gws, &wgm, 1, &set_event, &add_event);
+	CHECK_ERROR("enqueueing kernel add");
+	float *hmap = clEnqueueMapBuffer(q, buf[0], CL_TRUE, CL_MAP_READ, 0, buf_size,
+		1, &add_event, &map_event, &error);
+	CHECK_ERROR("map");
+
+	*add_bytes += 2.0*buf_size;
+	*add_ns += event_duration(add_event);
+	*map_bytes += buf_size;
+	*map_ns += event_duration(map_event);
+
+	error = clEnqueueUnmapMemObject(q, buf[0], hmap, 0, NULL, NULL);
+	CHECK_ERROR("unmap");
+	error = clFinish(q);
+	CHECK_ERROR("finishing");
+
+	trace_event(set_event, "set");
+	trace_event(add_event, "add");
+	trace_event(map_event, "map");
+	clReleaseEvent(set_event);
+	clReleaseEvent(add_event);
+	clReleaseEvent(map_event);
+}
+
+// one iteration of the latency workload: NLAT launch-to-completion samples
+void latency_iter(void)
+{
+	const size_t one = 1;
+
+	if (nlat + NLAT > lat_cap) {
+		lat_cap = 2*(nlat + NLAT);
+		lat_sample = realloc(lat_sample, lat_cap*sizeof(*lat_sample));
+		if (!lat_sample) {
+			fputs("couldn't allocate latency samples\n", stderr);
+			exit(1);
+		}
+	}
+	const double batch_start = now();
+	for (cl_uint i = 0; i < NLAT; ++i) {
+		const double start = now();
+		error = clEnqueueNDRangeKernel(q, k_nop, 1, NULL, &one, NULL, 0, NULL, NULL);
+		CHECK_ERROR("enqueueing nop");
+		error = clFinish(q);
+		CHECK_ERROR("finishing nop");
+		lat_sample[nlat++] = now() - start;
+	}
+	trace_host("nop latency", batch_start);
+}
+
+struct window *new_window(void)
+{
+	if (nwin == win_cap) {
+		win_cap = win_cap ? 2*win_cap : 64;
+		win = realloc(win, win_cap*sizeof(*win));
+		if (!win) {
+			fputs("couldn't allocate windows\n", stderr);
+			exit(1);
+		}
+	}
+	memset(win + nwin, 0, sizeof(*win));
+	return win + nwin++;
+}
+
+/* least-squares slope of metric m over time, in units per hour, with its
+ * t statistic; also the mean of the metric. Returns 0 if there are too few
+ * windows
+ */
+int drift(enum metric m, double *slope, double *tstat, double *mean)
+{
+	double mt = 0, my = 0, stt = 0, sty = 0, ss = 0;
+
+	if (nwin < 4)
+		return 0;
+	for (cl_uint w = 0; w < nwin; ++w) {
+		mt += win[w].t;
+		my += win[w].m[m];
+	}
+	mt /= nwin;
+	my /= nwin;
+	for (cl_uint w = 0; w < nwin; ++w) {
+		stt += (win[w].t - mt)*(win[w].t - mt);
+		sty += (win[w].t - mt)*(win[w].m[m] - my);
+	}
+	const double b = sty/stt;
+	for (cl_uint w = 0; w < nwin; ++w) {
+		const double r = win[w].m[m] - my - b*(win[w].t - mt);
+		ss += r*r;
+	}
+	const double se = sqrt(ss/(nwin - 2)/stt);
+
+	*slope = b*3600;
+	*mean = my;
+	// a perfectly flat or perfectly linear series has no residual
+	*tstat = se > 0 ? b/se : (b != 0 ? INFINITY : 0);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	// selected platform and device number
+	cl_uint pn = 0, dn = 0;
+	double duration = DEFAULT_DURATION, window = DEFAULT_WINDOW;
+	int use[NUM_WORKLOADS] = { 1, 1 };
+
+	// set platform/device num, duration, window and workloads from command line
+	if (argc > 1)
+		pn = atoi(argv[1]);
+	if (argc > 2)
+		dn = atoi(argv[2]);
+	if (argc > 3)
+		duration = atof(argv[3]);
+	if (argc > 4)
+		window = atof(argv[4]);
+	if (argc > 5)
+		for (enum workload wl = 0; wl < NUM_WORKLOADS; ++wl)
+			use[wl] = !!strstr(argv[5], workload_name[wl]);
+	if (window <= 0 || duration < window) {
+		fputs("the duration must be at least one window, and the window positive\n", stderr);
+		exit(1);
+	}
+	if (!use[WL_BANDWIDTH] && !use[WL_LATENCY]) {
+		fprintf(stderr, "no workload in %s\n", argv[5]);
+		exit(1);
+	}
+
+	error = clGetPlatformIDs(0, NULL, &np);
+	CHECK_ERROR("getting amount of platform IDs");
+	printf("%u platforms found\n", np);
+	if (pn >= np) {
+		fprintf(stderr, "there is no platform #%u\n" , pn);
+		exit(1);
+	}
+	// only allocate for IDs up to the intended one
+	platform = calloc(pn+1,sizeof(*platform));
+	// if allocation failed, next call will bomb. rely on this
+	error = clGetPlatformIDs(pn+1, platform, NULL);
+	CHECK_ERROR("getting platform IDs");
+
+	// choose platform
+	p = platform[pn];
+
+	error = clGetPlatformInfo(p, CL_PLATFORM_NAME, BUFSZ, strbuf, NULL);
+	CHECK_ERROR("getting platform name");
+	printf("using platform %u: %s\n", pn, strbuf);
+
+	error = clGetDeviceIDs(p, CL_DEVICE_TYPE_ALL, 0, NULL, &nd);
+	CHECK_ERROR("getting amount of device IDs");
+	printf("%u devices found\n", nd);
+	if (dn >= nd) {
+		fprintf(stderr, "there is no device #%u\n", dn);
+		exit(1);
+	}
+	// only allocate for IDs up to the intended one
+	device = calloc(dn+1,sizeof(*device));
+	// if allocation failed, next call will bomb. rely on this
+	error = clGetDeviceIDs(p, CL_DEVICE_TYPE_ALL, dn+1, device, NULL);
+	CHECK_ERROR("getting device IDs");
+
+	// choose device
+	d = device[dn];
+	error = clGetDeviceInfo(d, CL_DEVICE_NAME, BUFSZ, strbuf, NULL);
+	CHECK_ERROR("getting device name");
+	printf("using device %u: %s\n", dn, strbuf);
+
+	error = clGetDeviceInfo(d, CL_DEVICE_GLOBAL_MEM_SIZE,
+			sizeof(gmem), &gmem, NULL);
+	CHECK_ERROR("getting device global memory size");
+	error = clGetDeviceInfo(d, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+			sizeof(alloc_max), &alloc_max, NULL);
+	CHECK_ERROR("getting device max memory allocation size");
+
+	// create context
+	ctx_prop[1] = (cl_context_properties)p;
+	ctx = clCreateContext(ctx_prop, 1, &d, NULL, NULL, &error);
+	CHECK_ERROR("creating context");
+
+	// create queue
+	q = clCreateCommandQueue(ctx, d, CL_QUEUE_PROFILING_ENABLE, &error);
+	CHECK_ERROR("creating queue");
+
+	// create program
+	pg = clCreateProgramWithSource(ctx, sizeof(src)/sizeof(*src), src, NULL, &error);
+	CHECK_ERROR("creating program");
+
+	// build program
+	error = clBuildProgram(pg, 1, &d, NULL, NULL, NULL);
+	if (error == CL_BUILD_PROGRAM_FAILURE) {
+		error = clGetProgramBuildInfo(pg, d, CL_PROGRAM_BUILD_LOG,
+			BUFSZ, strbuf, NULL);
+		CHECK_ERROR("get program build info");
+		printf("=== BUILD LOG ===\n%s\n=========\n", strbuf);
+		error = CL_BUILD_PROGRAM_FAILURE;
+	}
+	CHECK_ERROR("building program");
+
+	// get kernels
+	k_set = clCreateKernel(pg, "set", &error);
+	CHECK_ERROR("creating kernel set");
+	k_add = clCreateKernel(pg, "add", &error);
+	CHECK_ERROR("creating kernel add");
+	k_nop = clCreateKernel(pg, "nop", &error);
+	CHECK_ERROR("creating kernel nop");
+
+	error = clGetKernelWorkGroupInfo(k_add, d, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+			sizeof(wgm), &wgm, NULL);
+	CHECK_ERROR("getting preferred workgroup size multiple");
+
+	// two buffers, as bandwidth
+	buf_size = gmem/2;
+	if (buf_size > alloc_max)
+		buf_size = alloc_max;
+	nels = buf_size/sizeof(cl_float);
+	buf_size = nels*sizeof(cl_float);
+	gws = ROUND_MUL(nels, wgm);
+
+	printf("soaking for %gs in %gs windows:%s%s\n", duration, window,
+		use[WL_BANDWIDTH] ? " bandwidth" : "", use[WL_LATENCY] ? " latency" : "");
+	if (use[WL_BANDWIDTH])
+		printf("bandwidth: two buffers of %gMB, reallocated each window\n", buf_size/MB);
+
+	printf("window\ttime s\titers");
+	for (enum metric m = 0; m < NUM_METRICS; ++m)
+		printf("\t%s", metric_name[m]);
+	puts("");
+
+	const double start = now();
+	double best_add = 0, first_throttle = -1;
+	cl_uint nthrottled = 0;
+
+	while (now() - start < duration) {
+		const double wstart = now();
+		const double wend = wstart + window;
+		double add_bytes = 0, add_ns = 0, map_bytes = 0, map_ns = 0;
+		struct window *w = new_window();
+
+		// fresh buffers each window, so that allocation churn shows up
+		if (use[WL_BANDWIDTH])
+			create_buffers();
+		nlat = 0;
+		do {
+			if (use[WL_BANDWIDTH])
+				bandwidth_iter(&add_bytes, &add_ns, &map_bytes, &map_ns);
+			if (use[WL_LATENCY])
+				latency_iter();
+			++w->iters;
+		} while (now() < wend);
+		if (use[WL_BANDWIDTH])
+			release_buffers();
+		trace_host("window", wstart);
+
+		w->t = now() - start;
+		if (add_ns) {
+			w->m[M_ADD] = add_bytes/add_ns;
+			w->m[M_MAP] = map_bytes/map_ns;
+		}
+		if (nlat) {
+			qsort(lat_sample, nlat, sizeof(*lat_sample), compare_double);
+			w->m[M_LAT] = lat_sample[nlat/2]*1.0e6;
+		}
+		w->m[M_RSS] = host_rss();
+		// without the descriptor of the directory stream itself
+		w->m[M_FDS] = count_dir("/proc/self/fd") - 1;
+		w->m[M_THREADS] = count_dir("/proc/self/task");
+		w->m[M_MAPS] = count_lines("/proc/self/maps");
+		/* the reference counts are only meant for finding leaks: where the
+		 * runtime retains the context, queue or program for each object
+		 * made from them, leaked buffers, events or kernels show up here
+		 */
+		cl_uint refs = 0;
+		clGetContextInfo(ctx, CL_CONTEXT_REFERENCE_COUNT, sizeof(refs), &refs, NULL);
+		w->m[M_CTX_REFS] = refs;
+		refs = 0;
+		clGetCommandQueueInfo(q, CL_QUEUE_REFERENCE_COUNT, sizeof(refs), &refs, NULL);
+		w->m[M_QUEUE_REFS] = refs;
+		refs = 0;
+		clGetProgramInfo(pg, CL_PROGRAM_REFERENCE_COUNT, sizeof(refs), &refs, NULL);
+		w->m[M_PROGRAM_REFS] = refs;
+
+		if (w->m[M_ADD] > best_add)
+			best_add = w->m[M_ADD];
+		else if (w->m[M_ADD] < THROTTLE_FRACTION*best_add) {
+			if (!nthrottled++)
+				first_throttle = w->t;
+		}
+
+		printf("%u\t%.1f\t%u", nwin - 1, w->t, w->iters);
+		for (enum metric m = 0; m < NUM_METRICS; ++m)
+			printf("\t%g", w->m[m]);
+		puts("");
+		fflush(stdout);
+	}
+
+	puts("Drift (least-squares slope over time):");
+	for (enum metric m = 0; m < NUM_METRICS; ++m) {
+		double slope, tstat, mean;
+		if ((m == M_ADD || m == M_MAP) && !use[WL_BANDWIDTH])
+			continue;
+		if (m == M_LAT && !use[WL_LATENCY])
+			continue;
+		if (!drift(m, &slope, &tstat, &mean)) {
+			puts("\ttoo few windows");
+			break;
+		}
+		const int significant = fabs(tstat) > DRIFT_T;
+		const int bad = significant && (slope > 0) == metric_up_is_bad[m];
+		printf("\t%s: mean %g, %+g/hour (%+.3g%%/hour), t = %.3g%s\n",
+			metric_name[m], mean, slope, mean ? slope*100/mean : 0, tstat,
+			bad ? ": DEGRADING" : significant ? ": significant" : "");
+	}
+	if (use[WL_BANDWIDTH]) {
+		if (nthrottled)
+			printf("throttling: %u windows below %g%% of the best add bandwidth, first at %.1fs\n",
+				nthrottled, THROTTLE_FRACTION*100, first_throttle);
+		else
+			printf("throttling: no window below %g%% of the best add bandwidth\n",
+				THROTTLE_FRACTION*100);
+	}
+
+	free(lat_sample);
+	free(win);
+	clReleaseKernel(k_nop);
+	clReleaseKernel(k_add);
+	clReleaseKernel(k_set);
+	clReleaseProgram(pg);
+	clReleaseCommandQueue(q);
+	clReleaseContext(ctx);
+	free(device);
+	free(platform);
+
+	return 0;
+}
@@ -0,0 +1,52 @@
+/* Context and queue a test runs on.
+ *
+ * The test bodies of the standalone tools take their device, context
+ * and queue from a struct test_env instead of creating their own, so
+ * that the clbench driver can run all of them in one process on
+ * contexts and queues created once per device. The queue is in-order,
+ * with profiling enabled; anything else (programs, buffers, other
+ * queues) is created and released by the test itself.
+ *
+ * Requires error.h and devsel.h.
+ */
+
+struct test_env {
+	const struct dev_entry *dev; // platform, device, version and name
+	cl_context ctx;
+	cl_command_queue q;
+};
+
+// generic string retrieval buffer. quick'n'dirty, hence fixed-size
+#define BUFSZ 1024
+char strbuf[BUFSZ];
+
+void test_env_create(struct test_env *env, const struct dev_entry *dev)
+{
+	cl_context_properties ctx_prop[] = {
+		CL_CONTEXT_PLATFORM, (cl_context_properties)dev->p, 0
+	};
+
+	env->dev = dev;
+	env->ctx = clCreateContext(ctx_prop, 1, &dev->d, NULL, NULL, &error);
+	CHECK_ERROR("creating context");
+	env->q = clCreateCommandQueue(env->ctx, dev->d, CL_QUEUE_PROFILING_ENABLE, &error);
+	CHECK_ERROR("creating queue");
+}
+
+void test_env_release(struct test_env *env)
+{
+	if (env->q)
+		clReleaseCommandQueue(env->q);
+	if (env->ctx)
+		clReleaseContext(env->ctx);
+	env->q = NULL;
+	env->ctx = NULL;
+}
+
+// ascending order of doubles, for qsort
+int compare_double(const void *_a, const void *_b)
+{
+	const double a = *(const double*)_a;
+	const double b = *(const double*)_b;
+	return (a > b) - (a < b);
+}
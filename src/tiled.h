@@ -0,0 +1,131 @@
+/* Tiled arrays: logical float arrays split across several allocations.
+ *
+ * Many platforms report a CL_DEVICE_MAX_MEM_ALLOC_SIZE of only a quarter
+ * of the device memory, so arrays larger than that must be split into
+ * tiles, each of them a separate cl_mem. Arrays created with the same
+ * number of elements and tile size have matching tiles, so elementwise
+ * kernels can run tile by tile: the tile kernels are all enqueued in one
+ * pass, and flushed together.
+ *
+ * Requires error.h and verify.h.
+ */
+
+struct tiled_array {
+	size_t nels; // logical number of elements
+	size_t tile_els; // number of elements in each tile but the last
+	cl_uint ntiles; // number of tiles
+	cl_mem *tile; // the tiles
+};
+
+// number of elements in tile i of t
+cl_uint tiled_tile_els(const struct tiled_array *t, cl_uint i)
+{
+	return i + 1 < t->ntiles ? t->tile_els : t->nels - i*t->tile_els;
+}
+
+void tiled_release(struct tiled_array *t)
+{
+	if (t->tile)
+		for (cl_uint i = 0; i < t->ntiles; ++i)
+			if (t->tile[i])
+				clReleaseMemObject(t->tile[i]);
+	free(t->tile);
+	memset(t, 0, sizeof(*t));
+}
+
+/* Create a tiled array of nels floats, in tiles of at most max_tile bytes.
+ * On failure, whatever was allocated is released.
+ */
+cl_int tiled_create(struct tiled_array *t, cl_context tctx, cl_mem_flags flags,
+	size_t nels, size_t max_tile)
+{
+	cl_int err = CL_SUCCESS;
+
+	memset(t, 0, sizeof(*t));
+	t->nels = nels;
+	t->tile_els = max_tile/sizeof(cl_float);
+	// the kernels index tiles with a uint
+	if (t->tile_els > ~(cl_uint)0)
+		t->tile_els = ~(cl_uint)0;
+	if (!nels || !t->tile_els)
+		return CL_INVALID_BUFFER_SIZE;
+	t->ntiles = (nels + t->tile_els - 1)/t->tile_els;
+
+	t->tile = calloc(t->ntiles, sizeof(*t->tile));
+	if (!t->tile)
+		return CL_OUT_OF_HOST_MEMORY;
+
+	for (cl_uint i = 0; i < t->ntiles; ++i) {
+		t->tile[i] = clCreateBuffer(tctx, flags, tiled_tile_els(t, i)*sizeof(cl_float),
+			NULL, &err);
+		if (err != CL_SUCCESS) {
+			tiled_release(t);
+			return err;
+		}
+	}
+	return CL_SUCCESS;
+}
+
+// fill all the elements of t with val
+cl_int tiled_fill(cl_command_queue tq, const struct tiled_array *t, float val)
+{
+	for (cl_uint i = 0; i < t->ntiles; ++i) {
+		cl_int err = clEnqueueFillBuffer(tq, t->tile[i], &val, sizeof(val),
+			0, tiled_tile_els(t, i)*sizeof(val), 0, NULL, NULL);
+		if (err != CL_SUCCESS)
+			return err;
+	}
+	return CL_SUCCESS;
+}
+
+/* Run the kernel tk (with arguments dst, src, n, like add) over the matching
+ * tiles of dst and src, local size lws. All the launches are enqueued
+ * before flushing; if evt is not NULL, it must have room for the event of
+ * each tile kernel.
+ */
+cl_int tiled_run(cl_command_queue tq, cl_kernel tk, size_t lws,
+	const struct tiled_array *dst, const struct tiled_array *src, cl_event *evt)
+{
+	if (dst->nels != src->nels || dst->tile_els != src->tile_els)
+		return CL_INVALID_VALUE;
+
+	for (cl_uint i = 0; i < dst->ntiles; ++i) {
+		const cl_uint n = tiled_tile_els(dst, i);
+		const size_t tgws = ((n + lws - 1)/lws)*lws;
+		clSetKernelArg(tk, 0, sizeof(cl_mem), dst->tile + i);
+		clSetKernelArg(tk, 1, sizeof(cl_mem), src->tile + i);
+		clSetKernelArg(tk, 2, sizeof(n), &n);
+		cl_int err = clEnqueueNDRangeKernel(tq, tk, 1, NULL, &tgws, &lws,
+			0, NULL, evt ? evt + i : NULL);
+		if (err != CL_SUCCESS)
+			return err;
+	}
+	return clFlush(tq);
+}
+
+/* check that all the elements of t equal expected, mapping the tiles one
+ * at a time. Returns the number of mismatches, setting *first_bad to the
+ * logical index of the first of them (nels if none)
+ */
+size_t tiled_check(cl_command_queue tq, const struct tiled_array *t, float expected,
+	size_t *first_bad)
+{
+	size_t nbad = 0;
+
+	*first_bad = t->nels;
+	for (cl_uint i = 0; i < t->ntiles; ++i) {
+		const cl_uint n = tiled_tile_els(t, i);
+		size_t tile_bad;
+		float *h = clEnqueueMapBuffer(tq, t->tile[i], CL_TRUE, CL_MAP_READ,
+			0, n*sizeof(*h), 0, NULL, NULL, &error);
+		CHECK_ERROR("mapping tile");
+		const size_t tile_nbad = par_check(h, n, expected, &tile_bad);
+		if (tile_nbad && !nbad)
+			*first_bad = i*t->tile_els + tile_bad;
+		nbad += tile_nbad;
+		error = clEnqueueUnmapMemObject(tq, t->tile[i], h, 0, NULL, NULL);
+		CHECK_ERROR("unmapping tile");
+	}
+	clFinish(tq);
+	return nbad;
+}
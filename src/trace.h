@@ -0,0 +1,365 @@
+/* Timeline traces in the Chrome trace event format, which can be loaded
+ * in chrome://tracing or Perfetto.
+ *
+ * Tracing is enabled by setting the CLTRACE environment variable (or the
+ * one named by TRACE_ENV, if defined before inclusion) to the name of
+ * the file to write; otherwise all the functions do nothing.
+ * Commands are traced from their completed events: each device is a
+ * process and each queue a thread in it, with the command spanning its
+ * START to END, and its wait since QUEUED and SUBMIT as arguments. Host
+ * spans go to a separate host process.
+ *
+ * Device timestamps are on a device clock, calibrated against the host
+ * clock once per device, when its first queue is seen: with
+ * clGetDeviceAndHostTimer where available (OpenCL 2.1), otherwise with a
+ * marker on a queue of its own, whose END is paired with the host time
+ * at which waiting for it returns. Either way, the best of a few tries is
+ * kept. Times within a device are exact, alignment with the host and
+ * other devices is off by the timer query or completion notification
+ * latency, regardless of when the commands are traced. Should both
+ * calibrations fail, the device is aligned at the first command traced
+ * on it, assuming it has just completed.
+ *
+ * The calibration calls entry points through TRACE_REAL(name), which an
+ * including file that interposes them can define to reach the real ones.
+ *
+ * Commands that may still be running when their event would be released
+ * can be handed to trace_defer(), which keeps them until trace_flush().
+ *
+ * Tracing never aborts the program: whatever cannot be queried is left
+ * out of the trace. The including file must define _POSIX_C_SOURCE for
+ * clock_gettime, and queues must have profiling enabled.
+ */
+
+#include <time.h>
+
+#ifndef TRACE_ENV
+#define TRACE_ENV "CLTRACE"
+#endif
+#define TRACE_MAX_QUEUES 64
+#define TRACE_MAX_DEVICES 16
+#define TRACE_NAMESZ 256
+#define TRACE_CALIB_TRIES 5
+
+#ifndef TRACE_REAL
+#define TRACE_REAL(name) name
+#endif
+
+struct trace_device {
+	cl_device_id d;
+	int aligned; // whether offset has been set
+	double offset; // host minus device time, us
+};
+
+struct trace_queue {
+	cl_command_queue q;
+	cl_uint dev; // index in trace_dev
+	char name[TRACE_NAMESZ];
+};
+
+// a command kept by trace_defer()
+struct trace_deferred {
+	cl_event evt;
+	const char *name;
+};
+
+FILE *trace_file;
+int trace_state; // 0: not checked yet, 1: tracing, -1: not tracing
+cl_uint trace_nevents;
+
+struct trace_device trace_dev[TRACE_MAX_DEVICES];
+cl_uint trace_ndev;
+struct trace_queue trace_q[TRACE_MAX_QUEUES];
+cl_uint trace_nq;
+struct trace_deferred *trace_def;
+cl_uint trace_ndef, trace_maxdef;
+
+// host CLOCK_MONOTONIC time in seconds, as now() in phases.h
+double trace_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1.0e-9;
+}
+
+void trace_close(void)
+{
+	if (!trace_file)
+		return;
+	fputs("\n]\n", trace_file);
+	fclose(trace_file);
+	trace_file = NULL;
+	trace_state = -1;
+}
+
+// print s as a JSON string
+void trace_string(const char *s)
+{
+	fputc('"', trace_file);
+	for (; *s; ++s) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', trace_file);
+		if ((unsigned char)*s < ' ')
+			fprintf(trace_file, "\\u%04x", *s);
+		else
+			fputc(*s, trace_file);
+	}
+	fputc('"', trace_file);
+}
+
+// start a new trace event record, up to the opening brace
+void trace_begin(void)
+{
+	fputs(trace_nevents++ ? ",\n{" : "\n{", trace_file);
+}
+
+// name process pid or thread tid of it
+void trace_metadata(const char *what, cl_uint pid, cl_uint tid, const char *name)
+{
+	trace_begin();
+	fprintf(trace_file, "\"ph\":\"M\",\"name\":\"%s\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":",
+		what, pid, tid);
+	trace_string(name);
+	fputs("}}", trace_file);
+}
+
+// whether tracing is enabled, opening the trace file the first time
+int trace_enabled(void)
+{
+	if (trace_state)
+		return trace_state > 0;
+
+	const char *fname = getenv(TRACE_ENV);
+	trace_state = -1;
+	if (!fname || !*fname)
+		return 0;
+	trace_file = fopen(fname, "w");
+	if (!trace_file) {
+		perror(fname);
+		return 0;
+	}
+	fputs("[", trace_file);
+	atexit(trace_close);
+	trace_state = 1;
+	trace_metadata("process_name", 0, 0, "host");
+	return 1;
+}
+
+const char *trace_command_name(cl_command_type type)
+{
+	switch (type) {
+	case CL_COMMAND_NDRANGE_KERNEL: return "kernel";
+	case CL_COMMAND_TASK: return "task";
+	case CL_COMMAND_NATIVE_KERNEL: return "native kernel";
+	case CL_COMMAND_READ_BUFFER: return "read buffer";
+	case CL_COMMAND_WRITE_BUFFER: return "write buffer";
+	case CL_COMMAND_COPY_BUFFER: return "copy buffer";
+	case CL_COMMAND_READ_BUFFER_RECT: return "read buffer rect";
+	case CL_COMMAND_WRITE_BUFFER_RECT: return "write buffer rect";
+	case CL_COMMAND_COPY_BUFFER_RECT: return "copy buffer rect";
+	case CL_COMMAND_FILL_BUFFER: return "fill buffer";
+	case CL_COMMAND_MAP_BUFFER: return "map buffer";
+	case CL_COMMAND_UNMAP_MEM_OBJECT: return "unmap";
+	case CL_COMMAND_MIGRATE_MEM_OBJECTS: return "migrate";
+	case CL_COMMAND_MARKER: return "marker";
+	case CL_COMMAND_BARRIER: return "barrier";
+	default: return "command";
+	}
+}
+
+/* set the host minus device offset of td, on which queue tq is; returns
+ * 0 if the device can't be calibrated
+ */
+int trace_calibrate(struct trace_device *td, cl_command_queue tq)
+{
+	double best = -1; // uncertainty of the best try so far, seconds
+
+#ifdef CL_VERSION_2_1
+	// the device timer, bracketed by host clock reads
+	for (int i = 0; i < TRACE_CALIB_TRIES; ++i) {
+		cl_ulong dev_ts, host_ts;
+		const double before = trace_clock();
+		if (clGetDeviceAndHostTimer(td->d, &dev_ts, &host_ts) != CL_SUCCESS)
+			break;
+		const double after = trace_clock();
+		if (best < 0 || after - before < best) {
+			best = after - before;
+			td->offset = (before + after)*0.5e6 - dev_ts*1.0e-3;
+		}
+	}
+	if (best >= 0)
+		return 1;
+#endif
+
+	// a marker on an otherwise empty queue: it completes as soon as it is
+	// submitted, and waiting for it returns right after that
+	cl_context tc;
+	if (clGetCommandQueueInfo(tq, CL_QUEUE_CONTEXT, sizeof(tc), &tc, NULL) != CL_SUCCESS)
+		return 0;
+	cl_command_queue cq = TRACE_REAL(clCreateCommandQueue)(tc, td->d,
+		CL_QUEUE_PROFILING_ENABLE, NULL);
+	if (!cq)
+		return 0;
+	for (int i = 0; i < TRACE_CALIB_TRIES; ++i) {
+		cl_event evt;
+		cl_ulong end;
+		if (TRACE_REAL(clEnqueueMarkerWithWaitList)(cq, 0, NULL, &evt) != CL_SUCCESS)
+			break;
+		const double before = trace_clock();
+		const cl_int ret = TRACE_REAL(clWaitForEvents)(1, &evt);
+		const double after = trace_clock();
+		if (ret == CL_SUCCESS &&
+			clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL) == CL_SUCCESS &&
+			end && (best < 0 || after - before < best)) {
+			best = after - before;
+			td->offset = after*1.0e6 - end*1.0e-3;
+		}
+		clReleaseEvent(evt);
+	}
+	TRACE_REAL(clReleaseCommandQueue)(cq);
+	return best >= 0;
+}
+
+// index of device td in trace_dev, adding it (and naming its process) if needed
+cl_uint trace_device_index(cl_device_id td, cl_command_queue tq)
+{
+	cl_uint i;
+	char name[TRACE_NAMESZ];
+
+	for (i = 0; i < trace_ndev; ++i)
+		if (trace_dev[i].d == td)
+			return i;
+	if (trace_ndev == TRACE_MAX_DEVICES)
+		return TRACE_MAX_DEVICES;
+
+	trace_dev[i].d = td;
+	trace_dev[i].aligned = trace_calibrate(trace_dev + i, tq);
+	++trace_ndev;
+	if (clGetDeviceInfo(td, CL_DEVICE_NAME, sizeof(name), name, NULL) != CL_SUCCESS)
+		strcpy(name, "device");
+	trace_metadata("process_name", i + 1, 0, name);
+	return i;
+}
+
+// index of queue tq in trace_q, adding it if needed
+cl_uint trace_queue_index(cl_command_queue tq)
+{
+	cl_uint i;
+	cl_device_id td;
+
+	for (i = 0; i < trace_nq; ++i)
+		if (trace_q[i].q == tq)
+			return i;
+	if (trace_nq == TRACE_MAX_QUEUES ||
+		clGetCommandQueueInfo(tq, CL_QUEUE_DEVICE, sizeof(td), &td, NULL) != CL_SUCCESS)
+		return TRACE_MAX_QUEUES;
+	const cl_uint dev = trace_device_index(td, tq);
+	if (dev == TRACE_MAX_DEVICES)
+		return TRACE_MAX_QUEUES;
+
+	trace_q[i].q = tq;
+	trace_q[i].dev = dev;
+	snprintf(trace_q[i].name, TRACE_NAMESZ, "queue %u", i);
+	++trace_nq;
+	trace_metadata("thread_name", dev + 1, i, trace_q[i].name);
+	return i;
+}
+
+// give queue tq a name in the trace
+void trace_name_queue(cl_command_queue tq, const char *name)
+{
+	if (!trace_enabled())
+		return;
+	const cl_uint i = trace_queue_index(tq);
+	if (i == TRACE_MAX_QUEUES)
+		return;
+	snprintf(trace_q[i].name, TRACE_NAMESZ, "%s", name);
+	trace_metadata("thread_name", trace_q[i].dev + 1, i, trace_q[i].name);
+}
+
+// trace a host span from start (seconds, as from now()) to the current time
+void trace_host(const char *name, double start)
+{
+	if (!trace_enabled())
+		return;
+	const double end = trace_clock();
+	trace_begin();
+	fputs("\"ph\":\"X\",\"cat\":\"host\",\"name\":", trace_file);
+	trace_string(name);
+	fprintf(trace_file, ",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}",
+		start*1.0e6, (end - start)*1.0e6);
+}
+
+// trace the completed command evt under the given name; the event is not released
+void trace_event(cl_event evt, const char *name)
+{
+	cl_command_queue tq;
+	cl_command_type type;
+	cl_ulong queued, submit, start, end;
+
+	if (!trace_enabled())
+		return;
+
+	// user events have no queue, and no timestamps; failures to query
+	// the event only lose it from the trace
+	if (clGetEventInfo(evt, CL_EVENT_COMMAND_QUEUE, sizeof(tq), &tq, NULL) != CL_SUCCESS || !tq ||
+		clGetEventInfo(evt, CL_EVENT_COMMAND_TYPE, sizeof(type), &type, NULL) != CL_SUCCESS ||
+		clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_QUEUED, sizeof(queued), &queued, NULL) != CL_SUCCESS ||
+		clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_SUBMIT, sizeof(submit), &submit, NULL) != CL_SUCCESS ||
+		clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL) != CL_SUCCESS ||
+		clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL) != CL_SUCCESS)
+		return;
+
+	const cl_uint qi = trace_queue_index(tq);
+	if (qi == TRACE_MAX_QUEUES)
+		return;
+	struct trace_device *td = trace_dev + trace_q[qi].dev;
+	if (!td->aligned) {
+		// calibration failed: assume the command has just completed
+		td->offset = trace_clock()*1.0e6 - end*1.0e-3;
+		td->aligned = 1;
+	}
+
+	trace_begin();
+	fputs("\"ph\":\"X\",\"cat\":", trace_file);
+	trace_string(trace_command_name(type));
+	fputs(",\"name\":", trace_file);
+	trace_string(name ? name : trace_command_name(type));
+	fprintf(trace_file, ",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+		"\"args\":{\"queued_to_start_us\":%.3f,\"submit_to_start_us\":%.3f}}",
+		trace_q[qi].dev + 1, qi, start*1.0e-3 + td->offset, (end - start)*1.0e-3,
+		(start - queued)*1.0e-3, (start - submit)*1.0e-3);
+}
+
+/* keep command evt, which may not have completed yet, to trace it under
+ * name (which must stay valid until then) at the next trace_flush(); the
+ * caller can release its own reference right away
+ */
+void trace_defer(cl_event evt, const char *name)
+{
+	if (!evt || !trace_enabled())
+		return;
+	if (trace_ndef == trace_maxdef) {
+		const cl_uint n = trace_maxdef ? 2*trace_maxdef : 256;
+		struct trace_deferred *def = realloc(trace_def, n*sizeof(*def));
+		if (!def)
+			return;
+		trace_def = def;
+		trace_maxdef = n;
+	}
+	clRetainEvent(evt);
+	trace_def[trace_ndef].evt = evt;
+	trace_def[trace_ndef].name = name;
+	++trace_ndef;
+}
+
+// wait for the deferred commands, trace them and release them
+void trace_flush(void)
+{
+	for (cl_uint i = 0; i < trace_ndef; ++i) {
+		if (clWaitForEvents(1, &trace_def[i].evt) == CL_SUCCESS)
+			trace_event(trace_def[i].evt, trace_def[i].name);
+		clReleaseEvent(trace_def[i].evt);
+	}
+	trace_ndef = 0;
+}
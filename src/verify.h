@@ -0,0 +1,272 @@
+/* Buffer initialization and verification for the overallocation tests.
+ *
+ * Filling multi-GB buffers and checking them one float at a time on a
+ * single host thread can take much longer than what we are trying to
+ * measure, so buffers can be filled on the device, either with
+ * clEnqueueFillBuffer or with an init kernel, and checked on the device
+ * with a kernel that only returns the number of mismatches and the
+ * first bad index. What is left on the host is split across threads,
+ * and uses vector operations where the compiler supports them.
+ *
+ * Requires error.h; link with -pthread.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+enum fill_mode {
+	FILL_HOST, // map and fill on the host
+	FILL_BUFFER, // clEnqueueFillBuffer
+	FILL_KERNEL, // init kernel
+	NUM_FILL_MODES
+};
+
+const char * const fill_mode_name[] = { "host", "fill", "kernel" };
+
+enum check_mode {
+	CHECK_HOST, // map and check on the host
+	CHECK_DEVICE, // verification kernel
+	NUM_CHECK_MODES
+};
+
+const char * const check_mode_name[] = { "host", "device" };
+
+// look up a mode by name, exit if not found
+int parse_mode(const char *arg, const char * const *names, int count, const char *what)
+{
+	for (int m = 0; m < count; ++m)
+		if (!strcmp(arg, names[m]))
+			return m;
+	fprintf(stderr, "unknown %s mode %s\n", what, arg);
+	exit(1);
+}
+
+/* Device side */
+
+const char *verify_src[] = {
+"kernel void init(global float *dst, float val, uint n) {\n",
+"	uint i = get_global_id(0);\n",
+"	if (i < n) dst[i] = val;\n",
+"}\n",
+// result[0] counts the mismatches, result[1] is the first bad index;
+// only mismatching work-items touch them, so the common case is free
+"kernel void verify(global const float *src, float expected, uint n,\n",
+"	global uint *result) {\n",
+"	uint i = get_global_id(0);\n",
+"	if (i < n && src[i] != expected) {\n",
+"		atomic_inc(result);\n",
+"		atomic_min(result + 1, i);\n",
+"	}\n",
+"}\n"
+};
+
+cl_program verify_pg;
+cl_kernel k_init, k_verify;
+cl_mem verify_result; // mismatch count and first bad index
+size_t verify_wgm; // preferred workgroup size multiple of the kernels
+
+void verify_setup(cl_context vctx, cl_device_id vd)
+{
+	verify_pg = clCreateProgramWithSource(vctx, sizeof(verify_src)/sizeof(*verify_src),
+		verify_src, NULL, &error);
+	CHECK_ERROR("creating verification program");
+	error = clBuildProgram(verify_pg, 1, &vd, NULL, NULL, NULL);
+	CHECK_ERROR("building verification program");
+	k_init = clCreateKernel(verify_pg, "init", &error);
+	CHECK_ERROR("creating kernel init");
+	k_verify = clCreateKernel(verify_pg, "verify", &error);
+	CHECK_ERROR("creating kernel verify");
+	error = clGetKernelWorkGroupInfo(k_verify, vd, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+			sizeof(verify_wgm), &verify_wgm, NULL);
+	CHECK_ERROR("getting preferred workgroup size multiple");
+	verify_result = clCreateBuffer(vctx, CL_MEM_READ_WRITE, 2*sizeof(cl_uint), NULL, &error);
+	CHECK_ERROR("allocating verification result");
+}
+
+void verify_teardown(void)
+{
+	clReleaseMemObject(verify_result);
+	clReleaseKernel(k_verify);
+	clReleaseKernel(k_init);
+	clReleaseProgram(verify_pg);
+}
+
+/* fill the first n floats of buf with val on the device, with mode
+ * FILL_BUFFER or FILL_KERNEL; buf must be writable by kernels for the latter
+ */
+cl_int fill_device(cl_command_queue vq, enum fill_mode mode, cl_mem buf, cl_uint n, float val,
+	cl_uint nwait, const cl_event *wait, cl_event *evt)
+{
+	if (mode == FILL_BUFFER)
+		return clEnqueueFillBuffer(vq, buf, &val, sizeof(val), 0, n*sizeof(val),
+			nwait, wait, evt);
+
+	const size_t vgws = ((n + verify_wgm - 1)/verify_wgm)*verify_wgm;
+	clSetKernelArg(k_init, 0, sizeof(buf), &buf);
+	clSetKernelArg(k_init, 1, sizeof(val), &val);
+	clSetKernelArg(k_init, 2, sizeof(n), &n);
+	return clEnqueueNDRangeKernel(vq, k_init, 1, NULL, &vgws, &verify_wgm,
+		nwait, wait, evt);
+}
+
+/* check that the first n floats of buf equal expected on the device; set
+ * *nbad to the number of mismatches and *first_bad to the first of them.
+ * If evt is not NULL, it gets the event of the verification kernel
+ */
+cl_int check_device(cl_command_queue vq, cl_mem buf, cl_uint n, float expected,
+	cl_uint nwait, const cl_event *wait, cl_uint *nbad, cl_uint *first_bad,
+	cl_event *evt)
+{
+	cl_uint result[2] = { 0, ~(cl_uint)0 };
+	const size_t vgws = ((n + verify_wgm - 1)/verify_wgm)*verify_wgm;
+	cl_int err;
+
+	err = clEnqueueWriteBuffer(vq, verify_result, CL_FALSE, 0, sizeof(result), result,
+		0, NULL, NULL);
+	if (err != CL_SUCCESS)
+		return err;
+
+	clSetKernelArg(k_verify, 0, sizeof(buf), &buf);
+	clSetKernelArg(k_verify, 1, sizeof(expected), &expected);
+	clSetKernelArg(k_verify, 2, sizeof(n), &n);
+	clSetKernelArg(k_verify, 3, sizeof(verify_result), &verify_result);
+	err = clEnqueueNDRangeKernel(vq, k_verify, 1, NULL, &vgws, &verify_wgm,
+		nwait, wait, evt);
+	if (err != CL_SUCCESS)
+		return err;
+
+	err = clEnqueueReadBuffer(vq, verify_result, CL_TRUE, 0, sizeof(result), result,
+		0, NULL, NULL);
+	*nbad = result[0];
+	*first_bad = result[1];
+	return err;
+}
+
+/* Host side */
+
+#define PAR_MAX_THREADS 64
+// below this many elements, threads are not worth it
+#define PAR_MIN_ELEMS (1U << 20)
+
+#ifdef __GNUC__
+#define PAR_VLEN 8
+typedef float par_vfloat __attribute__((vector_size(PAR_VLEN*sizeof(float)), aligned(4), may_alias));
+typedef int par_vint __attribute__((vector_size(PAR_VLEN*sizeof(int))));
+#endif
+
+struct par_job {
+	float *dst;
+	const float *src;
+	size_t begin, end;
+	float val;
+	size_t nbad, first_bad;
+};
+
+void *par_fill_worker(void *arg)
+{
+	struct par_job *job = arg;
+	float * restrict dst = job->dst;
+	size_t i = job->begin;
+#ifdef PAR_VLEN
+	par_vfloat v;
+	for (int l = 0; l < PAR_VLEN; ++l)
+		v[l] = job->val;
+	for (; i + PAR_VLEN <= job->end; i += PAR_VLEN)
+		*(par_vfloat *)(dst + i) = v;
+#endif
+	for (; i < job->end; ++i)
+		dst[i] = job->val;
+	return NULL;
+}
+
+void *par_check_worker(void *arg)
+{
+	struct par_job *job = arg;
+	const float * restrict src = job->src;
+	size_t i = job->begin, nbad = 0;
+#ifdef PAR_VLEN
+	par_vfloat ev;
+	par_vint bad = { 0 };
+	for (int l = 0; l < PAR_VLEN; ++l)
+		ev[l] = job->val;
+	for (; i + PAR_VLEN <= job->end; i += PAR_VLEN)
+		bad -= *(const par_vfloat *)(src + i) != ev;
+	for (int l = 0; l < PAR_VLEN; ++l)
+		nbad += bad[l];
+#endif
+	for (; i < job->end; ++i)
+		nbad += src[i] != job->val;
+
+	job->nbad = nbad;
+	job->first_bad = job->end;
+	// only look for the first mismatch if there is one
+	if (nbad)
+		for (i = job->begin; i < job->end; ++i)
+			if (src[i] != job->val) {
+				job->first_bad = i;
+				break;
+			}
+	return NULL;
+}
+
+cl_uint par_nthreads(size_t n)
+{
+	static cl_uint ncpu;
+	if (!ncpu) {
+		long c = sysconf(_SC_NPROCESSORS_ONLN);
+		ncpu = c < 1 ? 1 : c > PAR_MAX_THREADS ? PAR_MAX_THREADS : c;
+	}
+	return n < PAR_MIN_ELEMS ? 1 : ncpu;
+}
+
+// run worker over n elements split among threads, jobs must have
+// room for par_nthreads(n) entries
+cl_uint par_run(void *(*worker)(void *), struct par_job *jobs, size_t n)
+{
+	pthread_t tid[PAR_MAX_THREADS];
+	const cl_uint nt = par_nthreads(n);
+	const size_t chunk = (n + nt - 1)/nt;
+
+	for (cl_uint t = 0; t < nt; ++t) {
+		jobs[t] = jobs[0];
+		jobs[t].begin = t*chunk < n ? t*chunk : n;
+		jobs[t].end = (t + 1)*chunk < n ? (t + 1)*chunk : n;
+	}
+	// the calling thread takes the first chunk
+	for (cl_uint t = 1; t < nt; ++t)
+		if (pthread_create(tid + t, NULL, worker, jobs + t)) {
+			// couldn't start the thread: do its work here
+			worker(jobs + t);
+			tid[t] = pthread_self();
+		}
+	worker(jobs);
+	for (cl_uint t = 1; t < nt; ++t)
+		if (!pthread_equal(tid[t], pthread_self()))
+			pthread_join(tid[t], NULL);
+	return nt;
+}
+
+// fill the n floats at dst with val
+void par_fill(float *dst, size_t n, float val)
+{
+	struct par_job jobs[PAR_MAX_THREADS] = { { .dst = dst, .val = val } };
+	par_run(par_fill_worker, jobs, n);
+}
+
+// count the floats at src that differ from expected, setting *first_bad
+// to the index of the first of them (n if none)
+size_t par_check(const float *src, size_t n, float expected, size_t *first_bad)
+{
+	struct par_job jobs[PAR_MAX_THREADS] = { { .src = src, .val = expected } };
+	const cl_uint nt = par_run(par_check_worker, jobs, n);
+	size_t nbad = 0;
+
+	*first_bad = n;
+	for (cl_uint t = 0; t < nt; ++t) {
+		nbad += jobs[t].nbad;
+		if (jobs[t].nbad && jobs[t].first_bad < *first_bad)
+			*first_bad = jobs[t].first_bad;
+	}
+	return nbad;
+}